@@ -0,0 +1,70 @@
+#!/bin/bash
+
+# Compare how long LLVM takes to compile the shipped
+# tools with and without --fast-compile
+#
+
+set -o pipefail
+set -e
+set -u
+
+if [[ "$#" -ne 2 ]]; then
+  echo "Compare LLVM compile times with and without --fast-compile"
+  echo ""
+  echo "USAGE:"
+  echo "$(basename $0) <bpftrace> <tooldir>"
+  echo ""
+  echo "EXAMPLE:"
+  echo "$(basename $0) bpftrace /vagrant/tools"
+  echo ""
+  exit 1
+fi
+
+TOOLDIR=$2
+BPF=$(command -v "$1") || ( echo "ERROR: $1 not found"; exit 1 )
+[[ -d "$TOOLDIR" ]] || (echo "tooldir does not appear to be a directory: ${TOOLDIR}"; exit 1)
+
+# Seconds to give a tool to attach its probes
+ATTACH_TIMEOUT=30
+# Runs of each tool in each mode, the fastest one counts
+RUNS=3
+
+set +e
+
+# Milliseconds spent in the LLVM phases of --timings, tools run until
+# interrupted and print these once they're attached
+function compile_ms() {
+    local best=""
+    for i in $(seq $RUNS); do
+        local ms
+        ms=$(timeout -s INT $ATTACH_TIMEOUT "$@" 2>/dev/null |
+            grep -m 1 '"type": "timings"' |
+            python3 -c 'import sys, json
+phases = json.load(sys.stdin)["data"]["phases"]
+print("%.1f" % sum(p["wall_ms"] for p in phases if p["name"].startswith("llvm")))')
+        [[ $? -ne 0 ]] && return 1
+        if [[ -z $best ]] || python3 -c "import sys; sys.exit(not $ms < $best)"; then
+            best=$ms
+        fi
+    done
+    echo $best
+}
+
+echo "Using version $($BPF -V)"
+printf "%-24s %12s %12s\n" "tool" "full (ms)" "fast (ms)"
+
+TOTAL_FULL=0
+TOTAL_FAST=0
+for script in ${TOOLDIR}/*.bt; do
+    s=$(basename ${script/.bt/})
+    full=$(compile_ms env BPFTRACE_FAST_COMPILE_INSNS=0 "$BPF" -f json --timings "$script") &&
+        fast=$(compile_ms "$BPF" -f json --timings --fast-compile "$script")
+    if [ $? -ne 0 ]; then
+        echo "bpftrace failed on script: ${s}"
+        continue
+    fi
+    printf "%-24s %12s %12s\n" "$s" "$full" "$fast"
+    TOTAL_FULL=$(python3 -c "print('%.1f' % ($TOTAL_FULL + $full))")
+    TOTAL_FAST=$(python3 -c "print('%.1f' % ($TOTAL_FAST + $fast))")
+done
+printf "%-24s %12s %12s\n" "total" "$TOTAL_FULL" "$TOTAL_FAST"
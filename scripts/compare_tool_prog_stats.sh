@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# Compare the size of the programs loaded for the
+# shipped tools between two bpftrace builds
+#
+
+set -o pipefail
+set -e
+set -u
+
+if [[ "$#" -ne 3 ]]; then
+  echo "Compare loaded program sizes between two bpftrace builds"
+  echo ""
+  echo "USAGE:"
+  echo "$(basename $0) <bpftrace_A> <bpftrace_B> <tooldir>"
+  echo ""
+  echo "EXAMPLE:"
+  echo "$(basename $0) bpftrace bpftrace_master /vagrant/tools"
+  echo ""
+  exit 1
+fi
+
+TOOLDIR=$3
+BPF_A=$(command -v "$1") || ( echo "ERROR: $1 not found"; exit 1 )
+BPF_B=$(command -v "$2") || ( echo "ERROR: $2 not found"; exit 1 )
+[[ -d "$TOOLDIR" ]] || (echo "tooldir does not appear to be a directory: ${TOOLDIR}"; exit 1)
+
+# Seconds to give a tool to attach its probes
+ATTACH_TIMEOUT=30
+
+TMPDIR=$(mktemp -d)
+[[ $? -ne 0 || -z $TMPDIR ]] && (echo "Failed to create tmp dir"; exit 10)
+
+cd $TMPDIR
+set +e
+
+# Tools run until interrupted, the statistics are printed once they're attached
+function prog_stats() {
+    timeout -s INT $ATTACH_TIMEOUT "$1" -f json --prog-stats "$2" 2>/dev/null |
+        grep -m 1 '"type": "prog_stats"'
+}
+
+# Print every program which got bigger or needs more verifier work in B
+function compare() {
+    python3 - "$1" "$2" <<'PYEOF'
+import json, sys
+
+def load(path):
+    with open(path) as f:
+        return {p["name"]: p for p in json.load(f)["data"]}
+
+a, b = load(sys.argv[1]), load(sys.argv[2])
+grown = False
+for name in sorted(set(a) | set(b)):
+    if name not in a or name not in b:
+        print("{}: only loaded by {}".format(name, "A" if name in a else "B"))
+        grown = True
+        continue
+    for field in ("xlated_insns", "jited_bytes", "verified_insns", "stack_depth"):
+        if b[name][field] > a[name][field]:
+            print("{}: {} {} -> {}".format(name, field, a[name][field], b[name][field]))
+            grown = True
+sys.exit(1 if grown else 0)
+PYEOF
+}
+
+echo "Using version $($BPF_A -V) and $($BPF_B -V)"
+
+EXIT_STATUS=0
+for script in ${TOOLDIR}/*.bt; do
+    s=$(basename ${script/.bt/})
+    echo "Checking $s"
+    prog_stats "$BPF_A" "$script" > "a_${s}" && prog_stats "$BPF_B" "$script" > "b_${s}"
+    if [ $? -ne 0 ]; then
+        echo "###############################"
+        echo "bpftrace failed on script: ${s}"
+        echo "###############################"
+        continue
+    fi
+    if ! compare "a_${s}" "b_${s}"; then
+        echo "###############################"
+        echo "Programs grew for script: ${s}"
+        echo "###############################"
+        EXIT_STATUS=1
+    fi
+done
+
+[[ -n ${TMPDIR} ]] && rm -rf "${TMPDIR}"
+exit $EXIT_STATUS
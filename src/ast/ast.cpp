@@ -460,6 +460,15 @@ std::string opstr(Jump &jump)
   return {}; // unreached
 }
 
+bool is_print_delta(const Call &call)
+{
+  if (call.func != "print" || !call.vargs || call.vargs->size() < 2)
+    return false;
+
+  auto *mode = dynamic_cast<Identifier *>(call.vargs->at(1).get());
+  return mode && mode->ident == "delta";
+}
+
 std::string opstr(Binop &binop)
 {
   switch (binop.op) {
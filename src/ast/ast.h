@@ -377,6 +377,7 @@ public:
   std::string name() const;
   bool need_expansion = false;        // must build a BPF program per wildcard match
   bool need_tp_args_structs = false;  // must import struct for tracepoints
+  bool splittable = false;            // may be split into tail called programs
 
   int index();
   void set_index(int index);
@@ -430,5 +431,9 @@ std::string opstr(Binop &binop);
 std::string opstr(Unop &unop);
 std::string opstr(Jump &jump);
 
+// print(@map, delta) emits only the entries that changed since the last
+// delta print of the same map
+bool is_print_delta(const Call &call);
+
 } // namespace ast
 } // namespace bpftrace
@@ -6,26 +6,65 @@
 #include "codegen_helper.h"
 #include "log.h"
 #include "parser.tab.hh"
+#include "qhist.h"
+#include "sketch.h"
 #include "tracepoint_format_parser.h"
 #include "types.h"
 #include "usdt.h"
 #include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <cerrno>
+#include <cmath>
 #include <csignal>
 #include <ctime>
 #include <fstream>
+#include <functional>
+#include <thread>
 
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Scalar.h>
+#if LLVM_VERSION_MAJOR >= 7
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Utils.h>
+#endif
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm-c/Transforms/IPO.h>
 
 namespace bpftrace {
 namespace ast {
 
+namespace {
+
+// Calls fn(0) to fn(n - 1), spread over up to max_threads threads
+void parallel_for(size_t n,
+                  size_t max_threads,
+                  const std::function<void(size_t)> &fn)
+{
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < n; i = next++)
+      fn(i);
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(n, max_threads); i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+} // namespace
+
 CodegenLLVM::CodegenLLVM(Node *root, BPFtrace &bpftrace)
     : root_(root),
       module_(std::make_unique<Module>("bpftrace", context_)),
@@ -38,17 +77,8 @@ CodegenLLVM::CodegenLLVM(Node *root, BPFtrace &bpftrace)
   LLVMInitializeBPFTargetMC();
   LLVMInitializeBPFAsmPrinter();
 
-  std::string targetTriple = "bpf-pc-linux";
-  module_->setTargetTriple(targetTriple);
-
-  std::string error;
-  const Target *target = TargetRegistry::lookupTarget(targetTriple, error);
-  if (!target)
-    throw std::runtime_error("Could not create LLVM target " + error);
-
-  TargetOptions opt;
-  auto RM = Reloc::Model();
-  TM_ = target->createTargetMachine(targetTriple, "generic", "", opt, RM);
+  module_->setTargetTriple("bpf-pc-linux");
+  TM_ = createTargetMachine();
   module_->setDataLayout(TM_->createDataLayout());
   layout_ = DataLayout(module_.get());
   orc_ = std::make_unique<BpfOrc>(TM_);
@@ -450,6 +480,75 @@ void CodegenLLVM::visit(Call &call)
     b_.CreateLifetimeEnd(newval);
     expr_ = nullptr;
   }
+  else if (call.func == "bhist")
+  {
+    Map &map = *call.map;
+    auto scoped_del = accept(call.vargs->front().get());
+    Value *value = b_.CreateIntCast(expr_,
+                                    b_.getInt64Ty(),
+                                    call.vargs->front()->type.IsSigned());
+    Value *bucket = createBucketSearch(
+        value, bpftrace_.maps[map.ident].value()->bhist_bounds);
+
+    // All buckets of a key share one map value, count in place
+    AllocaInst *key = getMapKey(map);
+    Value *counters = b_.CreateLookupOrInitElem(ctx_, map, key, call.loc);
+    Function *parent = b_.GetInsertBlock()->getParent();
+    BasicBlock *notzero = BasicBlock::Create(module_->getContext(),
+                                             "bhist_notzero",
+                                             parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                          "bhist_done",
+                                          parent);
+    b_.CreateCondBr(
+        b_.CreateICmpNE(counters,
+                        ConstantExpr::getCast(Instruction::IntToPtr,
+                                              b_.getInt64(0),
+                                              b_.getInt8PtrTy()),
+                        "bhist_cond"),
+        notzero,
+        done);
+
+    b_.SetInsertPoint(notzero);
+    Value *counter = b_.CreateGEP(
+        b_.CreatePointerCast(counters, b_.getInt64Ty()->getPointerTo()),
+        bucket);
+    b_.CreateStore(b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), counter),
+                                b_.getInt64(1)),
+                   counter);
+    b_.CreateBr(done);
+    b_.SetInsertPoint(done);
+
+    b_.CreateLifetimeEnd(key);
+    expr_ = nullptr;
+  }
+  else if (call.func == "qhist")
+  {
+    if (!qhist_func_)
+      qhist_func_ = createQhistFunction();
+
+    Map &map = *call.map;
+    auto scoped_del = accept(call.vargs->front().get());
+    // promote int to 64-bit
+    expr_ = b_.CreateIntCast(expr_,
+                             b_.getInt64Ty(),
+                             call.vargs->front()->type.IsSigned());
+    int precision = bpftrace_.maps[map.ident].value()->qprecision;
+    Value *index = b_.CreateCall(qhist_func_,
+                                 { expr_, b_.getInt64(precision) },
+                                 "qhist");
+    AllocaInst *key = getHistMapKey(map, index);
+
+    Value *oldval = b_.CreateMapLookupElem(ctx_, map, key, call.loc);
+    AllocaInst *newval = b_.CreateAllocaBPF(map.type, map.ident + "_val");
+    b_.CreateStore(b_.CreateAdd(oldval, b_.getInt64(1)), newval);
+    b_.CreateMapUpdateElem(ctx_, map, key, newval, call.loc);
+
+    // oldval can only be an integer so won't be in memory and doesn't need lifetime end
+    b_.CreateLifetimeEnd(key);
+    b_.CreateLifetimeEnd(newval);
+    expr_ = nullptr;
+  }
   else if (call.func == "lhist")
   {
     if (!linear_func_)
@@ -497,6 +596,138 @@ void CodegenLLVM::visit(Call &call)
     b_.CreateLifetimeEnd(newval);
     expr_ = nullptr;
   }
+  else if (call.func == "topk")
+  {
+    Map &map = *call.map;
+    auto &arg = *call.vargs->at(0);
+    auto scoped_del = accept(&arg);
+    AllocaInst *key = createSketchKey(arg, map.ident + "_key");
+
+    // Count it in every sketch row, see sketch.h for the userspace side
+    Value *hash = createSketchHash(key);
+
+    Function *parent = b_.GetInsertBlock()->getParent();
+    for (int row = 0; row < TOPK_SKETCH_DEPTH; row++)
+    {
+      Value *column = b_.CreateLShr(
+          b_.CreateMul(b_.CreateXor(hash, b_.getInt64(SKETCH_ROW_SEEDS[row])),
+                       b_.getInt64(SKETCH_HASH_MULT)),
+          64 - TOPK_SKETCH_WIDTH_BITS);
+      Value *counters = b_.CreateGetSketchRow(ctx_, map, row, call.loc);
+      BasicBlock *notzero = BasicBlock::Create(module_->getContext(),
+                                               "sketch_notzero",
+                                               parent);
+      BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                            "sketch_done",
+                                            parent);
+      b_.CreateCondBr(
+          b_.CreateICmpNE(counters,
+                          ConstantExpr::getCast(Instruction::IntToPtr,
+                                                b_.getInt64(0),
+                                                b_.getInt8PtrTy()),
+                          "sketch_cond"),
+          notzero,
+          done);
+
+      b_.SetInsertPoint(notzero);
+      Value *counter = b_.CreateGEP(
+          b_.CreatePointerCast(counters, b_.getInt64Ty()->getPointerTo()),
+          column);
+      b_.CreateStore(b_.CreateAdd(b_.CreateLoad(b_.getInt64Ty(), counter),
+                                  b_.getInt64(1)),
+                     counter);
+      b_.CreateBr(done);
+      b_.SetInsertPoint(done);
+    }
+
+    // Remember the key as a candidate. Looking it up is enough to keep a
+    // known key from being evicted from the LRU table.
+    AllocaInst *seen = b_.CreateAllocaBPF(map.type, map.ident + "_val");
+    b_.CreateStore(b_.getInt64(0), seen);
+    Value *found = b_.CreateMapLookupElem(ctx_, map, key, call.loc);
+    BasicBlock *insert = BasicBlock::Create(module_->getContext(),
+                                            "topk_insert",
+                                            parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                          "topk_done",
+                                          parent);
+    b_.CreateCondBr(b_.CreateICmpEQ(found, b_.getInt64(0)), insert, done);
+    b_.SetInsertPoint(insert);
+    b_.CreateStore(b_.getInt64(1), seen);
+    b_.CreateMapUpdateElem(ctx_, map, key, seen, call.loc);
+    b_.CreateBr(done);
+    b_.SetInsertPoint(done);
+
+    b_.CreateLifetimeEnd(key);
+    b_.CreateLifetimeEnd(seen);
+    expr_ = nullptr;
+  }
+  else if (call.func == "distinct")
+  {
+    Map &map = *call.map;
+    auto &arg = *call.vargs->at(0);
+    auto scoped_del = accept(&arg);
+
+    // Hash the value, see sketch.h for the userspace side
+    AllocaInst *value = createSketchKey(arg, map.ident + "_distinct");
+    Value *hash = createSketchHash(value);
+    b_.CreateLifetimeEnd(value);
+    hash = b_.CreateXor(hash, b_.CreateLShr(hash, 32));
+    hash = b_.CreateMul(hash, b_.getInt64(SKETCH_HASH_MULT));
+    hash = b_.CreateXor(hash, b_.CreateLShr(hash, 29));
+
+    // The top bits pick the register, the rank is the number of leading
+    // zeros in the rest plus one. The guard bit caps the rank at
+    // 64 - precision + 1 when the rest is all zeros.
+    int precision = std::log2(map.type.size);
+    Value *index = b_.CreateLShr(hash, 64 - precision);
+    Value *rest = b_.CreateOr(b_.CreateShl(hash, precision),
+                              b_.getInt64(1ULL << (precision - 1)));
+    // BPF has no instruction to count leading zeros, and the BPF backend
+    // can't lower llvm.ctlz, so binary search for the highest set bit
+    Value *zeros = b_.getInt64(0);
+    for (int bits = 32; bits > 0; bits /= 2)
+    {
+      Value *top_clear = b_.CreateICmpEQ(b_.CreateLShr(rest, 64 - bits),
+                                         b_.getInt64(0));
+      rest = b_.CreateSelect(top_clear, b_.CreateShl(rest, bits), rest);
+      zeros = b_.CreateSelect(top_clear,
+                              b_.CreateAdd(zeros, b_.getInt64(bits)),
+                              zeros);
+    }
+    Value *rank = b_.CreateIntCast(b_.CreateAdd(zeros, b_.getInt64(1)),
+                                   b_.getInt8Ty(),
+                                   false);
+
+    AllocaInst *key = getMapKey(map);
+    Value *registers = b_.CreateLookupOrInitElem(ctx_, map, key, call.loc);
+    Function *parent = b_.GetInsertBlock()->getParent();
+    BasicBlock *notzero = BasicBlock::Create(module_->getContext(),
+                                             "distinct_notzero",
+                                             parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                          "distinct_done",
+                                          parent);
+    b_.CreateCondBr(
+        b_.CreateICmpNE(registers,
+                        ConstantExpr::getCast(Instruction::IntToPtr,
+                                              b_.getInt64(0),
+                                              b_.getInt8PtrTy()),
+                        "distinct_cond"),
+        notzero,
+        done);
+
+    b_.SetInsertPoint(notzero);
+    Value *reg = b_.CreateGEP(registers, index);
+    Value *old = b_.CreateLoad(b_.getInt8Ty(), reg);
+    b_.CreateStore(b_.CreateSelect(b_.CreateICmpUGT(rank, old), rank, old),
+                   reg);
+    b_.CreateBr(done);
+    b_.SetInsertPoint(done);
+
+    b_.CreateLifetimeEnd(key);
+    expr_ = nullptr;
+  }
   else if (call.func == "delete")
   {
     auto &arg = *call.vargs->at(0);
@@ -651,18 +882,39 @@ void CodegenLLVM::visit(Call &call)
 
     // arg0
     b_.SetInsertPoint(notzero);
-    b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::join)), perfdata);
-    b_.CreateStore(b_.getInt64(join_id_),
-                   b_.CreateGEP(perfdata, b_.getInt64(8)));
+    Value *header = b_.CreatePointerCast(perfdata,
+                                         b_.getInt64Ty()->getPointerTo());
+    b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::join)), header);
+    b_.CreateStore(b_.getInt64(join_id_), b_.CreateGEP(header, b_.getInt64(1)));
     join_id_++;
+
+    // Arguments are packed one after the other at their actual length, and
+    // the first one that is empty or can't be read ends the list. Their
+    // number goes in front of them, the buffer and the perf event padding
+    // behind them hold stale data.
+    Value *end = b_.getInt64(8 + 8 + 8);
+    Value *more = b_.getInt1(true);
+    Value *nargs = b_.getInt64(0);
+    auto pack_arg = [&](Value *str) {
+      CallInst *len = b_.CreateProbeReadStr(ctx_,
+                                            b_.CreateGEP(perfdata, end),
+                                            bpftrace_.join_argsize_,
+                                            str,
+                                            addrspace,
+                                            call.loc);
+      // Bounds the next offset for the verifier
+      more = b_.CreateAnd(
+          more,
+          b_.CreateAnd(b_.CreateICmpUGT(len, b_.getInt64(1)),
+                       b_.CreateICmpULE(len,
+                                        b_.getInt64(bpftrace_.join_argsize_))));
+      end = b_.CreateAdd(end, b_.CreateSelect(more, len, b_.getInt64(0)));
+      nargs = b_.CreateAdd(nargs, b_.CreateZExt(more, b_.getInt64Ty()));
+    };
+
     AllocaInst *arr = b_.CreateAllocaBPF(b_.getInt64Ty(), call.func + "_r0");
     b_.CreateProbeRead(ctx_, arr, 8, expr_, addrspace, call.loc);
-    b_.CreateProbeReadStr(ctx_,
-                          b_.CreateAdd(perfdata, b_.getInt64(8 + 8)),
-                          bpftrace_.join_argsize_,
-                          b_.CreateLoad(arr),
-                          addrspace,
-                          call.loc);
+    pack_arg(b_.CreateLoad(arr));
 
     for (unsigned int i = 1; i < bpftrace_.join_argnum_; i++)
     {
@@ -670,21 +922,12 @@ void CodegenLLVM::visit(Call &call)
       b_.CreateStore(b_.CreateAdd(expr_, b_.getInt64(8 * i)), first);
       b_.CreateProbeRead(
           ctx_, second, 8, b_.CreateLoad(first), addrspace, call.loc);
-      b_.CreateProbeReadStr(
-          ctx_,
-          b_.CreateAdd(perfdata,
-                       b_.getInt64(8 + 8 + i * bpftrace_.join_argsize_)),
-          bpftrace_.join_argsize_,
-          b_.CreateLoad(second),
-          addrspace,
-          call.loc);
+      pack_arg(b_.CreateLoad(second));
     }
 
     // emit
-    b_.CreatePerfEventOutput(
-        ctx_,
-        perfdata,
-        8 + 8 + bpftrace_.join_argnum_ * bpftrace_.join_argsize_);
+    b_.CreateStore(nargs, b_.CreateGEP(header, b_.getInt64(2)));
+    b_.CreatePerfEventOutput(ctx_, perfdata, end);
 
     b_.CreateBr(zero);
 
@@ -692,6 +935,89 @@ void CodegenLLVM::visit(Call &call)
     b_.SetInsertPoint(zero);
     expr_ = nullptr;
   }
+  else if (call.func == "ratelimit" || call.func == "sample")
+  {
+    auto &rate = static_cast<Integer &>(*call.vargs->at(0));
+    AllocaInst *result = b_.CreateAllocaBPF(b_.getInt64Ty(),
+                                            call.func + "_result");
+    b_.CreateStore(b_.getInt64(0), result);
+
+    Value *state;
+    if (call.vargs->size() == 1)
+    {
+      state = b_.CreateGetRatelimitState(ctx_, ratelimit_id_, call.loc);
+      ratelimit_id_++;
+    }
+    else
+    {
+      auto &arg = *call.vargs->at(1);
+      auto scoped_del = accept(&arg);
+      size_t key_size = 8 + bpftrace_.ratelimit_key_size_;
+      AllocaInst *key = b_.CreateAllocaBPF(key_size, call.func + "_key");
+      b_.CREATE_MEMSET(key, b_.getInt8(0), key_size, 1);
+      b_.CreateStore(b_.getInt64(keyed_ratelimit_id_),
+                     b_.CreatePointerCast(key,
+                                          b_.getInt64Ty()->getPointerTo()));
+      Value *dst = b_.CreateGEP(key, { b_.getInt64(0), b_.getInt64(8) });
+      if (arg.type.IsStringTy())
+        b_.CREATE_MEMCPY(dst, expr_, arg.type.size, 1);
+      else
+        b_.CreateStore(
+            b_.CreateIntCast(expr_, b_.getInt64Ty(), arg.type.IsSigned()),
+            b_.CreatePointerCast(dst, b_.getInt64Ty()->getPointerTo()));
+      state = b_.CreateGetKeyedRatelimitState(ctx_, key, call.loc);
+      b_.CreateLifetimeEnd(key);
+      keyed_ratelimit_id_++;
+    }
+    Function *parent = b_.GetInsertBlock()->getParent();
+    BasicBlock *notzero = BasicBlock::Create(module_->getContext(),
+                                             call.func + "_notzero",
+                                             parent);
+    BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                          call.func + "_done",
+                                          parent);
+    b_.CreateCondBr(b_.CreateICmpNE(state,
+                                    ConstantExpr::getCast(Instruction::IntToPtr,
+                                                          b_.getInt64(0),
+                                                          b_.getInt8PtrTy()),
+                                    call.func + "_cond"),
+                    notzero,
+                    done);
+
+    b_.SetInsertPoint(notzero);
+    Value *ptr = b_.CreatePointerCast(state, b_.getInt64Ty()->getPointerTo());
+    Value *old = b_.CreateLoad(b_.getInt64Ty(), ptr);
+    Value *hit;
+    if (call.func == "sample")
+    {
+      // Counts calls on this CPU, every Nth one is let through
+      Value *next = b_.CreateAdd(old, b_.getInt64(1));
+      hit = b_.CreateICmpUGE(next, b_.getInt64(rate.n));
+      b_.CreateStore(b_.CreateSelect(hit, b_.getInt64(0), next), ptr);
+    }
+    else
+    {
+      // Token bucket holding up to N tokens and refilled at N per second,
+      // stored as the time the bucket will next be full (GCRA). An event
+      // passes if that time is less than a second ahead of now.
+      uint64_t period = 1000000000 / rate.n;
+      Value *now = b_.CreateGetNs(
+          bpftrace_.feature_.has_helper_ktime_get_boot_ns());
+      hit = b_.CreateICmpULE(
+          old, b_.CreateAdd(now, b_.getInt64(1000000000 - period)));
+      Value *start = b_.CreateSelect(b_.CreateICmpUGT(old, now), old, now);
+      b_.CreateStore(b_.CreateSelect(hit,
+                                     b_.CreateAdd(start, b_.getInt64(period)),
+                                     old),
+                     ptr);
+    }
+    b_.CreateStore(b_.CreateZExt(hit, b_.getInt64Ty()), result);
+    b_.CreateBr(done);
+
+    b_.SetInsertPoint(done);
+    expr_ = b_.CreateLoad(result);
+    b_.CreateLifetimeEnd(result);
+  }
   else if (call.func == "ksym")
   {
     // We want expr_ to just pass through from the child node - don't set it here
@@ -1919,6 +2245,26 @@ void CodegenLLVM::generateProbe(Probe &probe,
   BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", func);
   b_.SetInsertPoint(entry);
 
+  // kfunc programs aren't guarded against running nested on the same CPU, so
+  // they can't share a scratch buffer
+  if (std::none_of(probe.attach_points->begin(),
+                   probe.attach_points->end(),
+                   [](auto &ap) {
+                     ProbeType type = probetype(ap->provider);
+                     return type == ProbeType::kfunc ||
+                            type == ProbeType::kretfunc;
+                   }))
+    scratch_funcs_.push_back(func);
+  scratch_pinned_size_ = 0;
+
+  // Subprograms can't be shared across sections, see createHelperFunction()
+  if (bpftrace_.helper_subprograms_)
+  {
+    log2_func_ = nullptr;
+    linear_func_ = nullptr;
+    qhist_func_ = nullptr;
+  }
+
   // check: do the following 8 lines need to be in the wildcard loop?
   ctx_ = func->arg_begin();
   if (probe.pred)
@@ -1926,11 +2272,281 @@ void CodegenLLVM::generateProbe(Probe &probe,
     auto scoped_del = accept(probe.pred.get());
   }
   variables_.clear();
-  for (auto &stmt : *probe.stmts)
+
+  // Probes whose program turned out too large for the kernel are split into
+  // parts of about split_insns IR instructions, see
+  // BPFtrace::split_large_probes()
+  std::string probe_section = func->getSection().str();
+  auto split = bpftrace_.split_sections_.find(probe_section);
+  uint64_t split_insns = split != bpftrace_.split_sections_.end()
+                             ? split->second
+                             : 0;
+  uint64_t insns = 0;
+  int part = 0;
+  for (size_t i = 0; i < probe.stmts->size(); i++)
   {
-    auto scoped_del = accept(stmt.get());
+    {
+      auto scoped_del = accept(probe.stmts->at(i).get());
+    }
+    if (split_insns > 0 && i + 1 < probe.stmts->size() &&
+        needSplit(func, part, split_insns))
+    {
+      insns += countInsns(func);
+      func = splitProbe(func, probe_section, ++part);
+    }
+  }
+  b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+  if (probe.splittable)
+    probe_insns_[probe_section] = insns + countInsns(func);
+}
+
+uint64_t CodegenLLVM::countInsns(Function *func)
+{
+  uint64_t insns = 0;
+  for (auto &block : *func)
+    insns += block.size();
+  return insns;
+}
+
+// Whether the part of a probe being generated has grown large enough to
+// carry on in a new one
+bool CodegenLLVM::needSplit(Function *func, int part, uint64_t split_insns)
+{
+  if (part >= MAX_TAIL_CALLS || tail_call_slot_ >= TAIL_CALL_SLOTS)
+    return false;
+
+  size_t vars_size = 0;
+  for (auto &var : variables_)
+    vars_size += alignTo(
+        layout_.getTypeAllocSize(var.second->getAllocatedType()), 8);
+  if (vars_size > bpftrace_.tail_call_scratch_size_)
+    return false;
+
+  return countInsns(func) > split_insns;
+}
+
+// Ends the program being generated with a tail call into a new program for
+// the rest of the probe, and returns the latter. The BPF stack doesn't survive
+// a tail call, so variables are handed over in the per-CPU scratch buffer.
+Function *CodegenLLVM::splitProbe(Function *func,
+                                  const std::string &probe_section,
+                                  int part)
+{
+  std::vector<std::tuple<std::string, AllocaInst *, size_t>> vars;
+  size_t offset = 0;
+  for (auto &var : variables_)
+  {
+    vars.emplace_back(var.first, var.second, offset);
+    offset += alignTo(
+        layout_.getTypeAllocSize(var.second->getAllocatedType()), 8);
+  }
+  auto var_size = [this](AllocaInst *var) {
+    return layout_.getTypeAllocSize(var->getAllocatedType());
+  };
+  Value *null = ConstantExpr::getCast(Instruction::IntToPtr,
+                                      b_.getInt64(0),
+                                      b_.getInt8PtrTy());
+
+  if (bpftrace_.helper_subprograms_)
+  {
+    // Kernels before 5.10 reject programs with both BPF-to-BPF calls and
+    // tail calls, so this part inlines its helpers after all
+    for (Function *helper : { log2_func_, linear_func_, qhist_func_ })
+    {
+      if (!helper)
+        continue;
+      helper->removeFnAttr(Attribute::NoInline);
+      helper->addFnAttr(Attribute::AlwaysInline);
+      helper->setSection("helpers");
+    }
+    log2_func_ = nullptr;
+    linear_func_ = nullptr;
+    qhist_func_ = nullptr;
+  }
+
+  // Like for the probe itself the function isn't named after its section,
+  // LLVM can't emit a global symbol with the name of a section
+  int slot = tail_call_slot_++;
+  std::string name = probe_section.substr(2) + "_tail" + std::to_string(part);
+  std::string section = "s_" + name;
+  bpftrace_.tail_call_sections_[probe_section].emplace_back(slot, section);
+
+  BasicBlock *save = BasicBlock::Create(module_->getContext(),
+                                        "tail_call_save",
+                                        func);
+  BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                        "tail_call_failed",
+                                        func);
+  Value *scratch = b_.CreateGetScratch(MapManager::Type::TailCallScratch);
+  b_.CreateCondBr(b_.CreateICmpNE(scratch, null, "scratch_cond"), save, done);
+  b_.SetInsertPoint(save);
+  for (auto &[name, var, var_offset] : vars)
+    b_.CREATE_MEMCPY(b_.CreateGEP(scratch, b_.getInt64(var_offset)),
+                     var,
+                     var_size(var),
+                     1);
+  b_.CreateTailCall(ctx_, slot);
+  b_.CreateBr(done);
+  b_.SetInsertPoint(done);
+  b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+
+  Function *next = Function::Create(func->getFunctionType(),
+                                    Function::ExternalLinkage,
+                                    name,
+                                    module_.get());
+  next->setSection(section);
+  scratch_funcs_.push_back(next);
+  scratch_pinned_size_ = 0;
+  BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", next);
+  BasicBlock *restore = BasicBlock::Create(module_->getContext(),
+                                           "tail_call_restore",
+                                           next);
+  BasicBlock *failed = BasicBlock::Create(module_->getContext(),
+                                          "tail_call_no_scratch",
+                                          next);
+  b_.SetInsertPoint(entry);
+  ctx_ = next->arg_begin();
+  scratch = b_.CreateGetScratch(MapManager::Type::TailCallScratch);
+  b_.CreateCondBr(b_.CreateICmpNE(scratch, null, "scratch_cond"),
+                  restore,
+                  failed);
+  b_.SetInsertPoint(failed);
+  b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+
+  b_.SetInsertPoint(restore);
+  for (auto &[name, var, var_offset] : vars)
+  {
+    AllocaInst *val = b_.CreateAllocaBPF(var->getAllocatedType(), name);
+    b_.CREATE_MEMCPY(val,
+                     b_.CreateGEP(scratch, b_.getInt64(var_offset)),
+                     var_size(var),
+                     1);
+    variables_[name] = val;
+  }
+  return next;
+}
+
+// Picks the largest temporaries of a program to move from the BPF stack into
+// the per-CPU scratch buffer, until what is left fits in SCRATCH_STACK_BUDGET,
+// and their offsets in it. Pinned temporaries always move. Programs don't
+// nest on a CPU, so each of them gets the whole buffer.
+std::vector<std::pair<AllocaInst *, uint64_t>> CodegenLLVM::pickScratchAllocas(
+    Function *func)
+{
+  std::vector<std::pair<AllocaInst *, uint64_t>> moved;
+  auto alloca_size = [this](AllocaInst *alloca) {
+    return alignTo(layout_.getTypeAllocSize(alloca->getAllocatedType()), 8);
+  };
+
+  std::vector<AllocaInst *> allocas;
+  uint64_t stack_size = 0;
+  bool pinned = false;
+  for (auto &inst : func->getEntryBlock())
+  {
+    auto *alloca = dyn_cast<AllocaInst>(&inst);
+    if (!alloca || !alloca->isStaticAlloca() || alloca->isArrayAllocation())
+      continue;
+    allocas.push_back(alloca);
+    stack_size += alloca_size(alloca);
+    pinned |= scratch_pinned_.count(alloca) > 0;
+  }
+  if (stack_size <= SCRATCH_STACK_BUDGET && !pinned)
+    return moved;
+
+  std::stable_sort(allocas.begin(),
+                   allocas.end(),
+                   [&](AllocaInst *a, AllocaInst *b) {
+                     bool a_pinned = scratch_pinned_.count(a) > 0;
+                     bool b_pinned = scratch_pinned_.count(b) > 0;
+                     if (a_pinned != b_pinned)
+                       return a_pinned;
+                     return alloca_size(a) > alloca_size(b);
+                   });
+  uint64_t offset = 0;
+  for (AllocaInst *alloca : allocas)
+  {
+    bool must_move = scratch_pinned_.count(alloca) > 0;
+    if (stack_size <= SCRATCH_STACK_BUDGET && !must_move)
+      break;
+    uint64_t size = alloca_size(alloca);
+    if (offset + size > bpftrace_.scratch_size_)
+    {
+      assert(!must_move);
+      continue;
+    }
+    moved.emplace_back(alloca, offset);
+    offset += size;
+    stack_size -= size;
   }
+  return moved;
+}
+
+// Moves the temporaries picked by pickScratchAllocas() to the scratch buffer
+void CodegenLLVM::moveAllocasToScratch(Function *func)
+{
+  auto moved = pickScratchAllocas(func);
+  if (moved.empty())
+    return;
+
+  BasicBlock &entry = func->getEntryBlock();
+  std::vector<AllocaInst *> allocas;
+  for (auto &inst : entry)
+  {
+    auto *alloca = dyn_cast<AllocaInst>(&inst);
+    if (alloca && alloca->isStaticAlloca() && !alloca->isArrayAllocation())
+      allocas.push_back(alloca);
+  }
+
+  // The buffer is looked up in a new entry block, which also takes over the
+  // allocas staying on the stack
+  BasicBlock *lookup = BasicBlock::Create(module_->getContext(),
+                                          "scratch_lookup",
+                                          func,
+                                          &entry);
+  BasicBlock *failed = BasicBlock::Create(module_->getContext(),
+                                          "scratch_failed",
+                                          func);
+  for (AllocaInst *alloca : allocas)
+  {
+    alloca->removeFromParent();
+    lookup->getInstList().push_back(alloca);
+  }
+  b_.SetInsertPoint(lookup);
+  Value *scratch = b_.CreateGetScratch(MapManager::Type::Scratch);
+  Value *null = ConstantExpr::getCast(Instruction::IntToPtr,
+                                      b_.getInt64(0),
+                                      b_.getInt8PtrTy());
+  b_.CreateCondBr(b_.CreateICmpNE(scratch, null, "scratch_cond"),
+                  &entry,
+                  failed);
+  b_.SetInsertPoint(failed);
   b_.CreateRet(ConstantInt::get(module_->getContext(), APInt(64, 0)));
+
+  b_.SetInsertPoint(&entry, entry.getFirstInsertionPt());
+  for (auto &[alloca, alloca_offset] : moved)
+  {
+    // Lifetime markers only apply to stack objects
+    std::vector<Value *> ptrs = { alloca };
+    for (User *user : alloca->users())
+      if (isa<BitCastInst>(user))
+        ptrs.push_back(user);
+    std::vector<Instruction *> markers;
+    for (Value *ptr : ptrs)
+      for (User *user : ptr->users())
+        if (auto *intrinsic = dyn_cast<IntrinsicInst>(user))
+          if (intrinsic->getIntrinsicID() == Intrinsic::lifetime_start ||
+              intrinsic->getIntrinsicID() == Intrinsic::lifetime_end)
+            markers.push_back(intrinsic);
+    for (Instruction *marker : markers)
+      marker->eraseFromParent();
+
+    Value *ptr = b_.CreatePointerCast(
+        b_.CreateGEP(scratch, b_.getInt64(alloca_offset)),
+        alloca->getType(),
+        alloca->getName());
+    alloca->replaceAllUsesWith(ptr);
+    alloca->eraseFromParent();
+  }
 }
 
 void CodegenLLVM::visit(Probe &probe)
@@ -1974,6 +2590,8 @@ void CodegenLLVM::visit(Probe &probe)
     int starting_join_id = join_id_;
     int starting_helper_error_id = b_.helper_error_id_;
     int starting_non_map_print_id = non_map_print_id_;
+    int starting_ratelimit_id = ratelimit_id_;
+    int starting_keyed_ratelimit_id = keyed_ratelimit_id_;
 
     auto reset_ids = [&]() {
       printf_id_ = starting_printf_id;
@@ -1984,6 +2602,8 @@ void CodegenLLVM::visit(Probe &probe)
       join_id_ = starting_join_id;
       b_.helper_error_id_ = starting_helper_error_id;
       non_map_print_id_ = starting_non_map_print_id;
+      ratelimit_id_ = starting_ratelimit_id;
+      keyed_ratelimit_id_ = starting_keyed_ratelimit_id;
     };
 
     for (auto &attach_point : *probe.attach_points)
@@ -2098,6 +2718,41 @@ std::string CodegenLLVM::getSectionNameForProbe(const std::string &probe_name, i
   return "s_" + probe_name + "_" + std::to_string(index);
 }
 
+// Copy the value of `arg`, held in expr_, into a buffer zero padded to whole
+// words for hashing
+AllocaInst *CodegenLLVM::createSketchKey(Expression &arg,
+                                         const std::string &name)
+{
+  size_t size = shouldBeOnStackAlready(arg.type) ? arg.type.size : 8;
+  size_t words = (size + 7) / 8;
+  AllocaInst *key = b_.CreateAllocaBPF(words * 8, name);
+  b_.CREATE_MEMSET(key, b_.getInt8(0), words * 8, 1);
+  if (shouldBeOnStackAlready(arg.type))
+    b_.CREATE_MEMCPY(key, expr_, arg.type.size, 1);
+  else
+    b_.CreateStore(
+        b_.CreateIntCast(expr_, b_.getInt64Ty(), arg.type.IsSigned()),
+        b_.CreatePointerCast(key, b_.getInt64Ty()->getPointerTo()));
+  return key;
+}
+
+// sketch_hash() of a buffer made by createSketchKey()
+Value *CodegenLLVM::createSketchHash(AllocaInst *key)
+{
+  size_t words = layout_.getTypeAllocSize(key->getAllocatedType()) / 8;
+  Value *hash = b_.getInt64(0);
+  Value *key_words = b_.CreatePointerCast(key,
+                                          b_.getInt64Ty()->getPointerTo());
+  for (size_t i = 0; i < words; i++)
+  {
+    Value *word = b_.CreateLoad(b_.getInt64Ty(),
+                                b_.CreateGEP(key_words, b_.getInt64(i)));
+    hash = b_.CreateMul(b_.CreateXor(hash, word),
+                        b_.getInt64(SKETCH_HASH_MULT));
+  }
+  return hash;
+}
+
 AllocaInst *CodegenLLVM::getMapKey(Map &map)
 {
   AllocaInst *key;
@@ -2157,7 +2812,16 @@ AllocaInst *CodegenLLVM::getMapKey(Map &map)
   {
     // No map key (e.g., @ = 1;). Use 0 as a key.
     key = b_.CreateAllocaBPF(CreateUInt64(), map.ident + "_key");
-    b_.CreateStore(b_.getInt64(0), key);
+    auto imap = bpftrace_.maps[map.ident];
+    if (imap.has_value() && imap.value()->is_mmapped())
+    {
+      // Memory mapped maps have a slot per CPU instead, see Map::Map
+      b_.CreateStore(b_.CreateMul(b_.CreateGetCpuId(),
+                                  b_.getInt64(MMAP_CPU_STRIDE)),
+                     key);
+    }
+    else
+      b_.CreateStore(b_.getInt64(0), key);
   }
   return key;
 }
@@ -2181,11 +2845,14 @@ AllocaInst *CodegenLLVM::getHistMapKey(Map &map, Value *log2)
       if (shouldBeOnStackAlready(expr->type))
         b_.CREATE_MEMCPY(offset_val, expr_, expr->type.size, 1);
       else
-        b_.CreateStore(expr_, offset_val);
+        b_.CreateStore(
+            expr_,
+            b_.CreatePointerCast(offset_val, expr_->getType()->getPointerTo()));
       offset += expr->type.size;
     }
     Value *offset_val = b_.CreateGEP(key, {b_.getInt64(0), b_.getInt64(offset)});
-    b_.CreateStore(log2, offset_val);
+    b_.CreateStore(
+        log2, b_.CreatePointerCast(offset_val, log2->getType()->getPointerTo()));
   }
   else
   {
@@ -2273,6 +2940,32 @@ Value *CodegenLLVM::createLogicalOr(Binop &binop)
   return b_.CreateLoad(result);
 }
 
+// Helpers become subprograms when the kernel supports BPF-to-BPF calls, and
+// are inlined into every caller otherwise. The loader hands the kernel one ELF
+// section per probe, so a subprogram is emitted into the section of the probe
+// calling it, after the probe itself. String comparisons and USDT argument
+// reads are specialised to the literal, length or argument location of each
+// call site, leaving nothing to share, so IRBuilderBPF keeps them inline.
+Function *CodegenLLVM::createHelperFunction(const std::string &name,
+                                            FunctionType *func_type)
+{
+  Function *func = Function::Create(func_type,
+                                    Function::InternalLinkage,
+                                    name,
+                                    module_.get());
+  if (bpftrace_.helper_subprograms_)
+  {
+    func->addFnAttr(Attribute::NoInline);
+    func->setSection(b_.GetInsertBlock()->getParent()->getSection());
+  }
+  else
+  {
+    func->addFnAttr(Attribute::AlwaysInline);
+    func->setSection("helpers");
+  }
+  return func;
+}
+
 Function *CodegenLLVM::createLog2Function()
 {
   auto ip = b_.saveIP();
@@ -2298,9 +2991,7 @@ Function *CodegenLLVM::createLog2Function()
   // }
 
   FunctionType *log2_func_type = FunctionType::get(b_.getInt64Ty(), {b_.getInt64Ty()}, false);
-  Function *log2_func = Function::Create(log2_func_type, Function::InternalLinkage, "log2", module_.get());
-  log2_func->addFnAttr(Attribute::AlwaysInline);
-  log2_func->setSection("helpers");
+  Function *log2_func = createHelperFunction("log2", log2_func_type);
   BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", log2_func);
   b_.SetInsertPoint(entry);
 
@@ -2343,7 +3034,114 @@ Function *CodegenLLVM::createLog2Function()
   }
   b_.CreateRet(b_.CreateLoad(result));
   b_.restoreIP(ip);
-  return module_->getFunction("log2");
+  return log2_func;
+}
+
+// bhist() bucket of `value`, i.e. the number of boundaries it is greater than
+// or equal to. BPF has no conditional moves, so rather than comparing against
+// every boundary this branches through a binary search over the constants.
+Value *CodegenLLVM::createBucketSearch(Value *value,
+                                       const std::vector<int64_t> &bounds)
+{
+  Function *parent = b_.GetInsertBlock()->getParent();
+  BasicBlock *done = BasicBlock::Create(module_->getContext(),
+                                        "bucket_found",
+                                        parent);
+  std::vector<std::pair<Value *, BasicBlock *>> found;
+
+  // Emit the search for a bucket between lo and hi, inclusive
+  std::function<void(size_t, size_t)> search = [&](size_t lo, size_t hi) {
+    if (lo == hi)
+    {
+      found.push_back({ b_.getInt64(lo), b_.GetInsertBlock() });
+      b_.CreateBr(done);
+      return;
+    }
+
+    // Bucket mid starts at bounds[mid - 1]
+    size_t mid = (lo + hi + 1) / 2;
+    BasicBlock *below = BasicBlock::Create(module_->getContext(),
+                                           "bucket_below",
+                                           parent);
+    BasicBlock *above = BasicBlock::Create(module_->getContext(),
+                                           "bucket_above",
+                                           parent);
+    b_.CreateCondBr(b_.CreateICmpSGE(value, b_.getInt64(bounds[mid - 1])),
+                    above,
+                    below);
+    b_.SetInsertPoint(below);
+    search(lo, mid - 1);
+    b_.SetInsertPoint(above);
+    search(mid, hi);
+  };
+  search(0, bounds.size());
+
+  b_.SetInsertPoint(done);
+  PHINode *bucket = b_.CreatePHI(b_.getInt64Ty(), found.size(), "bucket");
+  for (auto &incoming : found)
+    bucket->addIncoming(incoming.first, incoming.second);
+  return bucket;
+}
+
+Function *CodegenLLVM::createQhistFunction()
+{
+  auto ip = b_.saveIP();
+  // qhist() returns the log-linear bucket index of a value, see qhist.h.
+  // Negative values are counted as 0. It is branch-free:
+  //
+  // qhist(int n, int precision)
+  // {
+  //   n = max(n, 0);
+  //   int log2 = 0, m = n, shift;
+  //   for (int i = 5; i >= 0; i--)
+  //   {
+  //     shift = (m >= (1<<(1<<i))) << i;
+  //     m >>= shift;
+  //     log2 += shift;
+  //   }
+  //   int small = n < (1 << precision);
+  //   shift = small ? 0 : log2 - precision;
+  //   int index = ((shift + 1) << precision) +
+  //               ((n >> shift) & ((1 << precision) - 1));
+  //   return small ? n : index;
+  // }
+
+  FunctionType *qhist_func_type = FunctionType::get(
+      b_.getInt64Ty(), { b_.getInt64Ty(), b_.getInt64Ty() }, false);
+  Function *qhist_func = createHelperFunction("qhist", qhist_func_type);
+  BasicBlock *entry = BasicBlock::Create(module_->getContext(),
+                                         "entry",
+                                         qhist_func);
+  b_.SetInsertPoint(entry);
+
+  Value *n = qhist_func->arg_begin();
+  Value *precision = qhist_func->arg_begin() + 1;
+  n = b_.CreateSelect(b_.CreateICmpSLT(n, b_.getInt64(0)), b_.getInt64(0), n);
+
+  Value *m = n;
+  Value *log2 = b_.getInt64(0);
+  for (int i = 5; i >= 0; i--)
+  {
+    Value *shift = b_.CreateShl(
+        b_.CreateZExt(b_.CreateICmpUGE(m, b_.getInt64(1ULL << (1 << i))),
+                      b_.getInt64Ty()),
+        i);
+    m = b_.CreateLShr(m, shift);
+    log2 = b_.CreateAdd(log2, shift);
+  }
+
+  Value *small = b_.CreateICmpULT(n, b_.CreateShl(b_.getInt64(1), precision));
+  Value *shift = b_.CreateSelect(small,
+                                 b_.getInt64(0),
+                                 b_.CreateSub(log2, precision));
+  Value *mask = b_.CreateSub(b_.CreateShl(b_.getInt64(1), precision),
+                             b_.getInt64(1));
+  Value *index = b_.CreateAdd(
+      b_.CreateShl(b_.CreateAdd(shift, b_.getInt64(1)), precision),
+      b_.CreateAnd(b_.CreateLShr(n, shift), mask));
+  b_.CreateRet(b_.CreateSelect(small, n, index));
+  b_.restoreIP(ip);
+  return qhist_func;
 }
 
 Function *CodegenLLVM::createLinearFunction()
@@ -2369,9 +3167,7 @@ Function *CodegenLLVM::createLinearFunction()
 
   // inlined function initialization
   FunctionType *linear_func_type = FunctionType::get(b_.getInt64Ty(), {b_.getInt64Ty(), b_.getInt64Ty(), b_.getInt64Ty(), b_.getInt64Ty()}, false);
-  Function *linear_func = Function::Create(linear_func_type, Function::InternalLinkage, "linear", module_.get());
-  linear_func->addFnAttr(Attribute::AlwaysInline);
-  linear_func->setSection("helpers");
+  Function *linear_func = createHelperFunction("linear", linear_func_type);
   BasicBlock *entry = BasicBlock::Create(module_->getContext(), "entry", linear_func);
   b_.SetInsertPoint(entry);
 
@@ -2433,7 +3229,45 @@ Function *CodegenLLVM::createLinearFunction()
   }
 
   b_.restoreIP(ip);
-  return module_->getFunction("linear");
+  return linear_func;
+}
+
+// With adaptive sampling only one in `rate` records of per-event output is
+// emitted. Branches to `sample_done` for records which are skipped, and
+// returns the rate so it can be stored in the upper half of the record's id.
+// Returns nullptr without adaptive sampling.
+Value *CodegenLLVM::createSampleRateCheck(Call &call, BasicBlock *&sample_done)
+{
+  if (!bpftrace_.maps.Has(MapManager::Type::SampleRate))
+    return nullptr;
+
+  Function *parent = b_.GetInsertBlock()->getParent();
+  AllocaInst *key = b_.CreateAllocaBPF(b_.getInt32Ty(), "sample_rate_key");
+  b_.CreateStore(b_.getInt32(0), key);
+  auto type = CreateUInt64();
+  Value *rate = b_.CreateMapLookupElem(
+      ctx_,
+      bpftrace_.maps[MapManager::Type::SampleRate].value()->mapfd_,
+      key,
+      type,
+      call.loc);
+  b_.CreateLifetimeEnd(key);
+  rate = b_.CreateSelect(b_.CreateICmpUGT(rate, b_.getInt64(1)),
+                         rate,
+                         b_.getInt64(1));
+
+  BasicBlock *sample_emit = BasicBlock::Create(module_->getContext(),
+                                               "sample_emit",
+                                               parent);
+  sample_done = BasicBlock::Create(module_->getContext(),
+                                   "sample_done",
+                                   parent);
+  Value *pick = b_.CreateURem(b_.CreateGetRandom(), rate);
+  b_.CreateCondBr(b_.CreateICmpEQ(pick, b_.getInt64(0)),
+                  sample_emit,
+                  sample_done);
+  b_.SetInsertPoint(sample_emit);
+  return rate;
 }
 
 void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_args,
@@ -2445,15 +3279,44 @@ void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_arg
    * types and offsets of each of the arguments, and share that between BPF and
    * user-space for printing.
    */
-  std::vector<llvm::Type *> elements = { b_.getInt64Ty() }; // ID
-
   auto &args = std::get<1>(call_args.at(id));
+
+  // String arguments can be packed at their actual length behind the fixed
+  // part of the record, which then holds their offset and length instead.
+  // Their offsets aren't constant, so the record has to live in the scratch
+  // buffer rather than on the BPF stack.
+  size_t strings_size = 0;
   for (Field &arg : args)
+    if (arg.type.IsStringTy())
+      strings_size += arg.type.size;
+  auto record_type = [&](bool packed) {
+    std::vector<llvm::Type *> elements = { b_.getInt64Ty() }; // ID
+    for (Field &arg : args)
+    {
+      if (packed && arg.type.IsStringTy())
+        elements.push_back(b_.getInt64Ty());
+      else
+        elements.push_back(b_.GetType(arg.type));
+    }
+    return elements;
+  };
+  Function *parent = b_.GetInsertBlock()->getParent();
+  bool packed = strings_size > 0 && bpftrace_.scratch_size_ > 0 &&
+                !scratch_funcs_.empty() && scratch_funcs_.back() == parent;
+  if (packed)
   {
-    llvm::Type *ty = b_.GetType(arg.type);
-    elements.push_back(ty);
+    auto *packed_struct = StructType::get(module_->getContext(),
+                                          record_type(true));
+    packed = scratch_pinned_size_ +
+                 alignTo(layout_.getTypeAllocSize(packed_struct) +
+                             strings_size,
+                         8) <=
+             bpftrace_.scratch_size_;
   }
-  StructType *fmt_struct = StructType::create(elements, call_name + "_t", false);
+
+  StructType *fmt_struct = StructType::create(record_type(packed),
+                                              call_name + "_t",
+                                              false);
   int struct_size = layout_.getTypeAllocSize(fmt_struct);
 
   auto *struct_layout = layout_.getStructLayout(fmt_struct);
@@ -2463,27 +3326,76 @@ void CodegenLLVM::createFormatStringCall(Call &call, int &id, CallArgs &call_arg
     arg.offset = struct_layout->getElementOffset(i+1); // +1 for the id field
   }
 
-  AllocaInst *fmt_args = b_.CreateAllocaBPF(fmt_struct, call_name + "_args");
+  BasicBlock *sample_done = nullptr;
+  Value *rate = nullptr;
+  if (async_action == AsyncAction::printf)
+    rate = createSampleRateCheck(call, sample_done);
+
+  AllocaInst *fmt_buf;
+  Value *fmt_args;
+  if (packed)
+  {
+    fmt_buf = b_.CreateAllocaBPF(
+        ArrayType::get(b_.getInt8Ty(), struct_size + strings_size),
+        call_name + "_buf");
+    scratch_pinned_.insert(fmt_buf);
+    scratch_pinned_size_ += alignTo(struct_size + strings_size, 8);
+    fmt_args = b_.CreatePointerCast(fmt_buf, fmt_struct->getPointerTo());
+  }
+  else
+  {
+    fmt_buf = b_.CreateAllocaBPF(fmt_struct, call_name + "_args");
+    fmt_args = fmt_buf;
+  }
   // as the struct is not packed we need to memset it.
   b_.CREATE_MEMSET(fmt_args, b_.getInt8(0), struct_size, 1);
 
   Value *id_offset = b_.CreateGEP(fmt_args, {b_.getInt32(0), b_.getInt32(0)});
-  b_.CreateStore(b_.getInt64(id + asyncactionint(async_action)), id_offset);
+  uint64_t id_flags = packed ? ASYNC_PACKED_STRINGS : 0;
+  Value *id_val = b_.getInt64(id + asyncactionint(async_action) + id_flags);
+  if (rate)
+    id_val = b_.CreateOr(id_val, b_.CreateShl(rate, 32));
+  b_.CreateStore(id_val, id_offset);
 
+  Value *record_size = b_.getInt64(struct_size);
   for (size_t i=1; i<call.vargs->size(); i++)
   {
     Expression &arg = *call.vargs->at(i);
     auto scoped_del = accept(&arg);
     Value *offset = b_.CreateGEP(fmt_args, {b_.getInt32(0), b_.getInt32(i)});
-    if (needMemcpy(arg.type))
+    if (packed && arg.type.IsStringTy())
+    {
+      // Copying up to the NUL gives away the length, which is bounded so the
+      // verifier knows where the next string goes
+      CallInst *read = b_.CreateProbeReadStr(
+          ctx_,
+          b_.CreateGEP(b_.CreatePointerCast(fmt_args, b_.getInt8PtrTy()),
+                       record_size),
+          arg.type.size,
+          expr_,
+          AddrSpace::kernel,
+          call.loc);
+      Value *len = b_.CreateSelect(
+          b_.CreateICmpULE(read, b_.getInt64(arg.type.size)),
+          read,
+          b_.getInt64(0));
+      b_.CreateStore(b_.CreateOr(b_.CreateShl(len, 32), record_size), offset);
+      record_size = b_.CreateAdd(record_size, len);
+    }
+    else if (needMemcpy(arg.type))
       b_.CREATE_MEMCPY(offset, expr_, arg.type.size, 1);
     else
       b_.CreateStore(expr_, offset);
   }
 
   id++;
-  b_.CreatePerfEventOutput(ctx_, fmt_args, struct_size);
-  b_.CreateLifetimeEnd(fmt_args);
+  b_.CreatePerfEventOutput(ctx_, fmt_args, record_size);
+  b_.CreateLifetimeEnd(fmt_buf);
+  if (sample_done)
+  {
+    b_.CreateBr(sample_done);
+    b_.SetInsertPoint(sample_done);
+  }
   expr_ = nullptr;
 }
 
@@ -2498,8 +3410,11 @@ void CodegenLLVM::createPrintMapCall(Call &call)
   AllocaInst *buf = b_.CreateAllocaBPF(print_struct,
                                        call.func + "_" + map.ident);
 
+  bool delta = is_print_delta(call);
+
   // store asyncactionid:
-  b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::print)),
+  auto action = delta ? AsyncAction::print_delta : AsyncAction::print;
+  b_.CreateStore(b_.getInt64(asyncactionint(action)),
                  b_.CreateGEP(buf, { b_.getInt64(0), b_.getInt32(0) }));
 
   auto id = bpftrace_.maps[map.ident].value()->id;
@@ -2508,9 +3423,9 @@ void CodegenLLVM::createPrintMapCall(Call &call)
 
   // top, div
   // first loops sets the arguments as passed by user. The second one zeros
-  // the rest
+  // the rest. In delta mode the second argument is the mode selector.
   size_t arg_idx = 1;
-  for (; arg_idx < call.vargs->size(); arg_idx++)
+  for (; !delta && arg_idx < call.vargs->size(); arg_idx++)
   {
     auto scoped_del = accept(call.vargs->at(arg_idx).get());
 
@@ -2533,6 +3448,9 @@ void CodegenLLVM::createPrintMapCall(Call &call)
 
 void CodegenLLVM::createPrintNonMapCall(Call &call, int &id)
 {
+  BasicBlock *sample_done = nullptr;
+  Value *rate = createSampleRateCheck(call, sample_done);
+
   auto &arg = *call.vargs->at(0);
   auto scoped_del = accept(&arg);
 
@@ -2547,7 +3465,10 @@ void CodegenLLVM::createPrintNonMapCall(Call &call, int &id)
   size_t struct_size = layout_.getTypeAllocSize(print_struct);
 
   // Store asyncactionid:
-  b_.CreateStore(b_.getInt64(asyncactionint(AsyncAction::print_non_map)),
+  Value *action_id = b_.getInt64(asyncactionint(AsyncAction::print_non_map));
+  if (rate)
+    action_id = b_.CreateOr(action_id, b_.CreateShl(rate, 32));
+  b_.CreateStore(action_id,
                  b_.CreateGEP(buf, { b_.getInt64(0), b_.getInt32(0) }));
 
   // Store print id
@@ -2569,6 +3490,11 @@ void CodegenLLVM::createPrintNonMapCall(Call &call, int &id)
   id++;
   b_.CreatePerfEventOutput(ctx_, buf, struct_size);
   b_.CreateLifetimeEnd(buf);
+  if (sample_done)
+  {
+    b_.CreateBr(sample_done);
+    b_.SetInsertPoint(sample_done);
+  }
   expr_ = nullptr;
 }
 
@@ -2579,6 +3505,18 @@ void CodegenLLVM::generate_ir()
   state_ = State::IR;
 }
 
+// The scratch buffer is only created for scripts which have temporaries to
+// move to it, the moves are left to optimize()
+bool CodegenLLVM::needs_scratch()
+{
+  assert(state_ == State::IR);
+  return std::any_of(scratch_funcs_.begin(),
+                     scratch_funcs_.end(),
+                     [this](Function *func) {
+                       return !pickScratchAllocas(func).empty();
+                     });
+}
+
 void CodegenLLVM::emit_elf(const std::string &filename)
 {
   assert(state_ == State::OPT);
@@ -2620,9 +3558,54 @@ void CodegenLLVM::emit_elf(const std::string &filename)
 #endif
 }
 
-void CodegenLLVM::optimize()
+TargetMachine *CodegenLLVM::createTargetMachine()
+{
+  std::string targetTriple = "bpf-pc-linux";
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget(targetTriple, error);
+  if (!target)
+    throw std::runtime_error("Could not create LLVM target " + error);
+
+  TargetOptions opt;
+  auto RM = Reloc::Model();
+  return target->createTargetMachine(targetTriple, "generic", "", opt, RM);
+}
+
+// Small scripts spend much of their start up in the optimiser, so with
+// --fast-compile they only get the passes needed for code the verifier takes.
+// Unless their programs might not fit on the BPF stack without the rest,
+// which the BPF backend won't compile at all.
+bool CodegenLLVM::useFastPipeline()
+{
+  if (!bpftrace_.fast_compile_)
+    return false;
+
+  for (auto &func : *module_)
+  {
+    uint64_t stack_size = 0;
+    for (auto &block : func)
+      for (auto &inst : block)
+        if (auto *alloca = dyn_cast<AllocaInst>(&inst))
+          stack_size += alignTo(
+              layout_.getTypeAllocSize(alloca->getAllocatedType()), 8);
+    if (stack_size > SCRATCH_STACK_BUDGET)
+      return false;
+  }
+  return true;
+}
+
+void CodegenLLVM::runFastPipeline(Module &module)
+{
+  legacy::PassManager PM;
+  LLVMAddAlwaysInlinerPass(reinterpret_cast<LLVMPassManagerRef>(&PM));
+  PM.add(createPromoteMemoryToRegisterPass());
+  PM.add(createInstructionCombiningPass());
+  PM.add(createCFGSimplificationPass());
+  PM.run(module);
+}
+
+void CodegenLLVM::runFullPipeline(Module &module)
 {
-  assert(state_ == State::IR);
   PassManagerBuilder PMB;
   PMB.OptLevel = 3;
   legacy::PassManager PM;
@@ -2637,18 +3620,148 @@ void CodegenLLVM::optimize()
   LLVMAddAlwaysInlinerPass(reinterpret_cast<LLVMPassManagerRef>(&PM));
   PMB.populateModulePassManager(PM);
 
-  PM.run(*module_.get());
+  PM.run(module);
+}
+
+// Every section gets a module of its own, with the helpers its functions may
+// inline. Definitions of other sections are left as declarations. Sections
+// share nothing else, so the parts compile to the same code as the whole.
+std::vector<SmallVector<char, 0>> CodegenLLVM::splitModule()
+{
+  std::vector<SmallVector<char, 0>> bitcode;
+  std::set<std::string> sections;
+  for (auto &func : *module_)
+    if (!func.isDeclaration() && func.getSection() != "helpers")
+      sections.insert(func.getSection().str());
+  if (bpftrace_.compile_threads_ <= 1 || sections.size() <= 1)
+    return bitcode;
+
+  // Bitcode is the way for a module into another context
+  for (auto &section : sections)
+  {
+    ValueToValueMapTy vmap;
+    auto in_part = [&section](const GlobalValue *value) {
+      auto *func = dyn_cast<Function>(value);
+      return !func || func->getSection() == section ||
+             func->getSection() == "helpers";
+    };
+#if LLVM_VERSION_MAJOR >= 7
+    auto part = CloneModule(*module_, vmap, in_part);
+#else
+    auto part = CloneModule(module_.get(), vmap, in_part);
+#endif
+
+    bitcode.emplace_back();
+    raw_svector_ostream out(bitcode.back());
+#if LLVM_VERSION_MAJOR >= 7
+    WriteBitcodeToFile(*part, out);
+#else
+    WriteBitcodeToFile(part.get(), out);
+#endif
+  }
+  return bitcode;
+}
+
+void CodegenLLVM::optimize()
+{
+  assert(state_ == State::IR);
+  if (bpftrace_.maps.Has(MapManager::Type::Scratch))
+  {
+    for (Function *func : scratch_funcs_)
+      moveAllocasToScratch(func);
+  }
+  bool fast = useFastPipeline();
+  if (fast)
+  {
+    // The verifier rejects some code which it would take fully optimised,
+    // keep what's needed to get there
+#if LLVM_VERSION_MAJOR >= 7
+    full_module_ = CloneModule(*module_);
+#else
+    full_module_ = CloneModule(module_.get());
+#endif
+  }
+  auto run_pipeline = fast ? runFastPipeline : runFullPipeline;
+
+  auto bitcode = splitModule();
+  if (bitcode.empty())
+  {
+    run_pipeline(*module_);
+    state_ = State::OPT;
+    return;
+  }
+
+  part_contexts_.resize(bitcode.size());
+  parts_.resize(bitcode.size());
+  std::vector<std::string> errors(bitcode.size());
+  parallel_for(bitcode.size(), bpftrace_.compile_threads_, [&](size_t i) {
+    part_contexts_[i] = std::make_unique<LLVMContext>();
+    auto part = parseBitcodeFile(
+        MemoryBufferRef(StringRef(bitcode[i].data(), bitcode[i].size()),
+                        "bpftrace"),
+        *part_contexts_[i]);
+    if (!part)
+    {
+      errors[i] = toString(part.takeError());
+      return;
+    }
+    parts_[i] = std::move(*part);
+    run_pipeline(*parts_[i]);
+  });
+
+  // Splitting only makes compiling faster, the whole module is compiled at
+  // once if any part couldn't be read back
+  auto error = std::find_if(errors.begin(), errors.end(), [](auto &error) {
+    return !error.empty();
+  });
+  if (error != errors.end())
+  {
+    if (bt_verbose)
+      std::cerr << "Compiling all probes at once, as splitting the module "
+                   "failed: "
+                << *error << std::endl;
+    parts_.clear();
+    part_contexts_.clear();
+    run_pipeline(*module_);
+  }
   state_ = State::OPT;
 }
 
 std::unique_ptr<BpfOrc> CodegenLLVM::emit(void)
 {
   assert(state_ == State::OPT);
-  orc_->compileModule(move(module_));
+  if (parts_.empty())
+  {
+    orc_->compileModule(move(module_));
+    state_ = State::DONE;
+    return std::move(orc_);
+  }
+
+  std::vector<std::unique_ptr<BpfOrc>> part_orcs(parts_.size());
+  parallel_for(parts_.size(), bpftrace_.compile_threads_, [&](size_t i) {
+    part_orcs[i] = std::make_unique<BpfOrc>(createTargetMachine());
+    part_orcs[i]->compileModule(move(parts_[i]));
+  });
+  for (auto &part_orc : part_orcs)
+    orc_->merge(move(part_orc));
+  parts_.clear();
+
   state_ = State::DONE;
   return std::move(orc_);
 }
 
+std::unique_ptr<BpfOrc> CodegenLLVM::emit_full(void)
+{
+  assert(state_ == State::DONE);
+  if (!full_module_)
+    return nullptr;
+
+  runFullPipeline(*full_module_);
+  auto orc = std::make_unique<BpfOrc>(createTargetMachine());
+  orc->compileModule(move(full_module_));
+  return orc;
+}
+
 std::unique_ptr<BpfOrc> CodegenLLVM::compile(void)
 {
   generate_ir();
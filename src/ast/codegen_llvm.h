@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <ostream>
+#include <set>
 
 #include "ast.h"
 #include "bpftrace.h"
@@ -53,6 +54,10 @@ public:
   void visit(Program &program) override;
   AllocaInst *getMapKey(Map &map);
   AllocaInst *getHistMapKey(Map &map, Value *log2);
+  AllocaInst *createSketchKey(Expression &arg, const std::string &name);
+  Value      *createSketchHash(AllocaInst *key);
+  Value      *createBucketSearch(Value *value,
+                                 const std::vector<int64_t> &bounds);
   int         getNextIndexForProbe(const std::string &probe_name);
   std::string getSectionNameForProbe(const std::string &probe_name, int index);
   Value      *createLogicalAnd(Binop &binop);
@@ -65,14 +70,25 @@ public:
                               const std::string &call_name, AsyncAction async_action);
 
   void createPrintMapCall(Call &call);
+  Value *createSampleRateCheck(Call &call, BasicBlock *&sample_done);
   void createPrintNonMapCall(Call &call, int &id);
 
   void generate_ir(void);
+  bool needs_scratch(void);
   void optimize(void);
   std::unique_ptr<BpfOrc> emit(void);
+  // Fully optimised code for a module optimize() only ran the reduced pass
+  // pipeline on, for probes the verifier rejects as they are. nullptr if
+  // emit() already returned fully optimised code.
+  std::unique_ptr<BpfOrc> emit_full(void);
   void emit_elf(const std::string &filename);
   // Combine generate_ir, optimize and emit into one call
   std::unique_ptr<BpfOrc> compile(void);
+  // IR instructions generated for each probe which may be split, by section
+  const std::map<std::string, uint64_t> &probe_insns() const
+  {
+    return probe_insns_;
+  }
 
 private:
   class ScopedExprDeleter
@@ -107,11 +123,33 @@ private:
                      bool expansion);
   [[nodiscard]] ScopedExprDeleter accept(Node *node);
 
+  static uint64_t countInsns(Function *func);
+  bool needSplit(Function *func, int part, uint64_t split_insns);
+  Function *splitProbe(Function *func,
+                       const std::string &probe_section,
+                       int part);
+  std::vector<std::pair<AllocaInst *, uint64_t>> pickScratchAllocas(
+      Function *func);
+  void moveAllocasToScratch(Function *func);
+  Function *createHelperFunction(const std::string &name,
+                                 FunctionType *func_type);
   Function *createLog2Function();
   Function *createLinearFunction();
+  Function *createQhistFunction();
+  static TargetMachine *createTargetMachine();
+  bool useFastPipeline();
+  static void runFastPipeline(Module &module);
+  static void runFullPipeline(Module &module);
+  std::vector<SmallVector<char, 0>> splitModule();
   Node *root_;
   LLVMContext context_;
   std::unique_ptr<Module> module_;
+  // Unoptimised copy of the module, kept by the reduced pass pipeline
+  std::unique_ptr<Module> full_module_;
+  // The module split up by section, each part in a context of its own to be
+  // optimised and compiled concurrently
+  std::vector<std::unique_ptr<LLVMContext>> part_contexts_;
+  std::vector<std::unique_ptr<Module>> parts_;
   std::unique_ptr<ExecutionEngine> ee_;
   TargetMachine *TM_;
   IRBuilderBPF b_;
@@ -135,9 +173,20 @@ private:
   uint64_t join_id_ = 0;
   int system_id_ = 0;
   int non_map_print_id_ = 0;
+  int ratelimit_id_ = 0;
+  int keyed_ratelimit_id_ = 0;
+  int tail_call_slot_ = 0;
+  std::map<std::string, uint64_t> probe_insns_;
+  // Programs which may keep their temporaries in the scratch buffer
+  std::vector<Function *> scratch_funcs_;
+  // Temporaries which have to go to the scratch buffer, and how much of it
+  // they take in the program being generated
+  std::set<AllocaInst *> scratch_pinned_;
+  uint64_t scratch_pinned_size_ = 0;
 
   Function *linear_func_ = nullptr;
   Function *log2_func_ = nullptr;
+  Function *qhist_func_ = nullptr;
   std::unique_ptr<BpfOrc> orc_;
 
   size_t getStructSize(StructType *s)
@@ -10,6 +10,7 @@
 #include "utils.h"
 
 #include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Module.h>
 
 namespace libbpf {
@@ -21,6 +22,46 @@ namespace bpftrace {
 namespace ast {
 
 namespace {
+// Loads comparing n bytes a word at a time, as (offset, width) pairs. Whole
+// words are followed by a 4, 2 and 1 byte tail, so that every load is
+// naturally aligned and none reads past the n bytes.
+std::vector<std::pair<uint64_t, uint64_t>> strcmpChunks(uint64_t n)
+{
+  std::vector<std::pair<uint64_t, uint64_t>> chunks;
+  uint64_t offset = 0;
+  for (uint64_t width : { 8, 4, 2, 1 })
+  {
+    while (n - offset >= width)
+    {
+      chunks.emplace_back(offset, width);
+      offset += width;
+    }
+  }
+  return chunks;
+}
+
+// A width byte integer with every byte set to byte
+uint64_t repeatByte(uint64_t width, uint8_t byte)
+{
+  uint64_t val = 0;
+  for (uint64_t i = 0; i < width; i++)
+    val = (val << 8) | byte;
+  return val;
+}
+
+void alignAlloca(AllocaInst *alloca, unsigned align)
+{
+  if (alloca->getAlignment() >= align)
+    return;
+#if LLVM_VERSION_MAJOR >= 11
+  alloca->setAlignment(Align(align));
+#elif LLVM_VERSION_MAJOR >= 10
+  alloca->setAlignment(MaybeAlign(align));
+#else
+  alloca->setAlignment(align);
+#endif
+}
+
 std::string probeReadHelperName(libbpf::bpf_func_id id)
 {
   switch (id)
@@ -321,6 +362,151 @@ CallInst *IRBuilderBPF::CreateGetJoinMap(Value *ctx, const location &loc)
   return call;
 }
 
+CallInst *IRBuilderBPF::CreateGetRatelimitState(Value *ctx,
+                                                int id,
+                                                const location &loc)
+{
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(id), key);
+
+  CallInst *call = createMapLookup(
+      bpftrace_.maps[MapManager::Type::Ratelimit].value()->mapfd_, key);
+  CreateHelperErrorCond(ctx, call, libbpf::BPF_FUNC_map_lookup_elem, loc, true);
+  return call;
+}
+
+// State of a keyed ratelimit() or sample() call, inserting zeroed state for
+// new keys. Returns NULL if the entry couldn't be created.
+Value *IRBuilderBPF::CreateGetKeyedRatelimitState(Value *ctx,
+                                                  AllocaInst *key,
+                                                  const location &loc)
+{
+  Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *insert = BasicBlock::Create(module_.getContext(),
+                                          "ratelimit_insert",
+                                          parent);
+  BasicBlock *done = BasicBlock::Create(module_.getContext(),
+                                        "ratelimit_found",
+                                        parent);
+  Value *null = ConstantExpr::getCast(Instruction::IntToPtr,
+                                      getInt64(0),
+                                      getInt8PtrTy());
+
+  int mapfd = bpftrace_.maps[MapManager::Type::RatelimitKeys].value()->mapfd_;
+  CallInst *found = createMapLookup(mapfd, key);
+  BasicBlock *found_block = GetInsertBlock();
+  CreateCondBr(CreateICmpNE(found, null, "ratelimit_key_found"), done, insert);
+
+  SetInsertPoint(insert);
+  AllocaInst *zero = CreateAllocaBPF(getInt64Ty(), "ratelimit_init");
+  CreateStore(getInt64(0), zero);
+  CreateMapUpdateElem(ctx, mapfd, key, zero, loc);
+  CreateLifetimeEnd(zero);
+  CallInst *inserted = createMapLookup(mapfd, key);
+  BasicBlock *inserted_block = GetInsertBlock();
+  CreateBr(done);
+
+  SetInsertPoint(done);
+  PHINode *state = CreatePHI(getInt8PtrTy(), 2, "ratelimit_state");
+  state->addIncoming(found, found_block);
+  state->addIncoming(inserted, inserted_block);
+  return state;
+}
+
+// The single entry of a per-CPU scratch array
+CallInst *IRBuilderBPF::CreateGetScratch(MapManager::Type map)
+{
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "key");
+  CreateStore(getInt32(0), key);
+
+  CallInst *call = createMapLookup(bpftrace_.maps[map].value()->mapfd_, key);
+  CreateLifetimeEnd(key);
+  return call;
+}
+
+void IRBuilderBPF::CreateTailCall(Value *ctx, int slot)
+{
+  // long bpf_tail_call(void *ctx, struct bpf_map *prog_array_map, u32 index)
+  // Return: Doesn't return on success, a negative error otherwise
+  Value *map_ptr = CreateBpfPseudoCall(
+      bpftrace_.maps[MapManager::Type::TailCalls].value()->mapfd_);
+  FunctionType *tail_call_func_type = FunctionType::get(
+      getInt64Ty(), { getInt8PtrTy(), map_ptr->getType(), getInt32Ty() }, false);
+  PointerType *tail_call_func_ptr_type = PointerType::get(tail_call_func_type,
+                                                          0);
+  Constant *tail_call_func = ConstantExpr::getCast(
+      Instruction::IntToPtr,
+      getInt64(libbpf::BPF_FUNC_tail_call),
+      tail_call_func_ptr_type);
+  createCall(tail_call_func, { ctx, map_ptr, getInt32(slot) }, "tail_call");
+}
+
+CallInst *IRBuilderBPF::CreateGetSketchRow(Value *ctx,
+                                           Map &map,
+                                           int row,
+                                           const location &loc)
+{
+  AllocaInst *key = CreateAllocaBPF(getInt32Ty(), "sketch_key");
+  CreateStore(getInt32(row), key);
+
+  CallInst *call = createMapLookup(
+      bpftrace_.maps[map.ident].value()->sketch_fd_, key);
+  CreateHelperErrorCond(ctx, call, libbpf::BPF_FUNC_map_lookup_elem, loc, true);
+  CreateLifetimeEnd(key);
+  return call;
+}
+
+// Pointer to the value of a map entry, inserting a zeroed value for new keys.
+// Returns NULL if the entry couldn't be created.
+Value *IRBuilderBPF::CreateLookupOrInitElem(Value *ctx,
+                                            Map &map,
+                                            AllocaInst *key,
+                                            const location &loc)
+{
+  Function *parent = GetInsertBlock()->getParent();
+  BasicBlock *insert = BasicBlock::Create(module_.getContext(),
+                                          "lookup_or_init_insert",
+                                          parent);
+  BasicBlock *update = BasicBlock::Create(module_.getContext(),
+                                          "lookup_or_init_update",
+                                          parent);
+  BasicBlock *done = BasicBlock::Create(module_.getContext(),
+                                        "lookup_or_init_done",
+                                        parent);
+  Value *null = ConstantExpr::getCast(Instruction::IntToPtr,
+                                      getInt64(0),
+                                      getInt8PtrTy());
+
+  int mapfd = bpftrace_.maps[map.ident].value()->mapfd_;
+  CallInst *found = createMapLookup(mapfd, key);
+  BasicBlock *found_block = GetInsertBlock();
+  CreateCondBr(CreateICmpNE(found, null, "lookup_or_init_found"), done, insert);
+
+  // Values can be too large to be built on the BPF stack, so new entries are
+  // copied from an all-zero array instead
+  SetInsertPoint(insert);
+  AllocaInst *zeroes_key = CreateAllocaBPF(getInt32Ty(), "zeroes_key");
+  CreateStore(getInt32(0), zeroes_key);
+  CallInst *zeroes = createMapLookup(
+      bpftrace_.maps[MapManager::Type::Zeroes].value()->mapfd_, zeroes_key);
+  CreateLifetimeEnd(zeroes_key);
+  BasicBlock *zeroes_block = GetInsertBlock();
+  CreateCondBr(CreateICmpNE(zeroes, null, "zeroes_found"), update, done);
+
+  SetInsertPoint(update);
+  CreateMapUpdateElem(ctx, map, key, zeroes, loc);
+  CallInst *inserted = createMapLookup(mapfd, key);
+  BasicBlock *inserted_block = GetInsertBlock();
+  CreateBr(done);
+
+  SetInsertPoint(done);
+  PHINode *value = CreatePHI(getInt8PtrTy(), 3, "lookup_or_init_elem");
+  value->addIncoming(found, found_block);
+  value->addIncoming(null, zeroes_block);
+  value->addIncoming(inserted, inserted_block);
+  return value;
+}
+
 Value *IRBuilderBPF::CreateMapLookupElem(Value *ctx,
                                          Map &map,
                                          AllocaInst *key,
@@ -389,7 +575,17 @@ void IRBuilderBPF::CreateMapUpdateElem(Value *ctx,
                                        Value *val,
                                        const location &loc)
 {
-  Value *map_ptr = CreateBpfPseudoCall(map);
+  int mapfd = bpftrace_.maps[map.ident].value()->mapfd_;
+  CreateMapUpdateElem(ctx, mapfd, key, val, loc);
+}
+
+void IRBuilderBPF::CreateMapUpdateElem(Value *ctx,
+                                       int mapfd,
+                                       AllocaInst *key,
+                                       Value *val,
+                                       const location &loc)
+{
+  Value *map_ptr = CreateBpfPseudoCall(mapfd);
 
   assert(ctx && ctx->getType() == getInt8PtrTy());
   assert(key->getType()->isPointerTy());
@@ -662,12 +858,12 @@ Value *IRBuilderBPF::CreateStrcmp(Value *ctx,
   return CreateStrncmp(ctx, val, as, str, cmpAmount, loc, inverse);
 }
 
-Value *IRBuilderBPF::CreateStrncmp(Value *ctx __attribute__((unused)),
+Value *IRBuilderBPF::CreateStrncmp(Value *ctx,
                                    Value *val,
                                    AddrSpace as __attribute__((unused)),
                                    std::string str,
                                    uint64_t n,
-                                   const location &loc __attribute__((unused)),
+                                   const location &loc,
                                    bool inverse)
 {
   assert(ctx && ctx->getType() == getInt8PtrTy());
@@ -678,32 +874,36 @@ Value *IRBuilderBPF::CreateStrncmp(Value *ctx __attribute__((unused)),
          valp->getElementType()->getArrayElementType() == getInt8Ty());
 #endif
 
-  Function *parent = GetInsertBlock()->getParent();
-  BasicBlock *str_ne = BasicBlock::Create(module_.getContext(), "strcmp.false", parent);
-  AllocaInst *store = CreateAllocaBPF(getInt1Ty(), "strcmp.result");
-
-  CreateStore(getInt1(!inverse), store);
-
+  // Every word is compared against a constant and the differences are
+  // combined, so there's a single branch on the result. Nothing past the
+  // literal's terminator is compared.
   const char *c_str = str.c_str();
-  for (size_t i = 0; i < n; i++)
+  n = std::min<uint64_t>(n, strlen(c_str) + 1);
+  if (n == 0)
+    return getInt64(inverse);
+
+  Value *buf = createStrcmpOperand(ctx, val, AddrSpace::none, n, false, loc);
+  Value *diff = nullptr;
+  for (auto &chunk : strcmpChunks(n))
   {
-    BasicBlock *char_eq = BasicBlock::Create(module_.getContext(), "strcmp.loop", parent);
-
-    auto *ptr = CreateGEP(val, { getInt32(0), getInt32(i) });
-    Value *l = CreateLoad(getInt8Ty(), ptr);
-    Value *r = getInt8(c_str[i]);
-    Value *cmp = CreateICmpNE(l, r, "strcmp.cmp");
-    CreateCondBr(cmp, str_ne, char_eq);
-    SetInsertPoint(char_eq);
+    uint64_t expected = 0;
+    for (uint64_t i = chunk.second; i-- > 0;)
+      expected = (expected << 8) |
+                 static_cast<uint8_t>(c_str[chunk.first + i]);
+
+    Value *l = createStrcmpChunk(buf, chunk.first, chunk.second);
+    Value *x = CreateIntCast(CreateXor(l,
+                                       ConstantInt::get(l->getType(),
+                                                        expected)),
+                             getInt64Ty(),
+                             false);
+    diff = diff ? CreateOr(diff, x) : x;
   }
-  CreateStore(getInt1(inverse), store);
-  CreateBr(str_ne);
 
-  SetInsertPoint(str_ne);
-  Value *result = CreateLoad(store);
-  CreateLifetimeEnd(store);
-  result = CreateIntCast(result, getInt64Ty(), false);
-  return result;
+  Value *mismatch = CreateICmpNE(diff, getInt64(0), "strcmp.cmp");
+  return CreateIntCast(CreateXor(mismatch, getInt1(inverse)),
+                       getInt64Ty(),
+                       false);
 }
 
 Value *IRBuilderBPF::CreateStrcmp(Value *ctx,
@@ -728,28 +928,6 @@ Value *IRBuilderBPF::CreateStrncmp(Value *ctx,
                                    const location &loc,
                                    bool inverse)
 {
-  /*
-  // This function compares each character of the two string.
-  // It returns true if all are equal and false if any are different
-  // strcmp(String val1, String val2)
-     {
-        for (size_t i = 0; i < n; i++)
-        {
-
-          if (val1[i] != val2[i])
-          {
-            return false;
-          }
-          if (val1[i] == NULL)
-          {
-            return true;
-          }
-        }
-
-        return true;
-     }
-  */
-
 #ifndef NDEBUG
   PointerType *val1p = cast<PointerType>(val1->getType());
   PointerType *val2p = cast<PointerType>(val2->getType());
@@ -761,63 +939,116 @@ Value *IRBuilderBPF::CreateStrncmp(Value *ctx,
          val2p->getElementType()->getArrayElementType() == getInt8Ty());
 #endif
 
+  // Compared a word at a time, stopping at the first word with a difference
+  // or the terminator of val1
+  auto array_len = [](Value *val) {
+    return cast<PointerType>(val->getType())
+        ->getElementType()
+        ->getArrayNumElements();
+  };
+  n = std::min({ n, array_len(val1), array_len(val2) });
+  if (n == 0)
+    return getInt64(inverse);
+
+  Value *buf1 = createStrcmpOperand(ctx, val1, as1, n, true, loc);
+  Value *buf2 = createStrcmpOperand(ctx, val2, as2, n, true, loc);
+
   Function *parent = GetInsertBlock()->getParent();
   AllocaInst *store = CreateAllocaBPF(getInt1Ty(), "strcmp.result");
-  BasicBlock *str_ne = BasicBlock::Create(module_.getContext(),
-                                          "strcmp.false",
-                                          parent);
   BasicBlock *done = BasicBlock::Create(module_.getContext(),
                                         "strcmp.done",
                                         parent);
 
-  CreateStore(getInt1(!inverse), store);
-
-  Value *null_byte = getInt8(0);
-
-  AllocaInst *val_l = CreateAllocaBPF(getInt8Ty(), "strcmp.char_l");
-  AllocaInst *val_r = CreateAllocaBPF(getInt8Ty(), "strcmp.char_r");
-  for (size_t i = 0; i < n; i++)
+  for (auto &chunk : strcmpChunks(n))
   {
-    BasicBlock *char_eq = BasicBlock::Create(module_.getContext(),
-                                             "strcmp.loop",
-                                             parent);
-    BasicBlock *loop_null_check = BasicBlock::Create(module_.getContext(),
-                                                     "strcmp.loop_null_cmp",
-                                                     parent);
-
-    auto *ptr1 = CreateGEP(val1, { getInt32(0), getInt32(i) });
-    CreateProbeRead(ctx, val_l, 1, ptr1, as1, loc);
-    Value *l = CreateLoad(getInt8Ty(), val_l);
-
-    auto *ptr2 = CreateGEP(val2, { getInt32(0), getInt32(i) });
-    CreateProbeRead(ctx, val_r, 1, ptr2, as2, loc);
-    Value *r = CreateLoad(getInt8Ty(), val_r);
-
-    Value *cmp = CreateICmpNE(l, r, "strcmp.cmp");
-    CreateCondBr(cmp, str_ne, loop_null_check);
-
-    SetInsertPoint(loop_null_check);
-
-    Value *cmp_null = CreateICmpEQ(l, null_byte, "strcmp.cmp_null");
-    CreateCondBr(cmp_null, done, char_eq);
-
-    SetInsertPoint(char_eq);
+    uint64_t width = chunk.second;
+    Value *l = createStrcmpChunk(buf1, chunk.first, width);
+    Value *r = createStrcmpChunk(buf2, chunk.first, width);
+    llvm::Type *ty = l->getType();
+    auto bytes = [&](uint8_t byte) {
+      return ConstantInt::get(ty, repeatByte(width, byte));
+    };
+
+    // High bit of every byte of l which is zero. Borrows can only flag bytes
+    // after the first zero one, so the lowest bit set is exact.
+    Value *zeroes = CreateAnd(CreateAnd(CreateSub(l, bytes(0x01)),
+                                        CreateNot(l)),
+                              bytes(0x80));
+    // High bit of every byte which differs between l and r
+    Value *x = CreateXor(l, r);
+    Value *diffs = CreateAnd(
+        CreateOr(CreateAdd(CreateAnd(x, bytes(0x7f)), bytes(0x7f)), x),
+        bytes(0x80));
+    // The bytes up to and including the terminator, or all without one
+    Value *terminator = CreateAnd(zeroes, CreateNeg(zeroes));
+    Value *compared = CreateOr(terminator,
+                               CreateSub(terminator, ConstantInt::get(ty, 1)));
+    Value *mismatch = CreateICmpNE(CreateAnd(diffs, compared),
+                                   ConstantInt::get(ty, 0),
+                                   "strcmp.cmp");
+    CreateStore(mismatch, store);
+
+    BasicBlock *next = BasicBlock::Create(module_.getContext(),
+                                          "strcmp.loop",
+                                          parent);
+    Value *decided = CreateICmpNE(CreateOr(zeroes, diffs),
+                                  ConstantInt::get(ty, 0),
+                                  "strcmp.decided");
+    CreateCondBr(decided, done, next);
+    SetInsertPoint(next);
   }
-
+  // Equal up to n bytes. The last word stored a mismatch of false.
   CreateBr(done);
+
   SetInsertPoint(done);
-  CreateStore(getInt1(inverse), store);
+  Value *result = CreateXor(CreateLoad(store), getInt1(inverse));
+  CreateLifetimeEnd(store);
+  return CreateIntCast(result, getInt64Ty(), false);
+}
 
-  CreateBr(str_ne);
-  SetInsertPoint(str_ne);
+// Returns the first n bytes of val in a buffer aligned for word loads: val
+// itself when it's on the stack, a copy otherwise
+Value *IRBuilderBPF::createStrcmpOperand(Value *ctx,
+                                         Value *val,
+                                         AddrSpace as,
+                                         uint64_t n,
+                                         bool probe_read,
+                                         const location &loc)
+{
+  if (auto *alloca = dyn_cast<AllocaInst>(val->stripPointerCasts()))
+  {
+    alignAlloca(alloca, 8);
+    return val;
+  }
 
-  Value *result = CreateLoad(store);
-  CreateLifetimeEnd(store);
-  CreateLifetimeEnd(val_l);
-  CreateLifetimeEnd(val_r);
-  result = CreateIntCast(result, getInt64Ty(), false);
+  AllocaInst *buf = CreateAllocaBPF(ArrayType::get(getInt64Ty(), (n + 7) / 8),
+                                    "strcmp.buf");
+  if (probe_read)
+    CreateProbeRead(ctx, buf, n, val, as, loc);
+  else
+    CREATE_MEMCPY(buf, val, getInt64(n), 1);
+  return buf;
+}
 
-  return result;
+// Loads width bytes at offset into buf as an integer whose lowest byte comes
+// first in memory, whatever the byte order of the target
+Value *IRBuilderBPF::createStrcmpChunk(Value *buf,
+                                       uint64_t offset,
+                                       uint64_t width)
+{
+  llvm::Type *ty = getIntNTy(width * 8);
+  Value *ptr = CreateGEP(getInt8Ty(),
+                         CreatePointerCast(buf, getInt8PtrTy()),
+                         getInt64(offset));
+  Value *chunk = CreateLoad(ty, CreatePointerCast(ptr, ty->getPointerTo()));
+  if (width > 1 && module_.getDataLayout().isBigEndian())
+  {
+    Function *bswap = Intrinsic::getDeclaration(&module_,
+                                                Intrinsic::bswap,
+                                                { ty });
+    chunk = createCall(bswap, { chunk }, "strcmp.bswap");
+  }
+  return chunk;
 }
 
 CallInst *IRBuilderBPF::CreateGetNs(bool boot_time)
@@ -974,15 +1205,20 @@ void IRBuilderBPF::CreateGetCurrentComm(Value *ctx,
 }
 
 void IRBuilderBPF::CreatePerfEventOutput(Value *ctx, Value *data, size_t size)
+{
+  CreatePerfEventOutput(ctx, data, getInt64(size));
+}
+
+void IRBuilderBPF::CreatePerfEventOutput(Value *ctx, Value *data, Value *size)
 {
   assert(ctx && ctx->getType() == getInt8PtrTy());
   assert(data && data->getType()->isPointerTy());
+  assert(size && size->getType() == getInt64Ty());
 
   Value *map_ptr = CreateBpfPseudoCall(
       bpftrace_.maps[MapManager::Type::PerfEvent].value()->mapfd_);
 
   Value *flags_val = CreateGetCpuId();
-  Value *size_val = getInt64(size);
 
   // int bpf_perf_event_output(struct pt_regs *ctx, struct bpf_map *map,
   //                           u64 flags, void *data, u64 size)
@@ -1000,7 +1236,7 @@ void IRBuilderBPF::CreatePerfEventOutput(Value *ctx, Value *data, size_t size)
       getInt64(libbpf::BPF_FUNC_perf_event_output),
       perfoutput_func_ptr_type);
   createCall(perfoutput_func,
-             { ctx, map_ptr, flags_val, data, size_val },
+             { ctx, map_ptr, flags_val, data, size },
              "perf_event_output");
 }
 
@@ -70,6 +70,11 @@ public:
                            AllocaInst *key,
                            Value *val,
                            const location &loc);
+  void CreateMapUpdateElem(Value *ctx,
+                           int mapfd,
+                           AllocaInst *key,
+                           Value *val,
+                           const location &loc);
   void CreateMapDeleteElem(Value *ctx,
                            Map &map,
                            AllocaInst *key,
@@ -149,9 +154,16 @@ public:
   CallInst   *CreateGetRandom();
   CallInst   *CreateGetStackId(Value *ctx, bool ustack, StackType stack_type, const location& loc);
   CallInst   *CreateGetJoinMap(Value *ctx, const location& loc);
+  CallInst   *CreateGetRatelimitState(Value *ctx, int id, const location& loc);
+  Value      *CreateGetKeyedRatelimitState(Value *ctx, AllocaInst *key, const location& loc);
+  CallInst   *CreateGetScratch(MapManager::Type map);
+  void        CreateTailCall(Value *ctx, int slot);
+  CallInst   *CreateGetSketchRow(Value *ctx, Map &map, int row, const location& loc);
+  Value      *CreateLookupOrInitElem(Value *ctx, Map &map, AllocaInst *key, const location& loc);
   CallInst   *createCall(Value *callee, ArrayRef<Value *> args, const Twine &Name);
   void        CreateGetCurrentComm(Value *ctx, AllocaInst *buf, size_t size, const location& loc);
   void        CreatePerfEventOutput(Value *ctx, Value *data, size_t size);
+  void        CreatePerfEventOutput(Value *ctx, Value *data, Value *size);
   void        CreateSignal(Value *ctx, Value *sig, const location &loc);
   void        CreateOverrideReturn(Value *ctx, Value *rc);
   void        CreateHelperError(Value *ctx, Value *return_value, libbpf::bpf_func_id func_id, const location& loc);
@@ -175,6 +187,13 @@ private:
                                  llvm::Type *src,
                                  AddrSpace as);
   libbpf::bpf_func_id selectProbeReadHelper(AddrSpace as, bool str);
+  Value *createStrcmpOperand(Value *ctx,
+                             Value *val,
+                             AddrSpace as,
+                             uint64_t n,
+                             bool probe_read,
+                             const location &loc);
+  Value *createStrcmpChunk(Value *buf, uint64_t offset, uint64_t width);
 
   std::map<std::string, StructType *> structs_;
 };
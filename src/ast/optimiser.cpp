@@ -0,0 +1,668 @@
+#include "optimiser.h"
+#include "parser.tab.hh"
+#include "utils.h"
+#include <algorithm>
+#include <functional>
+#include <set>
+
+namespace bpftrace {
+namespace ast {
+
+void Optimiser::visit(Integer &integer __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(PositionalParameter &param)
+{
+  switch (param.ptype)
+  {
+    case PositionalParameterType::positional:
+    {
+      // $0 and non-numeric parameters are left for the semantic analyser to
+      // report. Parameters which weren't given are 0, as in get_param().
+      if (param.n <= 0)
+        break;
+      std::string pstr = bpftrace_.get_param(param.n, false);
+      if (is_numeric(pstr))
+        folded_ = std::make_unique<Integer>(std::stoll(pstr, nullptr, 0),
+                                            param.loc);
+      break;
+    }
+    case PositionalParameterType::count:
+      folded_ = std::make_unique<Integer>(bpftrace_.num_params(), param.loc);
+      break;
+  }
+}
+
+void Optimiser::visit(String &string __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(StackMode &mode __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(Identifier &identifier __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(Builtin &builtin __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(Call &call)
+{
+  if (!call.vargs)
+    return;
+
+  for (size_t i = 0; i < call.vargs->size(); i++)
+  {
+    // str($1) and buf($1) read the parameter as a string
+    auto &arg = call.vargs->at(i);
+    if (i == 0 && (call.func == "str" || call.func == "buf") &&
+        dynamic_cast<PositionalParameter *>(arg.get()))
+      continue;
+    fold(arg);
+  }
+}
+
+void Optimiser::visit(Map &map)
+{
+  if (map.vargs)
+  {
+    for (auto &expr : *map.vargs)
+      fold(expr);
+  }
+}
+
+void Optimiser::visit(Variable &var)
+{
+  var_reads_[var.ident]++;
+}
+
+void Optimiser::visit(Binop &binop)
+{
+  fold(binop.left);
+  fold(binop.right);
+
+  if (binop.op == Parser::token::LAND || binop.op == Parser::token::LOR)
+    reorder(binop);
+
+  std::string lstr, rstr;
+  if ((binop.op == Parser::token::EQ || binop.op == Parser::token::NE) &&
+      const_string(*binop.left, lstr) && const_string(*binop.right, rstr))
+  {
+    bool equal = lstr == rstr;
+    folded_ = std::make_unique<Integer>(
+        equal == (binop.op == Parser::token::EQ), binop.loc);
+    return;
+  }
+
+  auto *left = dynamic_cast<Integer *>(binop.left.get());
+  auto *right = dynamic_cast<Integer *>(binop.right.get());
+
+  // Short circuiting means the other side doesn't matter
+  if (left && binop.op == Parser::token::LAND && !left->n)
+  {
+    folded_ = std::make_unique<Integer>(0, binop.loc);
+    return;
+  }
+  if (left && binop.op == Parser::token::LOR && left->n)
+  {
+    folded_ = std::make_unique<Integer>(1, binop.loc);
+    return;
+  }
+  if (!left || !right)
+    return;
+
+  // Same semantics as in CodegenLLVM::visit(Binop &). Literals are signed,
+  // except for the unsigned division, which is only folded when that makes
+  // no difference.
+  int64_t l = left->n, r = right->n;
+  uint64_t ul = l, ur = r;
+  int64_t result;
+  switch (binop.op)
+  {
+    case Parser::token::EQ:    result = l == r; break;
+    case Parser::token::NE:    result = l != r; break;
+    case Parser::token::LE:    result = l <= r; break;
+    case Parser::token::GE:    result = l >= r; break;
+    case Parser::token::LT:    result = l < r; break;
+    case Parser::token::GT:    result = l > r; break;
+    case Parser::token::LAND:  result = l && r; break;
+    case Parser::token::LOR:   result = l || r; break;
+    case Parser::token::PLUS:  result = ul + ur; break;
+    case Parser::token::MINUS: result = ul - ur; break;
+    case Parser::token::MUL:   result = ul * ur; break;
+    case Parser::token::BAND:  result = ul & ur; break;
+    case Parser::token::BOR:   result = ul | ur; break;
+    case Parser::token::BXOR:  result = ul ^ ur; break;
+    case Parser::token::LEFT:
+      if (r < 0 || r >= 64)
+        return;
+      result = ul << r;
+      break;
+    case Parser::token::RIGHT:
+      if (l < 0 || r < 0 || r >= 64)
+        return;
+      result = ul >> r;
+      break;
+    case Parser::token::DIV:
+    case Parser::token::MOD:
+      if (l < 0 || r <= 0)
+        return;
+      result = binop.op == Parser::token::DIV ? l / r : l % r;
+      break;
+    default:
+      return;
+  }
+  folded_ = std::make_unique<Integer>(result, binop.loc);
+}
+
+void Optimiser::visit(Unop &unop)
+{
+  fold(unop.expr);
+
+  auto *integer = dynamic_cast<Integer *>(unop.expr.get());
+  if (!integer)
+    return;
+
+  switch (unop.op)
+  {
+    case Parser::token::LNOT:
+      folded_ = std::make_unique<Integer>(!integer->n, unop.loc);
+      break;
+    case Parser::token::BNOT:
+      folded_ = std::make_unique<Integer>(~integer->n, unop.loc);
+      break;
+    case Parser::token::MINUS:
+      folded_ = std::make_unique<Integer>(-static_cast<uint64_t>(integer->n),
+                                          unop.loc);
+      break;
+    default:
+      break;
+  }
+}
+
+void Optimiser::visit(Ternary &ternary)
+{
+  fold(ternary.cond);
+  fold(ternary.left);
+  fold(ternary.right);
+
+  if (auto *cond = dynamic_cast<Integer *>(ternary.cond.get()))
+    folded_ = std::move(cond->n ? ternary.left : ternary.right);
+}
+
+void Optimiser::visit(FieldAccess &acc)
+{
+  fold(acc.expr);
+}
+
+void Optimiser::visit(ArrayAccess &arr)
+{
+  fold(arr.expr);
+  fold(arr.indexpr);
+}
+
+void Optimiser::visit(Cast &cast)
+{
+  fold(cast.expr);
+}
+
+void Optimiser::visit(Tuple &tuple)
+{
+  for (auto &elem : *tuple.elems)
+    fold(elem);
+}
+
+void Optimiser::visit(ExprStatement &expr)
+{
+  fold(expr.expr);
+}
+
+void Optimiser::visit(AssignMapStatement &assignment)
+{
+  assignment.map->accept(*this);
+  fold(assignment.expr);
+}
+
+void Optimiser::visit(AssignVarStatement &assignment)
+{
+  fold(assignment.expr);
+}
+
+void Optimiser::visit(If &if_block)
+{
+  fold(if_block.cond);
+  prune(*if_block.stmts);
+  if (if_block.else_stmts)
+    prune(*if_block.else_stmts);
+}
+
+void Optimiser::visit(Unroll &unroll)
+{
+  fold(unroll.expr);
+  prune(*unroll.stmts);
+}
+
+void Optimiser::visit(While &while_block)
+{
+  fold(while_block.cond);
+  prune(*while_block.stmts);
+}
+
+void Optimiser::visit(Jump &jump __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(Predicate &pred)
+{
+  fold(pred.expr);
+}
+
+void Optimiser::visit(AttachPoint &ap __attribute__((unused)))
+{
+}
+
+void Optimiser::visit(Probe &probe)
+{
+  if (probe.pred)
+  {
+    probe.pred->accept(*this);
+    auto *cond = dynamic_cast<Integer *>(probe.pred->expr.get());
+    if (cond && cond->n)
+      probe.pred.reset();
+  }
+  prune(*probe.stmts);
+
+  // Each variable removed may leave others unused
+  do
+  {
+    var_reads_.clear();
+    if (probe.pred)
+      probe.pred->accept(*this);
+    for (auto &stmt : *probe.stmts)
+      stmt->accept(*this);
+  } while (remove_unused_vars(*probe.stmts));
+
+  auto reads = var_reads_;
+  sink(*probe.stmts, reads);
+
+  // A body which is a single if is the same as a predicate, which can then
+  // be ordered together with the existing one
+  auto &stmts = *probe.stmts;
+  auto *if_block = stmts.size() == 1 ? dynamic_cast<If *>(stmts[0].get())
+                                     : nullptr;
+  if (if_block && !if_block->else_stmts && is_pure(*if_block->cond) &&
+      (!probe.pred || is_pure(*probe.pred->expr)))
+  {
+    auto cond = std::move(if_block->cond);
+    auto body = std::move(if_block->stmts);
+    if (probe.pred)
+    {
+      auto loc = probe.pred->loc;
+      probe.pred = std::make_unique<Predicate>(
+          std::make_unique<Binop>(std::move(probe.pred->expr),
+                                  Parser::token::LAND,
+                                  std::move(cond),
+                                  loc),
+          loc);
+    }
+    else
+    {
+      auto loc = cond->loc;
+      probe.pred = std::make_unique<Predicate>(std::move(cond), loc);
+    }
+    probe.stmts = std::move(body);
+    probe.pred->accept(*this);
+  }
+}
+
+void Optimiser::visit(Program &program)
+{
+  for (auto &probe : *program.probes)
+    probe->accept(*this);
+
+  // A program needs at least one probe, even one that never fires
+  auto never_fires = [](std::unique_ptr<Probe> &probe) {
+    auto *cond = probe->pred ? dynamic_cast<Integer *>(probe->pred->expr.get())
+                             : nullptr;
+    return cond && !cond->n;
+  };
+  auto &probes = *program.probes;
+  if (!std::all_of(probes.begin(), probes.end(), never_fires))
+    probes.erase(std::remove_if(probes.begin(), probes.end(), never_fires),
+                 probes.end());
+}
+
+void Optimiser::optimise()
+{
+  root_->accept(*this);
+}
+
+void Optimiser::fold(std::unique_ptr<Expression> &expr)
+{
+  expr->accept(*this);
+  if (folded_)
+    expr = std::move(folded_);
+}
+
+// Drops statements that can't run or have no effect, and replaces ifs on a
+// constant with the branch taken
+void Optimiser::prune(StatementList &stmts)
+{
+  StatementList pruned;
+  for (auto &stmt : stmts)
+  {
+    stmt->accept(*this);
+
+    if (auto *if_block = dynamic_cast<If *>(stmt.get()))
+    {
+      if (auto *cond = dynamic_cast<Integer *>(if_block->cond.get()))
+      {
+        auto &taken = cond->n ? if_block->stmts : if_block->else_stmts;
+        if (taken)
+        {
+          for (auto &taken_stmt : *taken)
+            pruned.push_back(std::move(taken_stmt));
+        }
+      }
+      else
+        pruned.push_back(std::move(stmt));
+    }
+    else if (auto *while_block = dynamic_cast<While *>(stmt.get()))
+    {
+      auto *cond = dynamic_cast<Integer *>(while_block->cond.get());
+      if (!cond || cond->n)
+        pruned.push_back(std::move(stmt));
+    }
+    else if (auto *expr = dynamic_cast<ExprStatement *>(stmt.get()))
+    {
+      if (!is_pure(*expr->expr))
+        pruned.push_back(std::move(stmt));
+    }
+    else
+      pruned.push_back(std::move(stmt));
+
+    // Nothing after a jump runs
+    if (!pruned.empty() && dynamic_cast<Jump *>(pruned.back().get()))
+      break;
+  }
+  stmts = std::move(pruned);
+}
+
+// Removes side effect free assignments to variables which are never read,
+// returning whether there were any
+bool Optimiser::remove_unused_vars(StatementList &stmts)
+{
+  bool removed = false;
+  for (auto it = stmts.begin(); it != stmts.end();)
+  {
+    Statement *stmt = it->get();
+    if (auto *assignment = dynamic_cast<AssignVarStatement *>(stmt))
+    {
+      if (var_reads_[assignment->var->ident] == 0 &&
+          is_pure(*assignment->expr))
+      {
+        it = stmts.erase(it);
+        removed = true;
+        continue;
+      }
+    }
+    else if (auto *if_block = dynamic_cast<If *>(stmt))
+    {
+      removed |= remove_unused_vars(*if_block->stmts);
+      if (if_block->else_stmts)
+        removed |= remove_unused_vars(*if_block->else_stmts);
+    }
+    else if (auto *unroll = dynamic_cast<Unroll *>(stmt))
+      removed |= remove_unused_vars(*unroll->stmts);
+    else if (auto *while_block = dynamic_cast<While *>(stmt))
+      removed |= remove_unused_vars(*while_block->stmts);
+    ++it;
+  }
+  return removed;
+}
+
+// Moves side effect free assignments into the then branch of an if right
+// after them, when nothing else reads the variable, so that the work is only
+// done once the condition holds. reads holds the reads of each variable in
+// the whole probe.
+void Optimiser::sink(StatementList &stmts,
+                     const std::map<std::string, int> &reads)
+{
+  for (size_t i = stmts.size(); i-- > 1;)
+  {
+    auto *assignment = dynamic_cast<AssignVarStatement *>(stmts[i - 1].get());
+    auto *if_block = dynamic_cast<If *>(stmts[i].get());
+    if (!assignment || !if_block || !is_pure(*assignment->expr) ||
+        !is_pure(*if_block->cond))
+      continue;
+
+    auto saved_reads = std::move(var_reads_);
+    var_reads_.clear();
+    for (auto &stmt : *if_block->stmts)
+      stmt->accept(*this);
+    int then_reads = var_reads_[assignment->var->ident];
+    var_reads_ = std::move(saved_reads);
+
+    auto total = reads.find(assignment->var->ident);
+    if (then_reads == 0 || total == reads.end() || total->second != then_reads)
+      continue;
+
+    if_block->stmts->insert(if_block->stmts->begin(), std::move(stmts[i - 1]));
+    stmts.erase(stmts.begin() + i - 1);
+  }
+
+  for (auto &stmt : stmts)
+  {
+    if (auto *if_block = dynamic_cast<If *>(stmt.get()))
+    {
+      sink(*if_block->stmts, reads);
+      if (if_block->else_stmts)
+        sink(*if_block->else_stmts, reads);
+    }
+    else if (auto *unroll = dynamic_cast<Unroll *>(stmt.get()))
+      sink(*unroll->stmts, reads);
+    else if (auto *while_block = dynamic_cast<While *>(stmt.get()))
+      sink(*while_block->stmts, reads);
+  }
+}
+
+// Orders the operands of a chain of side effect free && or || by cost, so
+// that short circuiting skips the expensive ones whenever the cheap ones
+// decide the result
+void Optimiser::reorder(Binop &binop)
+{
+  using OperandFn = std::function<void(std::unique_ptr<Expression> &)>;
+  // Calls fn on each operand of the chain, left to right
+  std::function<void(std::unique_ptr<Expression> &, const OperandFn &)> walk =
+      [&](std::unique_ptr<Expression> &expr, const OperandFn &fn) {
+        auto *chain = dynamic_cast<Binop *>(expr.get());
+        if (chain && chain->op == binop.op)
+        {
+          walk(chain->left, fn);
+          walk(chain->right, fn);
+        }
+        else
+          fn(expr);
+      };
+
+  std::vector<int> costs;
+  bool pure = true;
+  auto inspect = [&](std::unique_ptr<Expression> &expr) {
+    costs.push_back(cost(*expr));
+    pure = pure && is_pure(*expr);
+  };
+  walk(binop.left, inspect);
+  walk(binop.right, inspect);
+  if (!pure || std::is_sorted(costs.begin(), costs.end()))
+    return;
+
+  ExpressionList operands;
+  auto take = [&](std::unique_ptr<Expression> &expr) {
+    operands.push_back(std::move(expr));
+  };
+  walk(binop.left, take);
+  walk(binop.right, take);
+  std::stable_sort(operands.begin(),
+                   operands.end(),
+                   [this](const std::unique_ptr<Expression> &a,
+                          const std::unique_ptr<Expression> &b) {
+                     return cost(*a) < cost(*b);
+                   });
+
+  std::unique_ptr<Expression> left = std::move(operands.front());
+  for (size_t i = 1; i + 1 < operands.size(); i++)
+    left = std::make_unique<Binop>(std::move(left),
+                                   binop.op,
+                                   std::move(operands[i]),
+                                   binop.loc);
+  binop.left = std::move(left);
+  binop.right = std::move(operands.back());
+}
+
+// Rough cost of evaluating an expression at run time: 1 for a register or
+// context access, 2 for a helper returning an integer, more for reading
+// memory, map lookups and stacks
+int Optimiser::cost(Expression &expr)
+{
+  const int read_cost = 20;
+
+  auto list_cost = [this](ExpressionList *list) {
+    int total = 0;
+    if (list)
+    {
+      for (auto &elem : *list)
+        total += cost(*elem);
+    }
+    return total;
+  };
+
+  if (auto *builtin = dynamic_cast<Builtin *>(&expr))
+  {
+    const auto &ident = builtin->ident;
+    if (ident == "kstack" || ident == "ustack")
+      return 100;
+    if (ident == "comm" || ident.compare(0, 4, "sarg") == 0)
+      return read_cost;
+    if (ident.compare(0, 3, "arg") == 0 || ident == "retval" ||
+        ident == "ctx" || ident == "func" || ident == "probe" ||
+        ident == "cpid")
+      return 1;
+    return 2;
+  }
+  if (dynamic_cast<Variable *>(&expr))
+    return 1;
+  if (auto *map = dynamic_cast<Map *>(&expr))
+    return 10 + list_cost(map->vargs.get());
+  if (auto *call = dynamic_cast<Call *>(&expr))
+  {
+    int args = list_cost(call->vargs.get());
+    if (call->func == "kstack" || call->func == "ustack")
+      return 100 + args;
+    if (call->func == "str" || call->func == "buf")
+      return read_cost + args;
+    return 10 + args;
+  }
+  if (auto *tuple = dynamic_cast<Tuple *>(&expr))
+    return list_cost(tuple->elems.get());
+  if (auto *binop = dynamic_cast<Binop *>(&expr))
+    return 1 + cost(*binop->left) + cost(*binop->right);
+  if (auto *unop = dynamic_cast<Unop *>(&expr))
+    return (unop->op == Parser::token::MUL ? read_cost : 1) +
+           cost(*unop->expr);
+  if (auto *ternary = dynamic_cast<Ternary *>(&expr))
+    return 1 + cost(*ternary->cond) + cost(*ternary->left) +
+           cost(*ternary->right);
+  if (auto *acc = dynamic_cast<FieldAccess *>(&expr))
+  {
+    // Tracepoint arguments are read straight from the context
+    auto *builtin = dynamic_cast<Builtin *>(acc->expr.get());
+    if (builtin && builtin->ident == "args")
+      return 1;
+    return read_cost + cost(*acc->expr);
+  }
+  if (auto *arr = dynamic_cast<ArrayAccess *>(&expr))
+    return read_cost + cost(*arr->expr) + cost(*arr->indexpr);
+  if (auto *cast = dynamic_cast<Cast *>(&expr))
+    return cost(*cast->expr);
+  return 0;
+}
+
+// Whether evaluating an expression has no effect besides its value. Only
+// calls which just compute a value are assumed to have none.
+bool Optimiser::is_pure(Expression &expr)
+{
+  if (dynamic_cast<Integer *>(&expr) || dynamic_cast<String *>(&expr) ||
+      dynamic_cast<PositionalParameter *>(&expr) ||
+      dynamic_cast<StackMode *>(&expr) || dynamic_cast<Identifier *>(&expr) ||
+      dynamic_cast<Builtin *>(&expr) || dynamic_cast<Variable *>(&expr))
+    return true;
+
+  auto pure_list = [this](ExpressionList *list) {
+    return !list || std::all_of(list->begin(),
+                                list->end(),
+                                [this](std::unique_ptr<Expression> &elem) {
+                                  return is_pure(*elem);
+                                });
+  };
+  if (auto *map = dynamic_cast<Map *>(&expr))
+    return pure_list(map->vargs.get());
+  if (auto *tuple = dynamic_cast<Tuple *>(&expr))
+    return pure_list(tuple->elems.get());
+  if (auto *binop = dynamic_cast<Binop *>(&expr))
+    return is_pure(*binop->left) && is_pure(*binop->right);
+  if (auto *unop = dynamic_cast<Unop *>(&expr))
+    return unop->op != Parser::token::INCREMENT &&
+           unop->op != Parser::token::DECREMENT && is_pure(*unop->expr);
+  if (auto *ternary = dynamic_cast<Ternary *>(&expr))
+    return is_pure(*ternary->cond) && is_pure(*ternary->left) &&
+           is_pure(*ternary->right);
+  if (auto *acc = dynamic_cast<FieldAccess *>(&expr))
+    return is_pure(*acc->expr);
+  if (auto *arr = dynamic_cast<ArrayAccess *>(&expr))
+    return is_pure(*arr->expr) && is_pure(*arr->indexpr);
+  if (auto *cast = dynamic_cast<Cast *>(&expr))
+    return is_pure(*cast->expr);
+  if (auto *call = dynamic_cast<Call *>(&expr))
+  {
+    static const std::set<std::string> pure_calls = {
+      "buf",  "cgroupid", "kaddr", "kptr",  "ksym",   "kstack", "ntop",
+      "reg",  "sizeof",   "str",   "strncmp", "uaddr", "uptr",  "ustack",
+      "usym",
+    };
+    return pure_calls.count(call->func) && pure_list(call->vargs.get());
+  }
+  return false;
+}
+
+// String literals and str($N) of a string parameter, or of one which wasn't
+// given, are known up front. str() truncates the parameter to what fits in
+// BPFTRACE_STRLEN.
+bool Optimiser::const_string(Expression &expr, std::string &str)
+{
+  if (auto *string = dynamic_cast<String *>(&expr))
+  {
+    str = string->str;
+    return true;
+  }
+
+  auto *call = dynamic_cast<Call *>(&expr);
+  if (!call || call->func != "str" || !call->vargs ||
+      call->vargs->size() != 1)
+    return false;
+  auto *param = dynamic_cast<PositionalParameter *>(call->vargs->at(0).get());
+  if (!param || param->ptype != PositionalParameterType::positional ||
+      param->n <= 0)
+    return false;
+  str = bpftrace_.get_param(param->n, true);
+  if (is_numeric(str) || bpftrace_.strlen_ == 0)
+    return false;
+  str = str.substr(0, bpftrace_.strlen_ - 1);
+  return true;
+}
+
+} // namespace ast
+} // namespace bpftrace
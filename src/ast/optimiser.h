@@ -0,0 +1,76 @@
+#pragma once
+
+#include "ast.h"
+#include "bpftrace.h"
+#include <map>
+#include <memory>
+#include <string>
+
+namespace bpftrace {
+namespace ast {
+
+// Folds constant expressions, including positional parameters, and removes
+// code that can never run or whose result is never used. Cheap conditions
+// are moved ahead of expensive ones, and expensive work behind the
+// conditions it's only needed for.
+//
+// Runs between a semantic analysis that checks the program as written and
+// the one codegen works from, so that maps, printf() formats and the like
+// which only dead code refers to are never set up.
+class Optimiser : public Visitor {
+public:
+  explicit Optimiser(Node *root, BPFtrace &bpftrace)
+      : root_(root), bpftrace_(bpftrace)
+  { }
+
+  void visit(Integer &integer) override;
+  void visit(PositionalParameter &param) override;
+  void visit(String &string) override;
+  void visit(StackMode &mode) override;
+  void visit(Identifier &identifier) override;
+  void visit(Builtin &builtin) override;
+  void visit(Call &call) override;
+  void visit(Map &map) override;
+  void visit(Variable &var) override;
+  void visit(Binop &binop) override;
+  void visit(Unop &unop) override;
+  void visit(Ternary &ternary) override;
+  void visit(FieldAccess &acc) override;
+  void visit(ArrayAccess &arr) override;
+  void visit(Cast &cast) override;
+  void visit(Tuple &tuple) override;
+  void visit(ExprStatement &expr) override;
+  void visit(AssignMapStatement &assignment) override;
+  void visit(AssignVarStatement &assignment) override;
+  void visit(If &if_block) override;
+  void visit(Unroll &unroll) override;
+  void visit(While &while_block) override;
+  void visit(Jump &jump) override;
+  void visit(Predicate &pred) override;
+  void visit(AttachPoint &ap) override;
+  void visit(Probe &probe) override;
+  void visit(Program &program) override;
+
+  void optimise();
+
+private:
+  void fold(std::unique_ptr<Expression> &expr);
+  void prune(StatementList &stmts);
+  bool remove_unused_vars(StatementList &stmts);
+  void sink(StatementList &stmts, const std::map<std::string, int> &reads);
+  void reorder(Binop &binop);
+  int cost(Expression &expr);
+  bool is_pure(Expression &expr);
+  bool const_string(Expression &expr, std::string &str);
+
+  Node *root_;
+  BPFtrace &bpftrace_;
+
+  // Constant replacing the expression visited last, if it could be folded
+  std::unique_ptr<Expression> folded_;
+  // Number of reads of each variable of the probe being visited
+  std::map<std::string, int> var_reads_;
+};
+
+} // namespace ast
+} // namespace bpftrace
@@ -6,6 +6,8 @@
 #include "log.h"
 #include "parser.tab.hh"
 #include "printf.h"
+#include "qhist.h"
+#include "sketch.h"
 #include "tracepoint_format_parser.h"
 #include "usdt.h"
 #include <algorithm>
@@ -122,6 +124,12 @@ void SemanticAnalyser::visit(Identifier &identifier)
     identifier.type = CreateInt(
         std::get<0>(getIntcasts().at(identifier.ident)));
   }
+  else if (func_ == "print" && func_arg_idx_ == 1 &&
+           identifier.ident == "delta")
+  {
+    // print(@map, delta): a mode selector rather than a value
+    identifier.type = CreateNone();
+  }
   else {
     identifier.type = CreateNone();
     LOG(ERROR, identifier.loc, err_)
@@ -424,6 +432,97 @@ void SemanticAnalyser::visit(Call &call)
 
     call.type = CreateHist();
   }
+  else if (call.func == "qhist") {
+    check_assignment(call, true, false, false);
+    if (check_varargs(call, 1, 2)) {
+      check_arg(call, Type::integer, 0);
+      if (call.vargs->size() == 2 && check_arg(call, Type::integer, 1, true) &&
+          is_final_pass())
+      {
+        auto &precision = static_cast<Integer &>(*call.vargs->at(1));
+        if (precision.n < 0 || precision.n > QHIST_MAX_PRECISION)
+        {
+          LOG(ERROR, call.loc, err_)
+              << "qhist() precision must be between 0 and "
+              << QHIST_MAX_PRECISION << " (" << precision.n << " provided)";
+        }
+      }
+
+      // store args for later passing to bpftrace::Map
+      if (call.map && is_final_pass())
+      {
+        auto precision = [](const ExpressionList &args) {
+          auto *arg = args.size() == 2 ? dynamic_cast<Integer *>(args.at(1).get())
+                                       : nullptr;
+          return arg ? arg->n : QHIST_DEFAULT_PRECISION;
+        };
+        auto search = map_args_.find(call.map->ident);
+        if (search == map_args_.end())
+        {
+          map_args_.insert({ call.map->ident, call.vargs.get() });
+        }
+        else if (precision(*search->second) != precision(*call.vargs))
+        {
+          LOG(ERROR, call.loc, err_)
+              << "qhist() precision must be the same for every assignment to "
+              << call.map->ident;
+        }
+      }
+    }
+    call.type = CreateQhist();
+  }
+  else if (call.func == "bhist") {
+    // The counters of all buckets make up a single map value
+    const size_t max_bounds = 32;
+    size_t nbounds = 1;
+    check_assignment(call, true, false, false);
+    if (check_varargs(call, 2, max_bounds + 1)) {
+      nbounds = call.vargs->size() - 1;
+      check_arg(call, Type::integer, 0);
+      bool literal = true;
+      for (size_t i = 1; i <= nbounds; i++)
+        literal = check_arg(call, Type::integer, i, true) && literal;
+
+      if (literal && call.map && is_final_pass())
+      {
+        for (size_t i = 2; i <= nbounds; i++)
+        {
+          auto &prev = static_cast<Integer &>(*call.vargs->at(i - 1));
+          auto &bound = static_cast<Integer &>(*call.vargs->at(i));
+          if (bound.n <= prev.n)
+          {
+            LOG(ERROR, call.loc, err_)
+                << "bhist() boundaries must be in increasing order ("
+                << bound.n << " follows " << prev.n << ")";
+            break;
+          }
+        }
+
+        // store args for later passing to bpftrace::Map
+        auto search = map_args_.find(call.map->ident);
+        if (search == map_args_.end())
+        {
+          map_args_.insert({ call.map->ident, call.vargs.get() });
+        }
+        else
+        {
+          auto &other = *search->second;
+          bool same = other.size() == call.vargs->size();
+          for (size_t i = 1; same && i <= nbounds; i++)
+            same = static_cast<Integer &>(*other.at(i)).n ==
+                   static_cast<Integer &>(*call.vargs->at(i)).n;
+          if (!same)
+          {
+            LOG(ERROR, call.loc, err_)
+                << "bhist() boundaries must be the same for every "
+                   "assignment to "
+                << call.map->ident;
+          }
+        }
+      }
+    }
+    call.type = CreateBhist(nbounds + 1);
+  }
   else if (call.func == "lhist") {
     check_assignment(call, true, false, false);
     if (check_nargs(call, 4)) {
@@ -481,6 +580,80 @@ void SemanticAnalyser::visit(Call &call)
     }
     call.type = CreateLhist();
   }
+  else if (call.func == "topk") {
+    if (check_assignment(call, true, false, false) && check_nargs(call, 2) &&
+        check_arg(call, Type::integer, 1, true) && is_final_pass())
+    {
+      auto &key_arg = *call.vargs->at(0);
+      auto &k = static_cast<Integer &>(*call.vargs->at(1));
+      if (!key_arg.type.IsIntTy() && !key_arg.type.IsStringTy() &&
+          !key_arg.type.IsStack())
+      {
+        LOG(ERROR, call.loc, err_)
+            << "topk() only supports integer, string and stack arguments ("
+            << key_arg.type.type << " provided)";
+      }
+      if (k.n < 1 || k.n > 1000)
+      {
+        LOG(ERROR, call.loc, err_)
+            << "topk() k must be between 1 and 1000 (" << k.n << " provided)";
+      }
+      if (call.map->vargs)
+      {
+        LOG(ERROR, call.loc, err_)
+            << "topk() can't be assigned to a map with keys, its first "
+               "argument is the key";
+      }
+
+      // store args for later passing to bpftrace::Map
+      auto search = map_args_.find(call.map->ident);
+      if (search == map_args_.end())
+        map_args_.insert({ call.map->ident, call.vargs.get() });
+    }
+    call.type = CreateTopk();
+  }
+  else if (call.func == "distinct") {
+    long precision = DISTINCT_DEFAULT_PRECISION;
+    if (check_assignment(call, true, false, false) &&
+        check_varargs(call, 1, 2))
+    {
+      if (call.vargs->size() == 2 && check_arg(call, Type::integer, 1, true))
+        precision = static_cast<Integer &>(*call.vargs->at(1)).n;
+
+      auto &arg = *call.vargs->at(0);
+      if (is_final_pass() && !arg.type.IsIntTy() && !arg.type.IsStringTy() &&
+          !arg.type.IsStack())
+      {
+        LOG(ERROR, call.loc, err_)
+            << "distinct() only supports integer, string and stack arguments ("
+            << arg.type.type << " provided)";
+      }
+      if (precision < DISTINCT_MIN_PRECISION ||
+          precision > DISTINCT_MAX_PRECISION)
+      {
+        if (is_final_pass())
+          LOG(ERROR, call.loc, err_)
+              << "distinct() precision must be between "
+              << DISTINCT_MIN_PRECISION << " and " << DISTINCT_MAX_PRECISION
+              << " (" << precision << " provided)";
+        precision = DISTINCT_DEFAULT_PRECISION;
+      }
+    }
+    call.type = CreateDistinct(precision);
+
+    if (call.map)
+    {
+      auto search = map_val_.find(call.map->ident);
+      if (search != map_val_.end() && search->second.IsDistinctTy() &&
+          search->second.size != call.type.size)
+      {
+        LOG(ERROR, call.loc, err_)
+            << "distinct() precision must be the same for every assignment "
+               "to "
+            << call.map->ident;
+      }
+    }
+  }
   else if (call.func == "count") {
     check_assignment(call, true, false, false);
     check_nargs(call, 0);
@@ -856,7 +1029,20 @@ void SemanticAnalyser::visit(Call &call)
               << "indexed by a key";
         }
 
-        if (is_final_pass())
+        if (is_final_pass() && is_print_delta(call))
+        {
+          if (call.vargs->size() > 2)
+            LOG(ERROR, call.loc, err_)
+                << "print() in delta mode does not take top or div arguments";
+          if (!(map.type.IsCountTy() || map.type.IsSumTy() ||
+                map.type.IsMinTy() || map.type.IsMaxTy() ||
+                map.type.IsIntTy()))
+            LOG(ERROR, call.loc, err_)
+                << "print() in delta mode only supports count(), sum(), "
+                   "min(), max() and integer maps ("
+                << map.type << " provided)";
+        }
+        else if (is_final_pass())
         {
           if (call.vargs->size() > 1)
             check_arg(call, Type::integer, 1, true);
@@ -958,6 +1144,47 @@ void SemanticAnalyser::visit(Call &call)
       bpftrace_.strftime_args_.push_back(fmt.str);
     }
   }
+  else if (call.func == "ratelimit" || call.func == "sample")
+  {
+    call.type = CreateUInt64();
+    if (check_varargs(call, 1, 2) &&
+        check_arg(call, Type::integer, 0, true) && is_final_pass())
+    {
+      auto &rate = static_cast<Integer &>(*call.vargs->at(0));
+      if (rate.n < 1)
+      {
+        LOG(ERROR, call.loc, err_)
+            << call.func << "() argument must be >= 1 (" << rate.n
+            << " provided)";
+      }
+      else if (call.func == "ratelimit" && rate.n > 1000000000)
+      {
+        LOG(ERROR, call.loc, err_)
+            << "ratelimit() can't exceed one event per nanosecond ("
+            << rate.n << " provided)";
+      }
+
+      if (call.vargs->size() == 1)
+        bpftrace_.ratelimit_sites_++;
+      else
+      {
+        // Keyed state lives in a hash map, see create_maps_impl
+        auto &key = *call.vargs->at(1);
+        if (key.type.IsIntTy())
+          bpftrace_.ratelimit_key_size_ = std::max<size_t>(
+              bpftrace_.ratelimit_key_size_, 8);
+        else if (key.type.IsStringTy())
+          bpftrace_.ratelimit_key_size_ = std::max<size_t>(
+              bpftrace_.ratelimit_key_size_, (key.type.size + 7) & ~7);
+        else
+        {
+          LOG(ERROR, call.loc, err_)
+              << call.func << "() key must be an integer or a string ("
+              << key.type.type << " provided)";
+        }
+      }
+    }
+  }
   else if (call.func == "kstack") {
     check_stack_call(call, true);
   }
@@ -1863,6 +2090,11 @@ void SemanticAnalyser::visit(AssignMapStatement &assignment)
     if (type.IsArrayTy())
       LOG(ERROR, assignment.expr->loc, err_)
           << "Assigning array is not supported (#1057)";
+    if ((type.IsDistinctTy() || type.IsBhistTy() || type.IsTopkTy()) &&
+        !dynamic_cast<Call *>(assignment.expr.get()))
+      LOG(ERROR, assignment.expr->loc, err_)
+          << "The value of a " << typestr(type.type)
+          << "() map can only be printed";
   }
 }
 
@@ -1879,6 +2111,13 @@ void SemanticAnalyser::visit(AssignVarStatement &assignment)
   {
     LOG(ERROR, assignment.loc, err_) << "args cannot be assigned to a variable";
   }
+  if (assignment.expr->type.IsDistinctTy() ||
+      assignment.expr->type.IsBhistTy() || assignment.expr->type.IsTopkTy())
+  {
+    LOG(ERROR, assignment.loc, err_)
+        << "The value of a " << typestr(assignment.expr->type.type)
+        << "() map can only be printed";
+  }
 
   if (search != variable_val_.end()) {
     if (search->second.IsNoneTy())
@@ -2240,6 +2479,29 @@ void SemanticAnalyser::visit(Probe &probe)
   {
     stmt->accept(*this);
   }
+
+  // Codegen may split large probes at top level statements and chain the
+  // parts with tail calls. A prog array only takes programs of one type, so
+  // this is limited to the kprobe program type.
+  if (is_final_pass() && bpftrace_.split_insns_ > 0 && probe.stmts->size() > 1)
+  {
+    probe.splittable = std::all_of(
+        probe.attach_points->begin(),
+        probe.attach_points->end(),
+        [](auto &ap) {
+          return progtype(probetype(ap->provider)) == BPF_PROG_TYPE_KPROBE;
+        });
+  }
+  if (probe.splittable)
+  {
+    // Variables are handed over to the next part in a per-CPU scratch
+    // buffer, as the BPF stack doesn't survive a tail call
+    size_t vars_size = 0;
+    for (auto &var : variable_val_)
+      vars_size += (var.second.size + 7) / 8 * 8;
+    bpftrace_.tail_call_scratch_size_ = std::max(
+        bpftrace_.tail_call_scratch_size_, vars_size);
+  }
 }
 
 void SemanticAnalyser::visit(Program &program)
@@ -2277,10 +2539,74 @@ int SemanticAnalyser::create_maps(bool debug)
     return create_maps_impl<bpftrace::Map>();
 }
 
+// The maps chaining the parts of split probes are only needed once codegen
+// found a program too large for the kernel, see
+// BPFtrace::split_large_probes()
+int SemanticAnalyser::create_tail_call_maps(bool debug)
+{
+  if (debug)
+    return create_tail_call_maps_impl<bpftrace::FakeMap>();
+  else
+    return create_tail_call_maps_impl<bpftrace::Map>();
+}
+
+// The scratch buffer is only needed once codegen found temporaries which
+// don't fit on the BPF stack, see CodegenLLVM::needs_scratch()
+int SemanticAnalyser::create_scratch_map(bool debug)
+{
+  if (debug)
+    return create_scratch_map_impl<bpftrace::FakeMap>();
+  else
+    return create_scratch_map_impl<bpftrace::Map>();
+}
+
+template <typename T>
+int SemanticAnalyser::create_scratch_map_impl(void)
+{
+  auto map = std::make_unique<T>(
+      "scratch", BPF_MAP_TYPE_PERCPU_ARRAY, 4, bpftrace_.scratch_size_, 1, 0);
+  int mapfd = map->mapfd_;
+  bpftrace_.maps.Set(MapManager::Type::Scratch, std::move(map));
+  if (mapfd < 0)
+  {
+    out_ << "Creation of the scratch buffer map has failed." << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+template <typename T>
+int SemanticAnalyser::create_tail_call_maps_impl(void)
+{
+  uint32_t failed_maps = 0;
+  auto is_invalid_map = [](int a) -> uint8_t { return a < 0 ? 1 : 0; };
+
+  auto map = std::make_unique<T>(
+      "tail_calls", BPF_MAP_TYPE_PROG_ARRAY, 4, 4, TAIL_CALL_SLOTS, 0);
+  failed_maps += is_invalid_map(map->mapfd_);
+  bpftrace_.maps.Set(MapManager::Type::TailCalls, std::move(map));
+
+  map = std::make_unique<T>(
+      "tail_call_scratch",
+      BPF_MAP_TYPE_PERCPU_ARRAY,
+      4,
+      std::max<size_t>(bpftrace_.tail_call_scratch_size_, 8),
+      1,
+      0);
+  failed_maps += is_invalid_map(map->mapfd_);
+  bpftrace_.maps.Set(MapManager::Type::TailCallScratch, std::move(map));
+
+  if (failed_maps > 0)
+    out_ << "Creation of the tail call maps has failed." << std::endl;
+
+  return failed_maps;
+}
+
 template <typename T>
 int SemanticAnalyser::create_maps_impl(void)
 {
   uint32_t failed_maps = 0;
+  size_t zeroes_size = 0;
   auto is_invalid_map = [](int a) -> uint8_t { return a < 0 ? 1 : 0; };
   for (auto &map_val : map_val_)
   {
@@ -2316,12 +2642,65 @@ int SemanticAnalyser::create_maps_impl(void)
       failed_maps += is_invalid_map(map->mapfd_);
       bpftrace_.maps.Add(std::move(map));
     }
+    else if (type.IsBhistTy())
+    {
+      auto map_args = map_args_.find(map_name);
+      if (map_args == map_args_.end())
+      {
+        out_ << "map arg \"" << map_name << "\" not found" << std::endl;
+        abort();
+      }
+
+      auto map = std::make_unique<T>(map_name, type, key, bpftrace_.mapmax_);
+      for (size_t i = 1; i < map_args->second->size(); i++)
+        map->bhist_bounds.push_back(
+            static_cast<Integer &>(*map_args->second->at(i)).n);
+      failed_maps += is_invalid_map(map->mapfd_);
+      bpftrace_.maps.Add(std::move(map));
+    }
+    else if (type.IsQhistTy())
+    {
+      auto map = std::make_unique<T>(map_name, type, key, bpftrace_.mapmax_);
+      map->qprecision = QHIST_DEFAULT_PRECISION;
+      auto map_args = map_args_.find(map_name);
+      if (map_args != map_args_.end() && map_args->second->size() == 2)
+        map->qprecision = static_cast<Integer &>(*map_args->second->at(1)).n;
+      failed_maps += is_invalid_map(map->mapfd_);
+      bpftrace_.maps.Add(std::move(map));
+    }
+    else if (type.IsTopkTy())
+    {
+      auto map_args = map_args_.find(map_name);
+      if (map_args == map_args_.end())
+      {
+        out_ << "map arg \"" << map_name << "\" not found" << std::endl;
+        abort();
+      }
+
+      // The candidate table is keyed by the first topk() argument
+      SizedType key_type = map_args->second->at(0)->type;
+      if (key_type.IsIntTy())
+        key_type = CreateInteger(64, key_type.IsSigned());
+      MapKey topk_key;
+      topk_key.args_.push_back(key_type);
+
+      Integer &k = static_cast<Integer &>(*map_args->second->at(1));
+      auto map = std::make_unique<T>(
+          map_name, type, topk_key, k.n * TOPK_CANDIDATES);
+      map->topk_k = k.n;
+      failed_maps += is_invalid_map(map->mapfd_);
+      failed_maps += is_invalid_map(map->sketch_fd_);
+      bpftrace_.maps.Add(std::move(map));
+    }
     else
     {
       auto map = std::make_unique<T>(map_name, type, key, bpftrace_.mapmax_);
       failed_maps += is_invalid_map(map->mapfd_);
       bpftrace_.maps.Add(std::move(map));
     }
+
+    if (type.IsDistinctTy() || type.IsBhistTy())
+      zeroes_size = std::max(zeroes_size, type.size);
   }
 
   for (StackType stack_type : needs_stackid_maps_) {
@@ -2354,6 +2733,49 @@ int SemanticAnalyser::create_maps_impl(void)
     failed_maps += is_invalid_map(map->mapfd_);
     bpftrace_.maps.Set(MapManager::Type::Elapsed, std::move(map));
   }
+  if (zeroes_size > 0)
+  {
+    // Source of the initial value of distinct() and bhist() map entries, never
+    // written to
+    auto map = std::make_unique<T>(
+        "zeroes", BPF_MAP_TYPE_ARRAY, 4, zeroes_size, 1, 0);
+    failed_maps += is_invalid_map(map->mapfd_);
+    bpftrace_.maps.Set(MapManager::Type::Zeroes, std::move(map));
+  }
+  if (bpftrace_.ratelimit_sites_ > 0)
+  {
+    // One u64 of state per call site and CPU
+    auto map = std::make_unique<T>("ratelimit",
+                                   BPF_MAP_TYPE_PERCPU_ARRAY,
+                                   4,
+                                   8,
+                                   bpftrace_.ratelimit_sites_,
+                                   0);
+    failed_maps += is_invalid_map(map->mapfd_);
+    bpftrace_.maps.Set(MapManager::Type::Ratelimit, std::move(map));
+  }
+  if (bpftrace_.ratelimit_key_size_ > 0)
+  {
+    // One u64 of state per call site and key, shared by all CPUs. Keys are
+    // the call site followed by the zero padded key value.
+    auto map = std::make_unique<T>("ratelimit_keys",
+                                   BPF_MAP_TYPE_LRU_HASH,
+                                   8 + bpftrace_.ratelimit_key_size_,
+                                   8,
+                                   bpftrace_.mapmax_,
+                                   0);
+    failed_maps += is_invalid_map(map->mapfd_);
+    bpftrace_.maps.Set(MapManager::Type::RatelimitKeys, std::move(map));
+  }
+  if (bpftrace_.adaptive_sampling_ && (!bpftrace_.printf_args_.empty() ||
+                                       !bpftrace_.non_map_print_args_.empty()))
+  {
+    // Shared printf() and print() sample rate, written by userspace
+    auto map = std::make_unique<T>(
+        "sample_rate", BPF_MAP_TYPE_ARRAY, 4, 8, 1, 0);
+    failed_maps += is_invalid_map(map->mapfd_);
+    bpftrace_.maps.Set(MapManager::Type::SampleRate, std::move(map));
+  }
 
   {
     auto map = std::make_unique<T>(BPF_MAP_TYPE_PERF_EVENT_ARRAY);
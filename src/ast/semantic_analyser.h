@@ -64,6 +64,8 @@ public:
   void visit(Probe &probe) override;
   void visit(Program &program) override;
   int create_maps(bool debug);
+  int create_tail_call_maps(bool debug);
+  int create_scratch_map(bool debug);
 
   int analyse();
 
@@ -92,6 +94,10 @@ private:
   ProbeType single_provider_type(void);
   template <typename T>
   int create_maps_impl(void);
+  template <typename T>
+  int create_tail_call_maps_impl(void);
+  template <typename T>
+  int create_scratch_map_impl(void);
 
   bool in_loop(void)
   {
@@ -29,6 +29,9 @@ namespace libbpf {
 
 namespace bpftrace {
 
+// Only print verifier statistics, from the kernel's bpf_verifier.h
+const int BPF_LOG_STATS = 4;
+
 /*
  * Kernel functions that are unsafe to trace are excluded in the Kernel with
  * `notrace`. However, the ones below are not excluded.
@@ -133,8 +136,11 @@ int AttachedProbe::detach_kfunc(void)
 }
 #endif // HAVE_BCC_KFUNC
 
-AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func, bool safe_mode)
-  : probe_(probe), func_(func)
+AttachedProbe::AttachedProbe(Probe &probe,
+                             std::tuple<uint8_t *, uintptr_t> func,
+                             bool safe_mode,
+                             const std::vector<TailCallProg> &tail_calls)
+    : probe_(probe), func_(func), tail_calls_(tail_calls)
 {
   load_prog();
   if (bt_verbose)
@@ -177,8 +183,11 @@ AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func
   }
 }
 
-AttachedProbe::AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func, int pid)
-  : probe_(probe), func_(func)
+AttachedProbe::AttachedProbe(Probe &probe,
+                             std::tuple<uint8_t *, uintptr_t> func,
+                             int pid,
+                             const std::vector<TailCallProg> &tail_calls)
+    : probe_(probe), func_(func), tail_calls_(tail_calls)
 {
   load_prog();
   switch (probe_.type)
@@ -241,6 +250,8 @@ AttachedProbe::~AttachedProbe()
 
   if (progfd_ >= 0)
     close(progfd_);
+  for (int progfd : tail_call_progfds_)
+    close(progfd);
 }
 
 std::string AttachedProbe::eventprefix() const
@@ -551,10 +562,39 @@ void AttachedProbe::resolve_offset_kprobe(bool safe_mode)
       path, symbol, sym_offset, func_offset, safe_mode, probe_.type);
 }
 
+std::vector<int> AttachedProbe::progfds() const
+{
+  std::vector<int> progfds = { progfd_ };
+  progfds.insert(progfds.end(),
+                 tail_call_progfds_.begin(),
+                 tail_call_progfds_.end());
+  return progfds;
+}
+
 void AttachedProbe::load_prog()
 {
-  uint8_t *insns = std::get<0>(func_);
-  int prog_len = std::get<1>(func_);
+  progfd_ = load_func(func_);
+
+  // Parts the probe was split into are only reached through the tail call
+  // map. The slots are shared by all probes attached to the same program, any
+  // of them loading the parts will do.
+  for (size_t i = 0; i < tail_calls_.size(); i++)
+  {
+    auto &tail_call = tail_calls_[i];
+    int progfd = load_func(tail_call.func, i + 1);
+    tail_call_progfds_.push_back(progfd);
+    if (bpf_update_elem(tail_call.map_fd, &tail_call.slot, &progfd, 0))
+      throw std::runtime_error("Error adding program to the tail call map: " +
+                               probe_.name);
+  }
+}
+
+int AttachedProbe::load_func(std::tuple<uint8_t *, uintptr_t> func,
+                             size_t part)
+{
+  uint8_t *insns = std::get<0>(func);
+  int prog_len = std::get<1>(func);
+  int progfd = -1;
   const char *license = "GPL";
   int log_level = 0;
 
@@ -576,6 +616,9 @@ void AttachedProbe::load_prog()
     if (bt_verbose)
       log_level = 1;
 
+    if (probe_.prog_stats)
+      log_level |= BPF_LOG_STATS;
+
     // bpf_prog_load rejects colons in the probe name
     strncpy(name, probe_.name.c_str(), STRING_SIZE - 1);
     namep = name;
@@ -606,25 +649,33 @@ void AttachedProbe::load_prog()
       }
 
 #ifdef HAVE_BCC_PROG_LOAD
-      progfd_ = bcc_prog_load(progtype(probe_.type),
-                              namep,
+      progfd = bcc_prog_load(progtype(probe_.type),
+                             namep,
 #else
-      progfd_ = bpf_prog_load(progtype(probe_.type),
-                              namep,
+      progfd = bpf_prog_load(progtype(probe_.type),
+                             namep,
 #endif
-                              reinterpret_cast<struct bpf_insn *>(insns),
-                              prog_len,
-                              license,
-                              version,
-                              log_level,
-                              log_buf.get(),
-                              log_buf_size);
-      if (progfd_ >= 0)
+                             reinterpret_cast<struct bpf_insn *>(insns),
+                             prog_len,
+                             license,
+                             version,
+                             log_level,
+                             log_buf.get(),
+                             log_buf_size);
+      if (progfd >= 0)
         break;
+
+      // Kernels before 5.2 don't know about BPF_LOG_STATS and log every
+      // instruction instead, which may not fit into the buffer
+      if (errno == ENOSPC && log_level == BPF_LOG_STATS)
+      {
+        log_level = 0;
+        attempt--;
+      }
     }
   }
 
-  if (progfd_ < 0) {
+  if (progfd < 0) {
     if (bt_verbose) {
       std::cerr << std::endl
                 << "Error log: " << std::endl
@@ -636,10 +687,10 @@ void AttachedProbe::load_prog()
                << "environment variable beyond the current value of "
                << probe_.log_size << " bytes";
 
-        throw std::runtime_error(errmsg.str());
+        throw ProgLoadException(errmsg.str());
       }
     }
-    throw std::runtime_error("Error loading program: " + probe_.name + (bt_verbose ? "" : " (try -v)"));
+    throw ProgLoadException("Error loading program: " + probe_.name + (bt_verbose ? "" : " (try -v)"));
   }
 
   if (bt_verbose) {
@@ -647,7 +698,7 @@ void AttachedProbe::load_prog()
     uint32_t info_len = sizeof(info);
     int ret;
 
-    ret = bpf_obj_get_info(progfd_, &info, &info_len);
+    ret = bpf_obj_get_info(progfd, &info, &info_len);
     if (ret == 0) {
       std::cout << std::endl << "Program ID: " << info.id << std::endl;
     }
@@ -655,6 +706,54 @@ void AttachedProbe::load_prog()
               << "Bytecode: " << std::endl
               << log_buf.get() << std::endl;
   }
+
+  if (probe_.prog_stats)
+    collect_prog_stats(progfd, log_level ? log_buf.get() : "", part);
+
+  return progfd;
+}
+
+void AttachedProbe::collect_prog_stats(int progfd, const char *log, size_t part)
+{
+  ProgStats stats;
+  stats.name = probe_.name;
+  if (part > 0)
+    stats.name += " (part " + std::to_string(part) + ")";
+
+  struct bpf_prog_info info = {};
+  uint32_t info_len = sizeof(info);
+  if (bpf_obj_get_info(progfd, &info, &info_len) == 0)
+  {
+    stats.xlated_insns = info.xlated_prog_len / sizeof(struct bpf_insn);
+    stats.jited_bytes = info.jited_prog_len;
+  }
+  parse_verifier_stats(log, stats);
+
+  prog_stats_.push_back(stats);
+}
+
+void AttachedProbe::parse_verifier_stats(const std::string &log,
+                                         ProgStats &stats)
+{
+  // The verifier ends its log with lines like
+  //   stack depth 24+8
+  //   processed 17 insns (limit 1000000) max_states_per_insn 0 ...
+  // where the stack depth has a part for each BPF-to-BPF subprogram
+  static const std::regex insns_re("processed (\\d+) insns");
+  static const std::regex stack_re("stack depth ([0-9+]+)");
+  std::smatch match;
+
+  if (std::regex_search(log, match, insns_re))
+    stats.verified_insns = std::stoull(match[1]);
+
+  if (std::regex_search(log, match, stack_re))
+  {
+    std::stringstream depths(match[1].str());
+    std::string depth;
+    while (std::getline(depths, depth, '+'))
+      if (!depth.empty())
+        stats.stack_depth += std::stoull(depth);
+  }
 }
 
 void AttachedProbe::attach_kprobe(bool safe_mode)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -15,17 +16,53 @@ bpf_probe_attach_type attachtype(ProbeType t);
 bpf_prog_type progtype(ProbeType t);
 std::string progtypeName(bpf_prog_type t);
 
+// Part of a probe split by codegen, loaded into `slot` of the tail call map
+struct TailCallProg
+{
+  int map_fd;
+  int slot;
+  std::tuple<uint8_t *, uintptr_t> func;
+};
+
+// Thrown when the kernel doesn't load a probe's program, e.g. as the verifier
+// rejects it
+class ProgLoadException : public std::runtime_error
+{
+public:
+  ProgLoadException(const std::string &msg) : std::runtime_error(msg)
+  {
+  }
+};
+
 class AttachedProbe
 {
 public:
   AttachedProbe(Probe &probe,
                 std::tuple<uint8_t *, uintptr_t> func,
-                bool safe_mode);
-  AttachedProbe(Probe &probe, std::tuple<uint8_t *, uintptr_t> func, int pid);
+                bool safe_mode,
+                const std::vector<TailCallProg> &tail_calls = {});
+  AttachedProbe(Probe &probe,
+                std::tuple<uint8_t *, uintptr_t> func,
+                int pid,
+                const std::vector<TailCallProg> &tail_calls = {});
   ~AttachedProbe();
   AttachedProbe(const AttachedProbe &) = delete;
   AttachedProbe &operator=(const AttachedProbe &) = delete;
 
+  // Only collected if the probe asks for it
+  const std::vector<ProgStats> &prog_stats() const
+  {
+    return prog_stats_;
+  }
+  static void parse_verifier_stats(const std::string &log, ProgStats &stats);
+
+  const Probe &probe() const
+  {
+    return probe_;
+  }
+  // The probe's program and the parts it was split into
+  std::vector<int> progfds() const;
+
 private:
   std::string eventprefix() const;
   std::string eventname() const;
@@ -33,6 +70,8 @@ private:
   void resolve_offset_kprobe(bool safe_mode);
   void resolve_offset_uprobe(bool safe_mode);
   void load_prog();
+  int load_func(std::tuple<uint8_t *, uintptr_t> func, size_t part = 0);
+  void collect_prog_stats(int progfd, const char *log, size_t part);
   void attach_kprobe(bool safe_mode);
   void attach_uprobe(bool safe_mode);
   void attach_usdt(int pid);
@@ -47,8 +86,11 @@ private:
 
   Probe &probe_;
   std::tuple<uint8_t *, uintptr_t> func_;
+  std::vector<TailCallProg> tail_calls_;
   std::vector<int> perf_event_fds_;
   int progfd_ = -1;
+  std::vector<int> tail_call_progfds_;
+  std::vector<ProgStats> prog_stats_;
   uint64_t offset_ = 0;
 #ifdef HAVE_BCC_KFUNC
   int tracing_fd_ = -1;
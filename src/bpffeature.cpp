@@ -6,11 +6,17 @@
 #include <cstddef>
 #include <cstdio>
 #include <fcntl.h>
+#include <filesystem>
 #include <fstream>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
 #include "btf.h"
 #include "list.h"
+#include "log.h"
 #include "utils.h"
 
 namespace bpftrace {
@@ -25,10 +31,15 @@ static bool try_load(const char* name,
                      char* logbuf,
                      size_t logbuf_size)
 {
+  // Once a program has loaded, the kernel is known to accept the version it
+  // was loaded with, so later failures are down to the program itself and
+  // retrying with other versions is pointless.
+  static std::optional<int> good_attempt;
+
   int ret = 0;
   StderrSilencer silencer;
   silencer.silence();
-  for (int attempt = 0; attempt < 3; attempt++)
+  for (int attempt = good_attempt.value_or(0); attempt < 3; attempt++)
   {
     auto version = kernel_version(attempt);
     if (version == 0 && attempt > 0)
@@ -57,8 +68,11 @@ static bool try_load(const char* name,
     if (ret >= 0)
     {
       close(ret);
+      good_attempt = attempt;
       return true;
     }
+    if (good_attempt)
+      break;
   }
 
   return false;
@@ -181,10 +195,30 @@ bool BPFfeature::has_loop(void)
   return has_loop();
 }
 
+bool BPFfeature::has_bpf_call(void)
+{
+  if (has_bpf_call_.has_value())
+    return *has_bpf_call_;
+
+  // Call a local subprogram that returns 0
+  struct bpf_insn insns[] = {
+    BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, BPF_PSEUDO_CALL, 0, 1),
+    BPF_EXIT_INSN(),
+    BPF_MOV64_IMM(BPF_REG_0, 0),
+    BPF_EXIT_INSN(),
+  };
+
+  has_bpf_call_ = std::make_optional<bool>(
+      try_load(libbpf::BPF_PROG_TYPE_KPROBE, insns, ARRAY_SIZE(insns)));
+
+  return has_bpf_call();
+}
+
 bool BPFfeature::has_btf(void)
 {
-  BTF btf;
-  return btf.has_data();
+  if (!has_btf_.has_value())
+    has_btf_ = std::make_optional<bool>(BTF().has_data());
+  return *has_btf_;
 }
 
 int BPFfeature::instruction_limit(void)
@@ -304,6 +338,7 @@ std::string BPFfeature::report(void)
   buf << "Kernel features" << std::endl
       << "  Instruction limit: " << instruction_limit() << std::endl
       << "  Loop support: " << to_str(has_loop())
+      << "  BPF-to-BPF calls: " << to_str(has_bpf_call())
       << "  btf (depends on Build:libbpf): " << to_str(has_btf())
       << "  map batch (depends on Build:libbpf): " << to_str(has_map_batch())
       << std::endl;
@@ -326,4 +361,152 @@ std::string BPFfeature::report(void)
   return buf.str();
 }
 
+bool BPFfeature::parse_report(std::istream &in)
+{
+  // Labels as used by report()
+  std::map<std::string, std::optional<bool> *> checks = {
+    { "probe_read", &has_probe_read_ },
+    { "probe_read_str", &has_probe_read_str_ },
+    { "probe_read_user", &has_probe_read_user_ },
+    { "probe_read_user_str", &has_probe_read_user_str_ },
+    { "probe_read_kernel", &has_probe_read_kernel_ },
+    { "probe_read_kernel_str", &has_probe_read_kernel_str_ },
+    { "get_current_cgroup_id", &has_get_current_cgroup_id_ },
+    { "send_signal", &has_send_signal_ },
+    { "override_return", &has_override_return_ },
+    { "get_boot_ns", &has_ktime_get_boot_ns_ },
+    { "Loop support", &has_loop_ },
+    { "BPF-to-BPF calls", &has_bpf_call_ },
+    { "btf (depends on Build:libbpf)", &has_btf_ },
+    { "map batch (depends on Build:libbpf)", &has_map_batch_ },
+    { "hash", &map_hash_ },
+    { "percpu hash", &map_percpu_hash_ },
+    { "array", &map_array_ },
+    { "percpu array", &map_percpu_array_ },
+    { "stack_trace", &map_stack_trace_ },
+    { "perf_event_array", &map_perf_event_array_ },
+    { "kprobe", &prog_kprobe_ },
+    { "tracepoint", &prog_tracepoint_ },
+    { "perf_event", &prog_perf_event_ },
+    { "kfunc", &prog_kfunc_ },
+  };
+
+  bool found = false;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    // Checks are indented by two spaces, section headers aren't
+    if (line.rfind("  ", 0) != 0)
+      continue;
+    auto sep = line.find(": ");
+    if (sep == std::string::npos)
+      continue;
+    std::string label = line.substr(2, sep - 2);
+    std::string value = line.substr(sep + 2);
+
+    if (label == "Instruction limit")
+    {
+      try
+      {
+        insns_limit_ = std::make_optional<int>(std::stoi(value));
+        found = true;
+      }
+      catch (const std::exception &)
+      {
+      }
+      continue;
+    }
+
+    auto check = checks.find(label);
+    if (check == checks.end() || (value != "yes" && value != "no"))
+      continue;
+    *check->second = std::make_optional<bool>(value == "yes");
+    found = true;
+  }
+
+  return found;
+}
+
+std::string BPFfeature::cache_key(void)
+{
+  // Feature checks depend on the kernel and its settings, the latter of which
+  // may have changed since the last boot. The BTF file is checked by has_btf()
+  // and may be replaced at any time.
+  struct utsname utsname;
+  uname(&utsname);
+
+  std::string boot_id;
+  std::ifstream boot_id_file("/proc/sys/kernel/random/boot_id");
+  std::getline(boot_id_file, boot_id);
+
+  std::string btf_path = "/sys/kernel/btf/vmlinux";
+  if (const char *env_p = std::getenv("BPFTRACE_BTF"))
+    btf_path = env_p;
+  std::string btf = "none";
+  struct stat st;
+  if (stat(btf_path.c_str(), &st) == 0)
+    btf = btf_path + ":" + std::to_string(st.st_size) + ":" +
+          std::to_string(st.st_mtime);
+
+  return std::string(utsname.release) + " " + boot_id + " " + btf;
+}
+
+bool BPFfeature::read_cache(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  bool trusted = is_trusted_file(fd);
+  std::string contents;
+  char buf[4096];
+  ssize_t len;
+  while (trusted && (len = read(fd, buf, sizeof(buf))) > 0)
+    contents.append(buf, len);
+  close(fd);
+  if (!trusted)
+  {
+    LOG(WARNING) << "Ignoring feature cache " << path
+                 << " as it isn't owned by the current user or others can "
+                    "write to it";
+    return false;
+  }
+
+  std::istringstream cache(contents);
+  std::string line;
+  return std::getline(cache, line) && line == "key: " + cache_key() &&
+         parse_report(cache);
+}
+
+void BPFfeature::use_cache(const std::string &path)
+{
+  if (read_cache(path))
+    return;
+
+  // Runs all checks which haven't been done yet
+  std::string contents = "key: " + cache_key() + "\n" + report();
+
+  // Written to a temporary file first, so that bpftrace instances starting
+  // concurrently never read a partial file. O_EXCL keeps it from following
+  // a link someone else put in its place.
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+  std::string tmp_path = path + "." + std::to_string(getpid());
+  int fd = open(tmp_path.c_str(),
+                O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  bool written = fd >= 0 &&
+                 write(fd, contents.c_str(), contents.size()) ==
+                     static_cast<ssize_t>(contents.size());
+  if (fd >= 0)
+    close(fd);
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0)
+  {
+    LOG(WARNING) << "Could not write feature cache " << path;
+    if (fd >= 0)
+      unlink(tmp_path.c_str());
+  }
+}
+
 } // namespace bpftrace
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <bcc/libbpf.h>
+#include <istream>
 #include <memory>
 #include <optional>
 #include <string>
@@ -67,11 +68,25 @@ public:
 
   int instruction_limit();
   bool has_loop();
+  bool has_bpf_call();
   bool has_btf();
   bool has_map_batch();
 
   std::string report(void);
 
+  // Takes the results of feature checks from the output of report(), as far
+  // as it covers them. Returns false if none were found.
+  bool parse_report(std::istream &in);
+
+  // Serves the feature checks from the cache file at `path` if it was written
+  // by the running kernel since it booted. Otherwise runs all of them and
+  // writes the file, which holds the key followed by report() output.
+  void use_cache(const std::string &path);
+  // Takes the results of feature checks from the cache file at `path`, if it
+  // matches the running kernel and only the current user can write to it
+  bool read_cache(const std::string &path);
+  static std::string cache_key(void);
+
   DEFINE_MAP_TEST(array, libbpf::BPF_MAP_TYPE_ARRAY);
   DEFINE_MAP_TEST(hash, libbpf::BPF_MAP_TYPE_HASH);
   DEFINE_MAP_TEST(percpu_array, libbpf::BPF_MAP_TYPE_PERCPU_ARRAY);
@@ -95,8 +110,10 @@ public:
 
 protected:
   std::optional<bool> has_loop_;
+  std::optional<bool> has_bpf_call_;
   std::optional<int> insns_limit_;
   std::optional<bool> has_map_batch_;
+  std::optional<bool> has_btf_;
 
 private:
   bool detect_map(enum libbpf::bpf_map_type map_type);
@@ -46,6 +46,9 @@ private:
   RTDyldObjectLinkingLayer ObjectLayer;
   IRCompileLayer<decltype(ObjectLayer), SimpleCompiler> CompileLayer;
 
+  // Owners of the memory of sections taken over by merge()
+  std::vector<std::unique_ptr<BpfOrc>> merged_;
+
 public:
   std::map<std::string, std::tuple<uint8_t *, uintptr_t>> sections_;
 
@@ -64,6 +67,14 @@ public:
     cantFail(CompileLayer.emitAndFinalize(mod));
   }
 
+  // Takes over the sections of another BpfOrc, which is kept around as it
+  // owns their memory
+  void merge(std::unique_ptr<BpfOrc> other)
+  {
+    sections_.insert(other->sections_.begin(), other->sections_.end());
+    merged_.push_back(std::move(other));
+  }
+
   ModuleHandle addModule(std::unique_ptr<Module> M)
   {
     // We don't actually care about resolving symbols from other modules
@@ -89,6 +100,9 @@ private:
   IRCompileLayer<decltype(ObjectLayer), SimpleCompiler> CompileLayer;
 #endif
 
+  // Owners of the memory of sections taken over by merge()
+  std::vector<std::unique_ptr<BpfOrc>> merged_;
+
 public:
   std::map<std::string, std::tuple<uint8_t *, uintptr_t>> sections_;
 
@@ -147,6 +161,14 @@ public:
     cantFail(CompileLayer.emitAndFinalize(K));
   }
 
+  // Takes over the sections of another BpfOrc, which is kept around as it
+  // owns their memory
+  void merge(std::unique_ptr<BpfOrc> other)
+  {
+    sections_.insert(other->sections_.begin(), other->sections_.end());
+    merged_.push_back(std::move(other));
+  }
+
   VModuleKey addModule(std::unique_ptr<Module> M)
   {
     auto K = ES.allocateVModule();
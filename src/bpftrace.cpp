@@ -15,6 +15,7 @@
 #include <sys/personality.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -34,7 +35,9 @@
 #include "bpftrace.h"
 #include "log.h"
 #include "printf.h"
+#include "qhist.h"
 #include "resolve_cgroupid.h"
+#include "sketch.h"
 #include "triggers.h"
 #include "utils.h"
 
@@ -192,6 +195,8 @@ BPFtrace::~BPFtrace()
 
   if (ksyms_)
     bcc_free_symcache(ksyms_, -1);
+
+  disable_run_stats();
 }
 
 int BPFtrace::add_probe(ast::Probe &p)
@@ -205,6 +210,7 @@ int BPFtrace::add_probe(ast::Probe &p)
       probe.attach_point = attach_point->provider + "_trigger";
       probe.type = probetype(attach_point->provider);
       probe.log_size = log_size_;
+      probe.prog_stats = print_prog_stats_;
       probe.orig_name = p.name();
       probe.name = p.name();
       probe.loc = 0;
@@ -322,6 +328,7 @@ int BPFtrace::add_probe(ast::Probe &p)
       probe.attach_point = func_id;
       probe.type = probetype(attach_point->provider);
       probe.log_size = log_size_;
+      probe.prog_stats = print_prog_stats_;
       probe.orig_name = p.name();
       probe.ns = attach_point->ns;
       probe.name = attach_point->name(target, func_id);
@@ -529,6 +536,68 @@ int BPFtrace::num_probes() const
   return special_probes_.size() + probes_.size();
 }
 
+// Forgets what semantic analysis recorded about the program's calls, for it
+// to be analysed again once the optimiser has changed the program
+void BPFtrace::clear_analysis()
+{
+  static_cast<ProgramAnalysis &>(*this) = ProgramAnalysis();
+}
+
+// Picks the probes codegen has to split as their programs, or a part of them,
+// are larger than the kernel takes. Returns whether there are any, in which
+// case the probes and probe ids added by codegen are dropped for it to run
+// again.
+bool BPFtrace::split_large_probes(
+    const BpfOrc &bpforc,
+    const std::map<std::string, uint64_t> &probe_insns)
+{
+  if (split_insns_ == 0)
+    return false;
+
+  auto insns = [&bpforc](const std::string &section) -> uint64_t {
+    auto func = bpforc.sections_.find(section);
+    if (func == bpforc.sections_.end())
+      return 0;
+    return std::get<1>(func->second) / sizeof(struct bpf_insn);
+  };
+
+  bool split = false;
+  for (auto &[section, ir_insns] : probe_insns)
+  {
+    uint64_t largest = insns(section);
+    auto parts = tail_call_sections_.find(section);
+    if (parts != tail_call_sections_.end())
+    {
+      for (auto &part : parts->second)
+        largest = std::max(largest, insns(part.second));
+    }
+    if (largest <= split_insns_)
+      continue;
+
+    // IR and BPF instruction counts only roughly go hand in hand, so aim for
+    // parts at three quarters of the limit, and halve them from there on
+    auto budget = split_sections_.find(section);
+    if (budget == split_sections_.end())
+      split_sections_[section] = std::max<uint64_t>(
+          ir_insns * split_insns_ * 3 / 4 / largest, 1);
+    else if (budget->second > 1)
+      budget->second /= 2;
+    else
+      continue;
+    split = true;
+  }
+
+  if (split)
+  {
+    probes_.clear();
+    special_probes_.clear();
+    tail_call_sections_.clear();
+    probe_ids_.clear();
+    next_probe_id_ = 0;
+  }
+  return split;
+}
+
 void BPFtrace::request_finalize()
 {
   finalize_ = true;
@@ -550,6 +619,12 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
   auto arg_data = data_aligned.data();
 
   auto printf_id = *reinterpret_cast<uint64_t*>(arg_data);
+  // printf() and print() records carry their adaptive sample rate in the
+  // upper half
+  uint32_t sample_rate = printf_id >> 32;
+  printf_id &= 0xffffffff;
+  bool packed_strings = printf_id & ASYNC_PACKED_STRINGS;
+  printf_id &= ~ASYNC_PACKED_STRINGS;
 
   int err;
 
@@ -582,8 +657,21 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
                                map->name_ + "\", err=" + std::to_string(err));
     return;
   }
+  else if (printf_id == asyncactionint(AsyncAction::print_delta))
+  {
+    auto print = static_cast<AsyncEvent::Print *>(data);
+    IMap *map = *bpftrace->maps[print->mapid];
+
+    err = bpftrace->print_map_delta(*map);
+
+    if (err)
+      throw std::runtime_error("Could not print map with ident \"" +
+                               map->name_ + "\", err=" + std::to_string(err));
+    return;
+  }
   else if (printf_id == asyncactionint(AsyncAction::print_non_map))
   {
+    bpftrace->report_sample_rate(sample_rate);
     auto print = static_cast<AsyncEvent::PrintNonMap *>(data);
     const SizedType &ty = bpftrace->non_map_print_args_.at(print->print_id);
 
@@ -640,14 +728,20 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
   {
     uint64_t join_id = (uint64_t) * (static_cast<uint64_t *>(data) + 1);
     auto delim = bpftrace->join_args_[join_id].c_str();
+    uint64_t nargs = std::min<uint64_t>(
+        *(static_cast<uint64_t *>(data) + 2), bpftrace->join_argnum_);
     std::stringstream joined;
-    for (unsigned int i = 0; i < bpftrace->join_argnum_; i++) {
-      auto *arg = arg_data + 2*sizeof(uint64_t) + i * bpftrace->join_argsize_;
-      if (arg[0] == 0)
-        break;
+    // Arguments are packed back to back, each with its trailing NUL, and
+    // followed by stale data
+    size_t offset = 3 * sizeof(uint64_t);
+    for (uint64_t i = 0; i < nargs && offset < data_aligned.size(); i++)
+    {
+      auto *arg = reinterpret_cast<char *>(arg_data + offset);
+      size_t len = strnlen(arg, data_aligned.size() - offset);
       if (i)
         joined << delim;
-      joined << arg;
+      joined << std::string(arg, len);
+      offset += len + 1;
     }
     bpftrace->out_->message(MessageType::join, joined.str());
     return;
@@ -678,7 +772,9 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
     auto id = printf_id - asyncactionint(AsyncAction::syscall);
     auto fmt = std::get<0>(bpftrace->system_args_[id]);
     auto args = std::get<1>(bpftrace->system_args_[id]);
-    auto arg_values = bpftrace->get_arg_values(args, arg_data);
+    auto arg_values = bpftrace->get_arg_values(args,
+                                               arg_data,
+                                               packed_strings);
 
     bpftrace->out_->message(MessageType::syscall,
                             exec_system(format(fmt, arg_values).c_str()),
@@ -690,7 +786,9 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
     auto id = printf_id - asyncactionint(AsyncAction::cat);
     auto fmt = std::get<0>(bpftrace->cat_args_[id]);
     auto args = std::get<1>(bpftrace->cat_args_[id]);
-    auto arg_values = bpftrace->get_arg_values(args, arg_data);
+    auto arg_values = bpftrace->get_arg_values(args,
+                                               arg_data,
+                                               packed_strings);
 
     std::stringstream buf;
     cat_file(format(fmt, arg_values).c_str(), bpftrace->cat_bytes_max_, buf);
@@ -700,9 +798,13 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
   }
 
   // printf
+  bpftrace->report_sample_rate(sample_rate);
+
   auto fmt = std::get<0>(bpftrace->printf_args_[printf_id]);
   auto args = std::get<1>(bpftrace->printf_args_[printf_id]);
-  auto arg_values = bpftrace->get_arg_values(args, arg_data);
+  auto arg_values = bpftrace->get_arg_values(args,
+                                             arg_data,
+                                             packed_strings);
 
   if (bpftrace->printf_callback_) {
     bpftrace->printf_callback_(arg_data);
@@ -712,7 +814,12 @@ void perf_event_printer(void *cb_cookie, void *data, int size)
   bpftrace->out_->message(MessageType::printf, format(fmt, arg_values), false);
 }
 
-std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(const std::vector<Field> &args, uint8_t* arg_data)
+// Packed strings are stored behind the fixed part of the record, whose field
+// holds their offset in the lower and their length in the upper half
+std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(
+    const std::vector<Field> &args,
+    uint8_t *arg_data,
+    bool packed_strings)
 {
   std::vector<std::unique_ptr<IPrintable>> arg_values;
 
@@ -748,8 +855,15 @@ std::vector<std::unique_ptr<IPrintable>> BPFtrace::get_arg_values(const std::vec
       case Type::string:
       {
         auto p = reinterpret_cast<char *>(arg_data + arg.offset);
+        size_t len = arg.type.size;
+        if (packed_strings)
+        {
+          uint64_t packed = *reinterpret_cast<uint64_t *>(p);
+          p = reinterpret_cast<char *>(arg_data + (packed & 0xffffffff));
+          len = std::min<size_t>(packed >> 32, len);
+        }
         arg_values.push_back(std::make_unique<PrintableString>(
-            std::string(p, strnlen(p, arg.type.size))));
+            std::string(p, strnlen(p, len))));
         break;
       }
       case Type::buffer:
@@ -847,6 +961,7 @@ size_t BPFtrace::num_params() const
 void perf_event_lost(void *cb_cookie, uint64_t lost)
 {
   auto bpftrace = static_cast<BPFtrace*>(cb_cookie);
+  bpftrace->lost_since_adjust_ += lost;
   bpftrace->out_->lost_events(lost);
 }
 
@@ -854,13 +969,15 @@ std::vector<std::unique_ptr<AttachedProbe>> BPFtrace::attach_usdt_probe(
     Probe &probe,
     std::tuple<uint8_t *, uintptr_t> func,
     int pid,
-    bool file_activation)
+    bool file_activation,
+    const std::vector<TailCallProg> &tail_calls)
 {
   std::vector<std::unique_ptr<AttachedProbe>> ret;
 
   if (!(file_activation && probe.path.size()))
   {
-    ret.emplace_back(std::make_unique<AttachedProbe>(probe, func, pid));
+    ret.emplace_back(
+        std::make_unique<AttachedProbe>(probe, func, pid, tail_calls));
     return ret;
   }
 
@@ -915,8 +1032,11 @@ std::vector<std::unique_ptr<AttachedProbe>> BPFtrace::attach_usdt_probe(
         throw std::runtime_error("failed to parse pid=" + pid_str);
       }
 
-      ret.emplace_back(
-          std::make_unique<AttachedProbe>(probe, func, pid_parsed));
+      ret.emplace_back(std::make_unique<AttachedProbe>(
+          probe,
+          func,
+          pid_parsed,
+          ret.empty() ? tail_calls : std::vector<TailCallProg>()));
       break;
     }
   }
@@ -953,6 +1073,28 @@ std::vector<std::unique_ptr<AttachedProbe>> BPFtrace::attach_probe(
       LOG(ERROR) << "Code not generated for probe: " << probe.name;
     return ret;
   }
+
+  // The parts of a split probe are only reached through the tail call map,
+  // the first probe attached to its program loads them for all of them
+  std::vector<TailCallProg> tail_calls;
+  auto tail_call_sections = tail_call_sections_.find(func->first);
+  if (tail_call_sections != tail_call_sections_.end() &&
+      !tail_calls_loaded_.count(func->first))
+  {
+    int map_fd = maps[MapManager::Type::TailCalls].value()->mapfd_;
+    for (auto &[slot, section] : tail_call_sections->second)
+    {
+      auto tail_call = bpforc.sections_.find(section);
+      if (tail_call == bpforc.sections_.end())
+      {
+        LOG(ERROR) << "Code not generated for probe: " << probe.name
+                   << " part: " << section;
+        return ret;
+      }
+      tail_calls.push_back({ map_fd, slot, tail_call->second });
+    }
+  }
+
   try
   {
     pid_t pid = child_ ? child_->pid() : this->pid();
@@ -960,30 +1102,64 @@ std::vector<std::unique_ptr<AttachedProbe>> BPFtrace::attach_probe(
     if (probe.type == ProbeType::usdt)
     {
       auto aps = attach_usdt_probe(
-          probe, func->second, pid, usdt_file_activation_);
+          probe, func->second, pid, usdt_file_activation_, tail_calls);
       for (auto &ap : aps)
         ret.emplace_back(std::move(ap));
-
-      return ret;
     }
     else if (probe.type == ProbeType::watchpoint)
     {
-      ret.emplace_back(
-          std::make_unique<AttachedProbe>(probe, func->second, pid));
-      return ret;
+      ret.emplace_back(std::make_unique<AttachedProbe>(
+          probe, func->second, pid, tail_calls));
     }
     else
     {
-      ret.emplace_back(
-          std::make_unique<AttachedProbe>(probe, func->second, safe_mode_));
+      ret.emplace_back(std::make_unique<AttachedProbe>(
+          probe, func->second, safe_mode_, tail_calls));
+    }
+  }
+  catch (ProgLoadException &e)
+  {
+    // Only the kernel rejecting the program is worth another try with fully
+    // optimised code
+    BpfOrc *full_bpforc = full_bpforc_ ? full_bpforc_() : nullptr;
+    if (full_bpforc && full_bpforc != &bpforc)
+    {
+      if (bt_verbose)
+        std::cerr << e.what() << std::endl
+                  << "Retrying " << probe.name
+                  << " with fully optimised code" << std::endl;
+      ret = attach_probe(probe, *full_bpforc);
+      if (ret.empty())
+        LOG(ERROR) << "Before the retry with fully optimised code: "
+                   << e.what();
       return ret;
     }
+
+    LOG(ERROR) << e.what();
+    ret.clear();
+    return ret;
   }
   catch (std::runtime_error &e)
   {
     LOG(ERROR) << e.what();
     ret.clear();
+    return ret;
   }
+
+  // Each attached probe loads its own copy of the program
+  uint64_t size = ret.size() * std::get<1>(func->second);
+  for (auto &tail_call : tail_calls)
+    size += std::get<1>(tail_call.func);
+  timings_.count("programs", ret.size() + tail_calls.size());
+  timings_.count("insns", size / sizeof(struct bpf_insn));
+  if (!tail_calls.empty() && !ret.empty())
+    tail_calls_loaded_.insert(func->first);
+
+  for (auto &ap : ret)
+    prog_stats_.insert(prog_stats_.end(),
+                       ap->prog_stats().begin(),
+                       ap->prog_stats().end());
+
   return ret;
 }
 
@@ -1040,6 +1216,12 @@ int BPFtrace::run() {
     return status;
   }
 
+  timings_.stop();
+  if (print_timings_)
+    out_->timings(timings_);
+  if (print_prog_stats_)
+    out_->prog_stats(prog_stats_);
+
   if (bt_verbose)
     std::cerr << "Running..." << std::endl;
 
@@ -1047,6 +1229,11 @@ int BPFtrace::run() {
   bool stop = false;
   while (!stop) {
     stop = poll_perf_events();
+
+    if (print_run_stats_ && run_stats_interval_ > 0 &&
+        std::chrono::steady_clock::now() - run_stats_printed_ >=
+            std::chrono::seconds(run_stats_interval_))
+      print_run_stats();
   }
 
   // Run the END block and wrap-up.
@@ -1061,6 +1248,13 @@ int BPFtrace::deploy()
   if (epollfd_ < 0)
     return epollfd_;
 
+  if (print_run_stats_ && !enable_run_stats())
+  {
+    LOG(WARNING) << "Kernel BPF run time statistics are not available, "
+                    "--run-stats needs Linux 5.1 or later";
+    print_run_stats_ = false;
+  }
+
   if (maps.Has(MapManager::Type::Elapsed))
   {
     struct timespec ts;
@@ -1147,6 +1341,12 @@ int BPFtrace::deploy()
 }
 
 int BPFtrace::finalize() {
+  if (print_run_stats_)
+    print_run_stats();
+  // Put the sysctl back now rather than in the destructor, which a second
+  // Ctrl-C while the maps are printed would skip
+  disable_run_stats();
+
   attached_probes_.clear();
   // finalize_ and exitsig_recv should be false from now on otherwise
   // perf_event_printer() can ignore the END_trigger() events.
@@ -1228,6 +1428,9 @@ int BPFtrace::poll_perf_events(bool drain, int timeout)
     perf_reader_event_read((perf_reader*)events[i].data.ptr);
   }
 
+  if (maps.Has(MapManager::Type::SampleRate))
+    adjust_sample_rate();
+
   // If we are tracing a specific pid and it has exited, we should exit
   // as well b/c otherwise we'd be tracing nothing.
   if ((procmon_ && !procmon_->is_alive()) || (child_ && !child_->is_alive()))
@@ -1238,6 +1441,143 @@ int BPFtrace::poll_perf_events(bool drain, int timeout)
   return 0;
 }
 
+bool BPFtrace::enable_run_stats()
+{
+  // BPF_ENABLE_STATS (Linux 5.8) for BPF_STATS_RUN_TIME, which is 0. Spelt
+  // out as the headers we build against may predate it.
+  const int bpf_enable_stats = 32;
+  union bpf_attr attr = {};
+  run_stats_fd_ = syscall(__NR_bpf, bpf_enable_stats, &attr, sizeof(attr));
+
+  run_stats_enabled_ = std::chrono::steady_clock::now();
+  run_stats_printed_ = run_stats_enabled_;
+  if (run_stats_fd_ >= 0)
+    return true;
+
+  // Older kernels only have the global switch, which is put back at exit
+  const std::string sysctl = "/proc/sys/kernel/bpf_stats_enabled";
+  std::ifstream in(sysctl);
+  std::string old_value;
+  if (!(in >> old_value))
+    return false;
+  if (old_value == "1")
+    return true;
+
+  std::ofstream out(sysctl);
+  if (!(out << "1" << std::flush))
+    return false;
+  run_stats_sysctl_ = old_value;
+  return true;
+}
+
+void BPFtrace::disable_run_stats()
+{
+  if (run_stats_fd_ >= 0)
+  {
+    close(run_stats_fd_);
+    run_stats_fd_ = -1;
+  }
+
+  if (!run_stats_sysctl_.empty())
+  {
+    std::ofstream out("/proc/sys/kernel/bpf_stats_enabled");
+    out << run_stats_sysctl_;
+    run_stats_sysctl_.clear();
+  }
+}
+
+std::vector<RunStats> BPFtrace::get_run_stats() const
+{
+  // Wildcards expand into many attached probes, they are reported under
+  // the probe they came from
+  std::map<std::string, RunStats> by_probe;
+  for (auto &ap : attached_probes_)
+  {
+    auto &stats = by_probe[ap->probe().orig_name];
+    stats.name = ap->probe().orig_name;
+    for (int progfd : ap->progfds())
+    {
+      struct bpf_prog_info info = {};
+      uint32_t info_len = sizeof(info);
+      if (bpf_obj_get_info(progfd, &info, &info_len) != 0)
+        continue;
+      stats.run_cnt += info.run_cnt;
+      stats.run_time_ns += info.run_time_ns;
+    }
+  }
+
+  std::vector<RunStats> ret;
+  for (auto &[name, stats] : by_probe)
+    ret.push_back(stats);
+  std::stable_sort(ret.begin(),
+                   ret.end(),
+                   [](const RunStats &a, const RunStats &b) {
+                     return a.run_time_ns > b.run_time_ns;
+                   });
+  return ret;
+}
+
+void BPFtrace::print_run_stats()
+{
+  auto now = std::chrono::steady_clock::now();
+  uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            now - run_stats_enabled_)
+                            .count();
+  out_->run_stats(get_run_stats(), elapsed_ns);
+  run_stats_printed_ = now;
+}
+
+// Adaptive sampling: double the sample rate whenever events were lost, and
+// halve it again once the buffers kept up for a second.
+uint64_t BPFtrace::next_sample_rate(
+    uint64_t rate,
+    uint64_t lost,
+    std::chrono::steady_clock::duration unchanged_for)
+{
+  const uint64_t max_sample_rate = 1 << 16;
+  if (lost > 0)
+    return std::min(rate * 2, max_sample_rate);
+  if (rate > 1 && unchanged_for >= std::chrono::seconds(1))
+    return rate / 2;
+  return rate;
+}
+
+void BPFtrace::adjust_sample_rate()
+{
+  auto now = std::chrono::steady_clock::now();
+  uint64_t rate = next_sample_rate(sample_rate_,
+                                   lost_since_adjust_,
+                                   now - sample_rate_changed_);
+  // Losses at the maximum rate still hold off halving it
+  if (lost_since_adjust_ > 0 || rate != sample_rate_)
+    sample_rate_changed_ = now;
+  lost_since_adjust_ = 0;
+
+  if (rate == sample_rate_)
+    return;
+
+  uint32_t key = 0;
+  if (bpf_update_elem(maps[MapManager::Type::SampleRate].value()->mapfd_,
+                      &key,
+                      &rate,
+                      0) < 0)
+  {
+    LOG(ERROR) << "failed to update sample rate: " << strerror(errno);
+    return;
+  }
+  sample_rate_ = rate;
+}
+
+// Reports the adaptive sample rate of a record if it changed
+void BPFtrace::report_sample_rate(uint32_t rate)
+{
+  if (rate > 0 && rate != seen_sample_rate_)
+  {
+    seen_sample_rate_ = rate;
+    out_->sample_rate(rate);
+  }
+}
+
 BPFTraceMap BPFtrace::get_map(const std::string& name) {
   const auto& mapmap = maps[name];
   if (mapmap.has_value()) {
@@ -1250,6 +1590,13 @@ BPFTraceMap BPFtrace::get_map(const std::string& name) {
 BPFTraceMap BPFtrace::get_map(IMap &map) {
   BPFTraceMap values_by_key;
 
+  if (map.is_mmapped())
+  {
+    values_by_key.push_back(
+        { std::vector<uint8_t>(8, 0), read_mmapped_value(map) });
+    return values_by_key;
+  }
+
   uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
   std::vector<uint8_t> old_key;
   try
@@ -1311,6 +1658,14 @@ BPFTraceMap BPFtrace::get_map(IMap &map) {
       return max_value(a.second, nvalues) < max_value(b.second, nvalues);
     });
   }
+  else if (map.type_.IsDistinctTy())
+  {
+    std::sort(values_by_key.begin(), values_by_key.end(), [&](auto &a, auto &b)
+    {
+      return distinct_value(a.second, nvalues) <
+             distinct_value(b.second, nvalues);
+    });
+  }
   else
   {
     sort_by_key(map.key_.args_, values_by_key);
@@ -1334,11 +1689,22 @@ int BPFtrace::print_maps()
 // clear a map
 int BPFtrace::clear_map(IMap &map)
 {
+  if (map.type_.IsTopkTy() && zero_sketch(map))
+    return -1;
+
+  // Array slots can't be deleted, clearing is the same as zeroing
+  if (map.is_mmapped())
+  {
+    memset(map.mmap_, 0, map.mmap_size_);
+    return 0;
+  }
+
   std::vector<uint8_t> old_key;
   try
   {
     if (map.type_.IsHistTy() || map.type_.IsLhistTy() ||
-        map.type_.IsStatsTy() || map.type_.IsAvgTy())
+        map.type_.IsQhistTy() || map.type_.IsStatsTy() ||
+        map.type_.IsAvgTy())
       // hist maps have 8 extra bytes for the bucket number
       old_key = find_empty_key(map, map.key_.size() + 8);
     else
@@ -1376,12 +1742,24 @@ int BPFtrace::clear_map(IMap &map)
 // zero a map
 int BPFtrace::zero_map(IMap &map)
 {
+  // The keys of a topk() map are only candidates, zeroing their counts is
+  // enough
+  if (map.type_.IsTopkTy())
+    return zero_sketch(map);
+
+  if (map.is_mmapped())
+  {
+    memset(map.mmap_, 0, map.mmap_size_);
+    return 0;
+  }
+
   uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
   std::vector<uint8_t> old_key;
   try
   {
     if (map.type_.IsHistTy() || map.type_.IsLhistTy() ||
-        map.type_.IsStatsTy() || map.type_.IsAvgTy())
+        map.type_.IsQhistTy() || map.type_.IsStatsTy() ||
+        map.type_.IsAvgTy())
       // hist maps have 8 extra bytes for the bucket number
       old_key = find_empty_key(map, map.key_.size() + 8);
     else
@@ -1462,6 +1840,8 @@ std::string BPFtrace::map_value_to_str(const SizedType &stype,
     return std::to_string(min_value(value, nvalues) / div);
   else if (stype.IsMaxTy())
     return std::to_string(max_value(value, nvalues) / div);
+  else if (stype.IsDistinctTy())
+    return std::to_string(distinct_value(value, nvalues) / div);
   else if (stype.IsProbeTy())
     return resolve_probe(read_data<uint64_t>(value.data()));
   else if (stype.IsTimestampTy())
@@ -1475,10 +1855,23 @@ std::string BPFtrace::map_value_to_str(const SizedType &stype,
 
 int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div)
 {
-  if (map.type_.IsHistTy() || map.type_.IsLhistTy())
+  if (map.type_.IsHistTy() || map.type_.IsLhistTy() || map.type_.IsQhistTy())
     return print_map_hist(map, top, div);
   else if (map.type_.IsAvgTy() || map.type_.IsStatsTy())
     return print_map_stats(map, top, div);
+  else if (map.type_.IsTopkTy())
+    return print_map_topk(map, top, div);
+  else if (map.type_.IsBhistTy())
+    return print_map_bhist(map, top, div);
+
+  if (map.is_mmapped())
+  {
+    // Read straight from the memory mapping, no syscalls needed
+    if (div == 0)
+      div = 1;
+    out_->map(*this, map, top, div, get_map(map));
+    return 0;
+  }
 
   uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
   std::vector<uint8_t> old_key;
@@ -1543,6 +1936,14 @@ int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div)
       return max_value(a.second, nvalues) < max_value(b.second, nvalues);
     });
   }
+  else if (map.type_.IsDistinctTy())
+  {
+    std::sort(values_by_key.begin(), values_by_key.end(), [&](auto &a, auto &b)
+    {
+      return distinct_value(a.second, nvalues) <
+             distinct_value(b.second, nvalues);
+    });
+  }
   else
   {
     sort_by_key(map.key_.args_, values_by_key);
@@ -1554,6 +1955,119 @@ int BPFtrace::print_map(IMap &map, uint32_t top, uint32_t div)
   return 0;
 }
 
+int BPFtrace::print_map_topk(IMap &map, uint32_t top, uint32_t div)
+{
+  // Merge the per-CPU sketches
+  std::vector<uint64_t> sketch(TOPK_SKETCH_DEPTH * TOPK_SKETCH_WIDTH);
+  auto row_values = std::vector<uint8_t>(TOPK_SKETCH_WIDTH * sizeof(uint64_t) *
+                                         ncpus_);
+  for (uint32_t row = 0; row < TOPK_SKETCH_DEPTH; row++)
+  {
+    if (bpf_lookup_elem(map.sketch_fd_, &row, row_values.data()))
+    {
+      LOG(ERROR) << "failed to look up sketch of map '" << map.name_ << "'";
+      return -1;
+    }
+    auto counters = reinterpret_cast<uint64_t *>(row_values.data());
+    for (int cpu = 0; cpu < ncpus_; cpu++)
+    {
+      for (int col = 0; col < TOPK_SKETCH_WIDTH; col++)
+        sketch[row * TOPK_SKETCH_WIDTH + col] +=
+            counters[cpu * TOPK_SKETCH_WIDTH + col];
+    }
+  }
+
+  std::vector<uint8_t> old_key;
+  try
+  {
+    old_key = find_empty_key(map, map.key_.size());
+  }
+  catch (std::runtime_error &e)
+  {
+    LOG(ERROR) << "failed to get key for map '" << map.name_
+               << "': " << e.what();
+    return -2;
+  }
+  auto key(old_key);
+
+  // Estimate the count of every candidate, the smallest counter is the one
+  // with the fewest collisions
+  std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>> values_by_key;
+  while (bpf_get_next_key(map.mapfd_, old_key.data(), key.data()) == 0)
+  {
+    uint64_t hash = sketch_hash(key.data(), key.size());
+    uint64_t estimate = UINT64_MAX;
+    for (int row = 0; row < TOPK_SKETCH_DEPTH; row++)
+      estimate = std::min(estimate,
+                          sketch[row * TOPK_SKETCH_WIDTH +
+                                 sketch_column(hash, row)]);
+
+    auto value = std::vector<uint8_t>(sizeof(estimate));
+    memcpy(value.data(), &estimate, sizeof(estimate));
+    values_by_key.push_back({ key, value });
+    old_key = key;
+  }
+
+  std::sort(values_by_key.begin(), values_by_key.end(), [&](auto &a, auto &b) {
+    return read_data<uint64_t>(a.second.data()) <
+           read_data<uint64_t>(b.second.data());
+  });
+
+  if (top == 0)
+    top = map.topk_k;
+  if (div == 0)
+    div = 1;
+  out_->map(*this, map, top, div, values_by_key);
+  return 0;
+}
+
+int BPFtrace::zero_sketch(IMap &map)
+{
+  auto zero = std::vector<uint8_t>(TOPK_SKETCH_WIDTH * sizeof(uint64_t) *
+                                   ncpus_);
+  for (uint32_t row = 0; row < TOPK_SKETCH_DEPTH; row++)
+  {
+    if (bpf_update_elem(map.sketch_fd_, &row, zero.data(), BPF_EXIST))
+    {
+      LOG(ERROR) << "failed to zero sketch of map '" << map.name_ << "'";
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int BPFtrace::print_map_delta(IMap &map)
+{
+  // Only keys which are new, changed or removed since the previous delta
+  // print of this map are emitted, together with the change in value.
+  uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
+  auto &previous = map_delta_prev_[map.id];
+  std::unordered_map<std::vector<uint8_t>, int64_t, MapKeyHash> current;
+  std::vector<MapDelta> deltas;
+
+  for (auto &pair : get_map(map))
+  {
+    int64_t value = reduce_scalar(map.type_, pair.second, nvalues);
+    current.emplace(pair.first, value);
+
+    auto prev = previous.find(pair.first);
+    if (prev == previous.end())
+      deltas.push_back({ pair.first, value, value, false });
+    else if (prev->second != value)
+      deltas.push_back({ pair.first, value, value - prev->second, false });
+  }
+
+  for (auto &prev : previous)
+  {
+    if (current.find(prev.first) == current.end())
+      deltas.push_back({ prev.first, 0, -prev.second, true });
+  }
+
+  previous = std::move(current);
+  out_->map_delta(*this, map, deltas);
+  return 0;
+}
+
 int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
 {
   // A hist-map adds an extra 8 bytes onto the end of its key for storing
@@ -1605,6 +2119,9 @@ int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
       // New key - create a list of buckets for it
       if (map.type_.IsHistTy())
         values_by_key[key_prefix] = std::vector<uint64_t>(65);
+      else if (map.type_.IsQhistTy())
+        values_by_key[key_prefix] = std::vector<uint64_t>(
+            qhist_buckets(map.qprecision));
       else
         values_by_key[key_prefix] = std::vector<uint64_t>(1002);
     }
@@ -1635,6 +2152,44 @@ int BPFtrace::print_map_hist(IMap &map, uint32_t top, uint32_t div)
   return 0;
 }
 
+int BPFtrace::print_map_bhist(IMap &map, uint32_t top, uint32_t div)
+{
+  // Unlike hist(), each key holds the counters of all its buckets
+  uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
+  size_t nbuckets = map.bhist_bounds.size() + 1;
+
+  std::map<std::vector<uint8_t>, std::vector<uint64_t>> values_by_key;
+  for (auto &pair : get_map(map))
+  {
+    auto &counts = values_by_key[pair.first];
+    counts.resize(nbuckets);
+    for (uint32_t cpu = 0; cpu < nvalues; cpu++)
+    {
+      for (size_t i = 0; i < nbuckets; i++)
+        counts[i] += read_data<uint64_t>(pair.second.data() +
+                                         (cpu * nbuckets + i) * 8);
+    }
+  }
+
+  // Sort based on sum of counts in all buckets
+  std::vector<std::pair<std::vector<uint8_t>, uint64_t>> total_counts_by_key;
+  for (auto &map_elem : values_by_key)
+  {
+    uint64_t sum = 0;
+    for (uint64_t count : map_elem.second)
+      sum += count;
+    total_counts_by_key.push_back({ map_elem.first, sum });
+  }
+  std::sort(total_counts_by_key.begin(),
+            total_counts_by_key.end(),
+            [&](auto &a, auto &b) { return a.second < b.second; });
+
+  if (div == 0)
+    div = 1;
+  out_->map_hist(*this, map, top, div, values_by_key, total_counts_by_key);
+  return 0;
+}
+
 int BPFtrace::print_map_stats(IMap &map, uint32_t top, uint32_t div)
 {
   uint32_t nvalues = map.is_per_cpu_type() ? ncpus_ : 1;
@@ -1737,6 +2292,21 @@ uint64_t BPFtrace::max_value(const std::vector<uint8_t> &value, int nvalues)
   return max;
 }
 
+// Merge the per-CPU registers of a distinct() map entry and estimate its
+// cardinality
+uint64_t BPFtrace::distinct_value(const std::vector<uint8_t> &value,
+                                  int nvalues)
+{
+  size_t nregisters = value.size() / nvalues;
+  std::vector<uint8_t> registers(nregisters);
+  for (int i = 0; i < nvalues; i++)
+  {
+    for (size_t j = 0; j < nregisters; j++)
+      registers[j] = std::max(registers[j], value[i * nregisters + j]);
+  }
+  return distinct_estimate(registers);
+}
+
 int64_t BPFtrace::min_value(const std::vector<uint8_t> &value, int nvalues)
 {
   int64_t val, max = 0, retval;
@@ -1763,6 +2333,36 @@ int64_t BPFtrace::min_value(const std::vector<uint8_t> &value, int nvalues)
   return retval;
 }
 
+int64_t BPFtrace::reduce_scalar(const SizedType &stype,
+                                const std::vector<uint8_t> &value,
+                                int nvalues)
+{
+  if (stype.IsMinTy())
+    return min_value(value, nvalues);
+  else if (stype.IsMaxTy())
+    return max_value(value, nvalues);
+  else if ((stype.IsSumTy() || stype.IsIntTy()) && stype.IsSigned())
+    return reduce_value<int64_t>(value, nvalues);
+
+  return reduce_value<uint64_t>(value, nvalues);
+}
+
+// Gather the per-CPU slots of a memory mapped map into the layout
+// bpf_lookup_elem() returns for per-CPU maps.
+std::vector<uint8_t> BPFtrace::read_mmapped_value(IMap &map) const
+{
+  size_t value_size = map.type_.size;
+  size_t slot_size = ((value_size + 7) & ~7) * MMAP_CPU_STRIDE;
+  auto value = std::vector<uint8_t>(value_size * ncpus_);
+  for (int cpu = 0; cpu < ncpus_; cpu++)
+  {
+    memcpy(value.data() + cpu * value_size,
+           map.mmap_ + cpu * slot_size,
+           value_size);
+  }
+  return value;
+}
+
 std::vector<uint8_t> BPFtrace::find_empty_key(IMap &map, size_t size) const
 {
   // 4.12 and above kernel supports passing NULL to BPF_MAP_GET_NEXT_KEY
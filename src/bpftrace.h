@@ -1,10 +1,12 @@
 #pragma once
 
+#include <chrono>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <optional>
 #include <set>
+#include <string_view>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -21,6 +23,7 @@
 #include "printf.h"
 #include "procmon.h"
 #include "struct.h"
+#include "timings.h"
 #include "types.h"
 #include "utils.h"
 
@@ -90,13 +93,58 @@ struct HelperErrorInfo
 
 using BPFTraceMap = std::vector<std::pair<std::vector<uint8_t>, std::vector<uint8_t>>>;
 
-class BPFtrace
+struct MapKeyHash
+{
+  size_t operator()(const std::vector<uint8_t> &key) const
+  {
+    return std::hash<std::string_view>()(std::string_view(
+        reinterpret_cast<const char *>(key.data()), key.size()));
+  }
+};
+
+// Parts of split probes are chained through a prog array with this many
+// slots. The kernel follows at most MAX_TAIL_CALLS tail calls in a row.
+const int TAIL_CALL_SLOTS = 256;
+const int MAX_TAIL_CALLS = 32;
+
+// Stack temporaries are moved to the per-CPU scratch buffer once a program
+// would use more than SCRATCH_STACK_BUDGET bytes of its 512 byte stack,
+// leaving the rest to spilled registers. Map values of a single entry are
+// capped at MAX_SCRATCH_SIZE bytes by the kernel.
+const int SCRATCH_STACK_BUDGET = 256;
+const int MAX_SCRATCH_SIZE = 32768;
+
+// What semantic analysis records about a program for codegen and for
+// printing its output. clear_analysis() resets all of it at once before the
+// optimised program is analysed again.
+struct ProgramAnalysis
+{
+  std::vector<std::tuple<std::string, std::vector<Field>>> printf_args_;
+  std::vector<std::tuple<std::string, std::vector<Field>>> system_args_;
+  std::vector<std::string> join_args_;
+  std::vector<std::string> time_args_;
+  std::vector<std::string> strftime_args_;
+  std::vector<std::tuple<std::string, std::vector<Field>>> cat_args_;
+  std::vector<SizedType> non_map_print_args_;
+  // ratelimit() and sample() call sites, each owns a slot in the ratelimit map
+  unsigned int ratelimit_sites_ = 0;
+  // Largest key of a keyed ratelimit() or sample() call, padded to 8 bytes
+  size_t ratelimit_key_size_ = 0;
+  // Bytes of variables a split probe hands over to its next part
+  size_t tail_call_scratch_size_ = 0;
+  bool has_usdt_ = false;
+};
+
+class BPFtrace : public ProgramAnalysis
 {
 public:
   BPFtrace(std::unique_ptr<Output> o = std::make_unique<TextOutput>(std::cout)) : out_(std::move(o)),ncpus_(get_possible_cpus().size()) { }
   virtual ~BPFtrace();
   virtual int add_probe(ast::Probe &p);
   int num_probes() const;
+  bool split_large_probes(const BpfOrc &bpforc,
+                          const std::map<std::string, uint64_t> &probe_insns);
+  void clear_analysis();
   // run() is a shortcut for the following sequence:
   //   deploy(), poll_perf_events(), finalize()
   // The latter model is intended for caller managed polling.
@@ -108,6 +156,7 @@ public:
   int clear_map(IMap &map);
   int zero_map(IMap &map);
   int print_map(IMap &map, uint32_t top, uint32_t div);
+  int print_map_delta(IMap &map);
   inline int next_probe_id() {
     return next_probe_id_++;
   };
@@ -130,16 +179,36 @@ public:
   virtual std::string extract_func_symbols_from_path(const std::string &path) const;
   std::string resolve_probe(uint64_t probe_id) const;
   uint64_t resolve_cgroupid(const std::string &path) const;
-  std::vector<std::unique_ptr<IPrintable>> get_arg_values(const std::vector<Field> &args, uint8_t* arg_data);
+  std::vector<std::unique_ptr<IPrintable>> get_arg_values(
+      const std::vector<Field> &args,
+      uint8_t *arg_data,
+      bool packed_strings = false);
   void add_param(const std::string &param);
   std::string get_param(size_t index, bool is_str) const;
   size_t num_params() const;
   void request_finalize();
   bool is_aslr_enabled(int pid);
+  void adjust_sample_rate();
+  static uint64_t next_sample_rate(
+      uint64_t rate,
+      uint64_t lost,
+      std::chrono::steady_clock::duration unchanged_for);
+  void report_sample_rate(uint32_t rate);
+  // Kernel statistics on the time spent in the attached probes, by probe as
+  // written in the script, most expensive first
+  std::vector<RunStats> get_run_stats() const;
+  void print_run_stats();
 
   BpfOrc* bpforc_ = nullptr;
+  // Fully optimised code for probes whose code from the reduced pass
+  // pipeline the verifier rejects, built on first use
+  std::function<BpfOrc *()> full_bpforc_;
   int epollfd_ = -1;
   std::function<void(uint8_t*)> printf_callback_;
+  // Events lost since the adaptive sample rate was last adjusted
+  uint64_t lost_since_adjust_ = 0;
+  // Sample rate of the last printf() or print() record, to report changes
+  uint32_t seen_sample_rate_ = 1;
 
   std::string cmd_;
   bool finalize_ = false;
@@ -150,34 +219,53 @@ public:
   std::map<std::string, Struct> structs_;
   std::map<std::string, std::string> macros_;
   std::map<std::string, uint64_t> enums_;
-  std::vector<std::tuple<std::string, std::vector<Field>>> printf_args_;
-  std::vector<std::tuple<std::string, std::vector<Field>>> system_args_;
-  std::vector<std::string> join_args_;
-  std::vector<std::string> time_args_;
-  std::vector<std::string> strftime_args_;
-  std::vector<std::tuple<std::string, std::vector<Field>>> cat_args_;
-  std::vector<SizedType> non_map_print_args_;
   std::unordered_map<int64_t, struct HelperErrorInfo> helper_error_info_;
 
   std::vector<std::string> probe_ids_;
   unsigned int join_argnum_;
   unsigned int join_argsize_;
+  // Parts split off from a probe's program by codegen, keyed by the section
+  // of the probe's program, as (tail call map slot, section) pairs
+  std::map<std::string, std::vector<std::pair<int, std::string>>>
+      tail_call_sections_;
+  // Sections of the probes codegen splits, with the IR instructions to put
+  // in each part
+  std::map<std::string, uint64_t> split_sections_;
   std::unique_ptr<Output> out_;
   BPFfeature feature_;
+  // Phases of start up, printed once all probes are attached with --timings
+  Timings timings_;
+  // Programs loaded so far, if print_prog_stats_ is set
+  std::vector<ProgStats> prog_stats_;
 
   uint64_t strlen_ = 64;
   uint64_t mapmax_ = 4096;
   size_t cat_bytes_max_ = 10240;
   uint64_t max_probes_ = 512;
   uint64_t log_size_ = 1000000;
+  // Compile with just the LLVM passes needed for the verifier
+  bool fast_compile_ = false;
+  // Threads optimising and compiling the programs of different probes
+  uint64_t compile_threads_ = 1;
+  // BPF instructions past which a probe is split, 0 to never split
+  uint64_t split_insns_ = 0;
+  // Per-CPU buffer for what doesn't fit on the BPF stack, 0 to go without
+  uint64_t scratch_size_ = 0;
   uint64_t perf_rb_pages_ = 64;
   bool demangle_cpp_symbols_ = true;
   bool resolve_user_symbols_ = true;
   bool cache_user_symbols_ = true;
   bool safe_mode_ = true;
+  bool adaptive_sampling_ = false;
+  // Turned off for kernels which can't verify BPF-to-BPF calls
+  bool helper_subprograms_ = true;
   bool force_btf_ = false;
-  bool has_usdt_ = false;
   bool usdt_file_activation_ = false;
+  bool print_timings_ = false;
+  bool print_prog_stats_ = false;
+  bool print_run_stats_ = false;
+  // Seconds between printing run time statistics, 0 to only print at exit
+  uint64_t run_stats_interval_ = 0;
   int helper_check_level_ = 0;
   std::optional<struct timespec> boottime_;
 
@@ -218,28 +306,54 @@ private:
   std::map<std::string, std::pair<int, void *>> exe_sym_; // exe -> (pid, cache)
   int ncpus_;
   int online_cpus_;
+  uint64_t sample_rate_ = 1;
+  std::chrono::steady_clock::time_point sample_rate_changed_;
+  // Keeps the kernel's run time statistics enabled while open
+  int run_stats_fd_ = -1;
+  // Old bpf_stats_enabled sysctl value, if it was changed instead
+  std::string run_stats_sysctl_;
+  std::chrono::steady_clock::time_point run_stats_enabled_;
+  std::chrono::steady_clock::time_point run_stats_printed_;
   std::vector<std::string> params_;
   int next_probe_id_ = 0;
+  // Sections whose parts are in the tail call map already
+  std::set<std::string> tail_calls_loaded_;
 
   std::vector<std::unique_ptr<void, void(*)(void*)>> open_perf_buffers_;
+  // Reduced values seen by the last print(@map, delta), by map id
+  std::unordered_map<uint32_t,
+                     std::unordered_map<std::vector<uint8_t>, int64_t, MapKeyHash>>
+      map_delta_prev_;
 
   std::vector<std::unique_ptr<AttachedProbe>> attach_usdt_probe(
       Probe &probe,
       std::tuple<uint8_t *, uintptr_t> func,
       int pid,
-      bool file_activation);
+      bool file_activation,
+      const std::vector<TailCallProg> &tail_calls);
   std::vector<std::unique_ptr<AttachedProbe>> attach_probe(
       Probe &probe,
       const BpfOrc &bpforc);
   int setup_perf_events();
+  bool enable_run_stats();
+  void disable_run_stats();
   BPFTraceMap get_map(IMap &map);
   int print_map_hist(IMap &map, uint32_t top, uint32_t div);
   int print_map_stats(IMap &map, uint32_t top, uint32_t div);
+  int print_map_topk(IMap &map, uint32_t top, uint32_t div);
+  int print_map_bhist(IMap &map, uint32_t top, uint32_t div);
+  int zero_sketch(IMap &map);
+  static int64_t reduce_scalar(const SizedType &stype,
+                               const std::vector<uint8_t> &value,
+                               int nvalues);
   template <typename T>
   static T reduce_value(const std::vector<uint8_t> &value, int nvalues);
   static int64_t min_value(const std::vector<uint8_t> &value, int nvalues);
   static uint64_t max_value(const std::vector<uint8_t> &value, int nvalues);
+  static uint64_t distinct_value(const std::vector<uint8_t> &value,
+                                 int nvalues);
   static uint64_t read_address_from_output(std::string output);
+  std::vector<uint8_t> read_mmapped_value(IMap &map) const;
   std::vector<uint8_t> find_empty_key(IMap &map, size_t size) const;
 };
 
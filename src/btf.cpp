@@ -10,6 +10,7 @@
 #include <iostream>
 #include <linux/limits.h>
 #include <regex>
+#include <set>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
@@ -208,9 +209,55 @@ static std::string full_type_str(const struct btf *btf, const struct btf_type *t
   return str;
 }
 
-static std::string btf_type_str(const std::string& type)
+// Indexes all types by name on first use. Every lookup by name goes through
+// the index rather than scanning the ~100k types of vmlinux.
+void BTF::build_index() const
 {
-  return std::regex_replace(type, std::regex("^(struct )|(union )"), "");
+  if (indexed_)
+    return;
+  indexed_ = true;
+
+  __s32 id, max = (__s32)btf__get_nr_types(btf);
+  for (id = 1; id <= max; id++)
+  {
+    const struct btf_type *t = btf__type_by_id(btf, id);
+
+    if (btf_is_func(t))
+      func_ids_.push_back(id);
+
+    if (btf_is_enum(t))
+    {
+      const struct btf_enum *e = btf_enum(t);
+      for (__u16 i = 0; i < btf_vlen(t); i++, e++)
+        enum_value_ids_[btf_str(btf, e->name_off)].push_back(id);
+    }
+
+    if (t->name_off)
+      type_ids_[full_type_str(btf, t)].push_back(id);
+  }
+}
+
+const std::vector<__u32> &BTF::find_ids(const std::string &name) const
+{
+  static const std::vector<__u32> none;
+  build_index();
+  auto it = type_ids_.find(name);
+  return it != type_ids_.end() ? it->second : none;
+}
+
+const std::vector<__u32> &BTF::find_enums_with_value(
+    const std::string &name) const
+{
+  static const std::vector<__u32> none;
+  build_index();
+  auto it = enum_value_ids_.find(name);
+  return it != enum_value_ids_.end() ? it->second : none;
+}
+
+const std::vector<__u32> &BTF::find_funcs() const
+{
+  build_index();
+  return func_ids_;
 }
 
 std::string BTF::c_def(const std::unordered_set<std::string> &set) const
@@ -233,40 +280,22 @@ std::string BTF::c_def(const std::unordered_set<std::string> &set) const
       return std::string("");
   }
 
-  std::unordered_set<std::string> myset(set);
-  __s32 id, max = (__s32) btf__get_nr_types(btf);
-
-  for (id = 1; id <= max && myset.size(); id++)
+  // Dump in id order, as a scan of all types would
+  std::set<__u32> ids;
+  for (const auto &name : set)
   {
-    const struct btf_type *t = btf__type_by_id(btf, id);
-    // Allow users to reference enum values by name to pull in entire enum defs
-    if (btf_is_enum(t))
-    {
-      const struct btf_enum *p = btf_enum(t);
-      uint16_t vlen = btf_vlen(t);
-      for (int e = 0; e < vlen; ++e, ++p)
-      {
-        std::string str = btf_str(btf, p->name_off);
-        auto it = myset.find(str);
-        if (it != myset.end())
-        {
-          btf_dump__dump_type(dump, id);
-          myset.erase(it);
-          break;
-        }
-      }
-    }
-
-    std::string str = full_type_str(btf, t);
-
-    auto it = myset.find(str);
-    if (it != myset.end())
-    {
-      btf_dump__dump_type(dump, id);
-      myset.erase(it);
-    }
+    // Users can reference enum values by name to pull in entire enum defs
+    const auto &types = find_ids(name);
+    const auto &enums = find_enums_with_value(name);
+    if (!types.empty() && (enums.empty() || types.front() < enums.front()))
+      ids.insert(types.front());
+    else if (!enums.empty())
+      ids.insert(enums.front());
   }
 
+  for (__u32 id : ids)
+    btf_dump__dump_type(dump, id);
+
   btf_dump__free(dump);
   return ret;
 }
@@ -276,13 +305,18 @@ std::string BTF::type_of(const std::string& name, const std::string& field)
   if (!has_data())
     return std::string("");
 
-  __s32 type_id = btf__find_by_name(btf, btf_type_str(name).c_str());
+  const auto &ids = find_ids(name);
+  if (!ids.empty())
+    return type_of(btf__type_by_id(btf, ids.front()), field);
 
-  if (type_id < 0)
-    return std::string("");
-
-  const struct btf_type *type = btf__type_by_id(btf, type_id);
-  return type_of(type, field);
+  // Bare struct and union names
+  for (auto prefix : { "struct ", "union " })
+  {
+    const auto &tagged = find_ids(prefix + name);
+    if (!tagged.empty())
+      return type_of(btf__type_by_id(btf, tagged.front()), field);
+  }
+  return std::string("");
 }
 
 std::string BTF::type_of(const btf_type *type, const std::string &field)
@@ -410,20 +444,16 @@ int BTF::resolve_args(const std::string &func,
   if (!has_data())
     throw std::runtime_error("BTF data not available");
 
-  __s32 id, max = (__s32)btf__get_nr_types(btf);
   std::string name = func;
 
-  for (id = 1; id <= max; id++)
+  for (__u32 id : find_ids(name))
   {
     const struct btf_type *t = btf__type_by_id(btf, id);
 
     if (!btf_is_func(t))
       continue;
 
-    const char *str = btf_str(btf, t->name_off);
-
-    if (name != str)
-      continue;
+    const char *str;
 
     t = btf__type_by_id(btf, t->type);
     if (!btf_is_func_proto(t))
@@ -479,6 +509,177 @@ int BTF::resolve_args(const std::string &func,
   throw std::runtime_error("no BTF data for the function");
 }
 
+// Name under which clang knows a record: its tag, or for an anonymous one
+// the typedef naming it
+static std::string record_name(const struct btf *btf,
+                               const struct btf_type *t,
+                               const std::string &typedef_name)
+{
+  if (!t->name_off)
+    return typedef_name;
+  return (btf_is_struct(t) ? "struct " : "union ") +
+         std::string(btf_str(btf, t->name_off));
+}
+
+// Same SizedTypes as ClangParser builds for struct fields. Named records the
+// type holds by value, directly or in an array, are added to records as
+// (id, name) pairs.
+SizedType BTF::get_field_stype(__u32 id, BTF::RecordList &records) const
+{
+  const struct btf_type *t = btf__type_by_id(btf, id);
+  std::string typedef_name;
+  while (id && t && (btf_is_typedef(t) || btf_is_mod(t)))
+  {
+    if (btf_is_typedef(t) && typedef_name.empty())
+      typedef_name = btf_str(btf, t->name_off);
+    id = t->type;
+    t = btf__type_by_id(btf, id);
+  }
+  if (!id || !t)
+    return CreateNone();
+
+  if (btf_is_int(t))
+  {
+    bool is_signed = btf_int_encoding(t) & BTF_INT_SIGNED;
+    return is_signed ? CreateInt(t->size * 8) : CreateUInt(t->size * 8);
+  }
+  if (btf_is_enum(t))
+    return CreateUInt(t->size * 8);
+  if (btf_is_composite(t))
+  {
+    std::string name = record_name(btf, t, typedef_name);
+    if (!name.empty())
+      records.emplace_back(id, name);
+    return CreateRecord(t->size, name);
+  }
+  if (btf_is_ptr(t))
+  {
+    // Records behind a pointer are only resolved once the program
+    // dereferences them, which puts them in BPFtrace::btf_set_
+    RecordList pointees;
+    return CreatePointer(get_field_stype(t->type, pointees));
+  }
+  if (btf_is_array(t))
+  {
+    const struct btf_array *array = btf_array(t);
+    const struct btf_type *elem = btf__type_by_id(
+        btf, btf__resolve_type(btf, array->type));
+    if (!elem)
+      return CreateNone();
+
+    if (btf_is_int(elem) && !strcmp(btf_str(btf, elem->name_off), "char"))
+      return CreateString(array->nelems);
+    // Only support one-dimensional arrays for now
+    if (btf_is_array(elem))
+      return CreateNone();
+    return CreateArray(array->nelems, get_field_stype(array->type, records));
+  }
+  return CreateNone();
+}
+
+// Adds the fields of record id to record, those of anonymous members
+// included, base_offset bytes in
+void BTF::resolve_fields(__u32 id,
+                         int base_offset,
+                         Struct &record,
+                         BTF::RecordList &records,
+                         std::map<std::string, uint64_t> &enums) const
+{
+  const struct btf_type *t = btf__type_by_id(btf, id);
+  const struct btf_member *m = btf_members(t);
+
+  for (__u16 i = 0; i < btf_vlen(t); i++, m++)
+  {
+    __u32 bit_offset = btf_member_bit_offset(t, i);
+    __u32 bit_size = btf_member_bitfield_size(t, i);
+    __s32 member_id = btf__resolve_type(btf, m->type);
+    const struct btf_type *member = member_id > 0
+                                        ? btf__type_by_id(btf, member_id)
+                                        : nullptr;
+
+    if (!m->name_off)
+    {
+      if (member && btf_is_composite(member))
+        resolve_fields(
+            member_id, base_offset + bit_offset / 8, record, records, enums);
+      continue;
+    }
+
+    // Without the kind flag, a bitfield's width and offset are in its int
+    if (!btf_kflag(t) && member && btf_is_int(member) &&
+        btf_int_bits(member) != member->size * 8)
+    {
+      bit_size = btf_int_bits(member);
+      bit_offset += btf_int_offset(member);
+    }
+
+    Field &field = record.fields[btf_str(btf, m->name_off)];
+    field.type = get_field_stype(m->type, records);
+    field.offset = base_offset + bit_offset / 8;
+    field.is_bitfield = bit_size != 0;
+    if (field.is_bitfield)
+    {
+      // Same as getBitfield() in clang_parser.cpp
+      field.bitfield.mask = (1 << bit_size) - 1;
+      field.bitfield.access_rshift = bit_offset % 8;
+      field.bitfield.read_bytes = (bit_offset % 8 + bit_size + 7) / 8;
+    }
+
+    if (member && btf_is_enum(member))
+      resolve_enum(member_id, enums);
+  }
+}
+
+void BTF::resolve_enum(__u32 id, std::map<std::string, uint64_t> &enums) const
+{
+  const struct btf_type *t = btf__type_by_id(btf, id);
+  const struct btf_enum *e = btf_enum(t);
+  for (__u16 i = 0; i < btf_vlen(t); i++, e++)
+    enums[btf_str(btf, e->name_off)] = e->val;
+}
+
+// Fills in the layouts of the named types, and of the records they embed by
+// value, straight from BTF. This gives the same result as parsing what c_def()
+// dumps, without going through clang. Enums are pulled in by their name or
+// the name of one of their values.
+void BTF::resolve_types(const std::unordered_set<std::string> &names,
+                        std::map<std::string, Struct> &structs,
+                        std::map<std::string, uint64_t> &enums) const
+{
+  if (!has_data() || names.empty())
+    return;
+
+  RecordList records;
+  for (const auto &name : names)
+  {
+    for (__u32 id : find_ids(name))
+    {
+      const struct btf_type *t = btf__type_by_id(btf, id);
+      if (btf_is_enum(t))
+        resolve_enum(id, enums);
+      // A typedef stands for the record it names, if any
+      else if (btf_is_composite(t) || btf_is_typedef(t))
+        get_field_stype(id, records);
+    }
+    for (__u32 id : find_enums_with_value(name))
+      resolve_enum(id, enums);
+  }
+
+  std::unordered_set<__u32> resolved;
+  while (!records.empty())
+  {
+    auto record = records.back();
+    records.pop_back();
+    if (!resolved.insert(record.first).second ||
+        structs.count(record.second))
+      continue;
+
+    Struct &cstruct = structs[record.second];
+    cstruct.size = btf__type_by_id(btf, record.first)->size;
+    resolve_fields(record.first, 0, cstruct, records, enums);
+  }
+}
+
 static bool match_re(const std::string &probe, const std::regex &re)
 {
   try
@@ -498,7 +699,6 @@ std::unique_ptr<std::istream> BTF::get_funcs(std::regex *re,
                                              bool params,
                                              std::string prefix) const
 {
-  __s32 id, max = (__s32)btf__get_nr_types(btf);
   std::string type = std::string("");
   struct btf_dump_opts opts = {
     .ctx = &type,
@@ -517,13 +717,11 @@ std::unique_ptr<std::istream> BTF::get_funcs(std::regex *re,
     return nullptr;
   }
 
-  for (id = 1; id <= max; id++)
+  const auto &func_ids = find_funcs();
+  size_t i;
+  for (i = 0; i < func_ids.size(); i++)
   {
-    const struct btf_type *t = btf__type_by_id(btf, id);
-
-    if (!btf_is_func(t))
-      continue;
-
+    const struct btf_type *t = btf__type_by_id(btf, func_ids[i]);
     const char *str = btf__name_by_offset(btf, t->name_off);
     std::string func_name = str;
 
@@ -593,8 +791,9 @@ std::unique_ptr<std::istream> BTF::get_funcs(std::regex *re,
 #endif
   }
 
-  if (id != (max + 1))
-    LOG(ERROR) << "BTF data inconsistency " << id << "," << max;
+  if (i != func_ids.size())
+    LOG(ERROR) << "BTF data inconsistency " << func_ids[i] << ","
+               << btf__get_nr_types(btf);
 
   btf_dump__free(dump);
 
@@ -623,34 +822,13 @@ void BTF::display_structs(std::regex *re) const
     return;
 
   std::unordered_set<std::string> struct_set;
-  __s32 id, max = (__s32)btf__get_nr_types(btf);
-  std::string type = std::string("");
-  struct btf_dump_opts opts = {
-    .ctx = &type,
-  };
-  struct btf_dump *dump;
-  char err_buf[256];
-  int err;
-
-  dump = btf_dump__new(btf, nullptr, &opts, dump_printf);
-  err = libbpf_get_error(dump);
-  if (err)
+  build_index();
+  for (const auto &entry : type_ids_)
   {
-    libbpf_strerror(err, err_buf, sizeof(err_buf));
-    LOG(ERROR) << "BTF: failed to initialize dump (" << err_buf << ")";
-    return;
-  }
-
-  for (id = 1; id <= max; id++)
-  {
-    const struct btf_type *t = btf__type_by_id(btf, id);
-
-    if (!(btf_is_struct(t) || btf_is_union(t) || btf_is_enum(t)))
-      continue;
-
-    const std::string name = full_type_str(btf, t);
-
-    if (name.find("(anon)") != std::string::npos)
+    // Only records and enums are named with their kind
+    const std::string &name = entry.first;
+    if (name.compare(0, 7, "struct ") && name.compare(0, 6, "union ") &&
+        name.compare(0, 5, "enum "))
       continue;
 
     if (re && !match_re(name, *re))
@@ -659,11 +837,6 @@ void BTF::display_structs(std::regex *re) const
     struct_set.insert(name);
   }
 
-  if (id != (max + 1))
-    LOG(ERROR) << " BTF data inconsistency " << id << "," << max;
-
-  btf_dump__free(dump);
-
   if (struct_set.empty())
     return;
 
@@ -730,6 +903,15 @@ int BTF::resolve_args(const std::string &func __attribute__((__unused__)),
   return -1;
 }
 
+void BTF::resolve_types(const std::unordered_set<std::string>& names
+                        __attribute__((__unused__)),
+                        std::map<std::string, Struct>& structs
+                        __attribute__((__unused__)),
+                        std::map<std::string, uint64_t>& enums
+                        __attribute__((__unused__))) const
+{
+}
+
 void BTF::display_kfunc(std::regex* re __attribute__((__unused__)),
                         const bool retporbe __attribute__((__unused__))) const
 {
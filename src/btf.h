@@ -1,12 +1,15 @@
 #pragma once
 
+#include "struct.h"
 #include "types.h"
 #include <linux/types.h>
 #include <map>
 #include <regex>
 #include <string>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 struct btf;
 struct btf_type;
@@ -37,18 +40,42 @@ public:
   int resolve_args(const std::string &func,
                    std::map<std::string, SizedType>& args,
                    bool ret);
+  void resolve_types(const std::unordered_set<std::string>& names,
+                     std::map<std::string, Struct>& structs,
+                     std::map<std::string, uint64_t>& enums) const;
 
 private:
   SizedType get_stype(__u32 id);
+  // (type id, name) of records
+  using RecordList = std::vector<std::pair<__u32, std::string>>;
+
+  SizedType get_field_stype(__u32 id, RecordList& records) const;
+  void resolve_fields(__u32 id,
+                      int base_offset,
+                      Struct& record,
+                      RecordList& records,
+                      std::map<std::string, uint64_t>& enums) const;
+  void resolve_enum(__u32 id, std::map<std::string, uint64_t>& enums) const;
   const struct btf_type* btf_type_skip_modifiers(const struct btf_type* t);
   std::unique_ptr<std::istream> get_funcs(std::regex* re,
                                           bool params,
                                           std::string prefix) const;
   bool is_traceable_func(const std::string& func_name) const;
+  void build_index() const;
+  // Ids of the types named name, as by full_type_str(), in ascending order
+  const std::vector<__u32>& find_ids(const std::string& name) const;
+  // Ids of the enums with a value named name, in ascending order
+  const std::vector<__u32>& find_enums_with_value(const std::string& name) const;
+  const std::vector<__u32>& find_funcs() const;
 
   struct btf* btf;
   enum state state = NODATA;
   std::unordered_set<std::string> traceable_funcs_;
+
+  mutable bool indexed_ = false;
+  mutable std::unordered_map<std::string, std::vector<__u32>> type_ids_;
+  mutable std::unordered_map<std::string, std::vector<__u32>> enum_value_ids_;
+  mutable std::vector<__u32> func_ids_;
 };
 
 inline bool BTF::has_data(void) const
@@ -1,6 +1,12 @@
 #include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <regex>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 #include "llvm/Config/llvm-config.h"
@@ -71,6 +77,70 @@ std::vector<CXUnsavedFile> getTranslationUnitFiles(
 
   return files;
 }
+
+// Opens a file of the headers cache, if it exists and can be trusted
+int open_cache_file(int dir_fd, const std::string &name)
+{
+  int fd = openat(dir_fd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd >= 0 && !is_trusted_file(fd))
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Writes a file into the headers cache. O_EXCL and O_NOFOLLOW keep it from
+// writing through a file or link that's already there, and its mode doesn't
+// depend on the umask.
+bool write_cache_file(int dir_fd,
+                      const std::string &name,
+                      const std::string &contents)
+{
+  mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+  int fd = openat(dir_fd,
+                  name.c_str(),
+                  O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                  mode);
+  if (fd < 0)
+    return false;
+  bool written = fchmod(fd, mode) == 0 &&
+                 write(fd, contents.c_str(), contents.size()) ==
+                     static_cast<ssize_t>(contents.size());
+  close(fd);
+  if (!written)
+    unlinkat(dir_fd, name.c_str(), 0);
+  return written;
+}
+
+// Whether none of the files a precompiled header was built from, as listed in
+// its dependency file, has changed since
+bool deps_unchanged(int dir_fd, const std::string &deps_name)
+{
+  int fd = open_cache_file(dir_fd, deps_name);
+  if (fd < 0)
+    return false;
+  std::string contents;
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    contents.append(buf, len);
+  close(fd);
+
+  std::istringstream deps(contents);
+
+  std::string path;
+  off_t size;
+  time_t mtime;
+  while (deps >> std::quoted(path) >> size >> mtime)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_size != size ||
+        st.st_mtime != mtime)
+      return false;
+  }
+  return deps.eof();
+}
 } // namespace
 
 static std::string get_clang_string(CXString string)
@@ -80,6 +150,33 @@ static std::string get_clang_string(CXString string)
   return str;
 }
 
+static bool has_errors(CXTranslationUnit tu)
+{
+  for (unsigned int i = 0; i < clang_getNumDiagnostics(tu); i++)
+  {
+    CXDiagnostic diag = clang_getDiagnostic(tu, i);
+    CXDiagnosticSeverity severity = clang_getDiagnosticSeverity(diag);
+    clang_disposeDiagnostic(diag);
+    if (severity >= CXDiagnostic_Error)
+      return true;
+  }
+  return false;
+}
+
+// Prints the diagnostics of a parse which ran with stderr silenced, as
+// libclang would have
+static void print_diagnostics(CXTranslationUnit tu)
+{
+  for (unsigned int i = 0; i < clang_getNumDiagnostics(tu); i++)
+  {
+    CXDiagnostic diag = clang_getDiagnostic(tu, i);
+    std::cerr << get_clang_string(clang_formatDiagnostic(
+                     diag, clang_defaultDiagnosticDisplayOptions()))
+              << std::endl;
+    clang_disposeDiagnostic(diag);
+  }
+}
+
 /*
  * is_anonymous
  *
@@ -332,7 +429,8 @@ static SizedType get_sized_type(CXType clang_type)
 
 ClangParser::ClangParserHandler::ClangParserHandler()
 {
-  index = clang_createIndex(1, 1);
+  // Declarations from a precompiled header are visited like all others
+  index = clang_createIndex(0, 1);
 }
 
 ClangParser::ClangParserHandler::~ClangParserHandler()
@@ -353,6 +451,8 @@ CXErrorCode ClangParser::ClangParserHandler::parse_translation_unit(
     unsigned num_unsaved_files,
     unsigned options)
 {
+  clang_disposeTranslationUnit(translation_unit);
+  translation_unit = nullptr;
   return clang_parseTranslationUnit2(
       index,
       source_filename,
@@ -572,8 +672,166 @@ std::unordered_set<std::string> ClangParser::get_incomplete_types(
   return type_data.incomplete_types;
 }
 
+std::string ClangParser::get_pch(const std::vector<const char *> &args)
+{
+  std::string cache_dir = get_cache_dir();
+  if (cache_dir.empty())
+    return "";
+
+  std::string key = LLVM_VERSION_STRING;
+  for (auto arg : args)
+    key += std::string("\n") + arg;
+  for (auto &file : getDefaultHeaders())
+    key.append(file.Contents, file.Length);
+  std::ostringstream name;
+  name << std::hex << std::hash<std::string>()(key);
+
+  // bpftrace run with sudo may use the cache directory of the invoking user.
+  // Clang is handed the header by path, so the directory is only used if
+  // nobody else can change what's in it, and only through the fd it was
+  // checked on, so that it can't be swapped for another one either.
+  std::string headers_dir = cache_dir + "/headers";
+  std::error_code ec;
+  std::filesystem::create_directories(cache_dir, ec);
+  mkdir(headers_dir.c_str(), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+  if (headers_fd_ >= 0)
+    close(headers_fd_);
+  headers_fd_ = open(headers_dir.c_str(),
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (headers_fd_ < 0)
+    return "";
+  if (!is_trusted_dir(headers_fd_))
+  {
+    LOG(WARNING) << "Not using precompiled headers in " << headers_dir
+                 << " as it isn't owned by the current user or others can "
+                    "write to it";
+    close(headers_fd_);
+    headers_fd_ = -1;
+    return "";
+  }
+
+  std::string dir = "/proc/self/fd/" + std::to_string(headers_fd_) + "/";
+  std::string pch_name = name.str() + ".pch";
+  std::string deps_name = pch_name + ".deps";
+  int pch_fd = open_cache_file(headers_fd_, pch_name);
+  if (pch_fd >= 0)
+  {
+    close(pch_fd);
+    pch_fd = -1;
+    if (deps_unchanged(headers_fd_, deps_name))
+      return dir + pch_name;
+  }
+
+  auto input_files = getTranslationUnitFiles(CXUnsavedFile{
+      .Filename = "prefix.h",
+      .Contents = "",
+      .Length = 0,
+  });
+  // The BTF header is only filled in when BTF is processed, in which case no
+  // precompiled header is used
+  input_files.emplace_back(CXUnsavedFile{
+      .Filename = "/bpftrace/include/__btf_generated_header.h",
+      .Contents = "",
+      .Length = 0,
+  });
+
+  ClangParserHandler handler;
+  CXErrorCode error;
+  std::vector<std::string> error_msgs;
+  {
+    // Errors are reported by the parse without the precompiled header
+    StderrSilencer silencer;
+    silencer.silence();
+
+    error = handler.parse_translation_unit(
+        "prefix.h",
+        args.data(),
+        args.size(),
+        input_files.data(),
+        input_files.size(),
+        CXTranslationUnit_DetailedPreprocessingRecord |
+            CXTranslationUnit_Incomplete |
+            CXTranslationUnit_ForSerialization);
+    if (error || !handler.check_diagnostics("", error_msgs, true))
+      return "";
+  }
+
+  std::vector<std::string> deps;
+  clang_getInclusions(
+      handler.get_translation_unit(),
+      [](CXFile file, CXSourceLocation *, unsigned, CXClientData client_data) {
+        auto &deps = *static_cast<std::vector<std::string> *>(client_data);
+        deps.push_back(get_clang_string(clang_getFileName(file)));
+      },
+      &deps);
+
+  // Written to temporary files first, so that bpftrace instances starting
+  // concurrently never read partial ones
+  std::string suffix = "." + std::to_string(getpid());
+  std::ostringstream deps_out;
+  for (auto &dep : deps)
+  {
+    // Embedded headers are part of the key
+    struct stat st;
+    if (dep.rfind("/bpftrace/include/", 0) == 0 || dep == "prefix.h" ||
+        stat(dep.c_str(), &st) != 0)
+      continue;
+    deps_out << std::quoted(dep) << " " << st.st_size << " " << st.st_mtime
+             << std::endl;
+  }
+  if (!write_cache_file(headers_fd_, deps_name + suffix, deps_out.str()))
+    return "";
+
+  // Clang writes the header through a file of its own in the same directory,
+  // whose mode is then set through an fd, whatever the umask
+  auto tu = handler.get_translation_unit();
+  std::string pch_tmp = pch_name + suffix;
+  bool saved = clang_saveTranslationUnit(tu,
+                                         (dir + pch_tmp).c_str(),
+                                         clang_defaultSaveOptions(tu)) ==
+                   CXSaveError_None &&
+               (pch_fd = openat(headers_fd_,
+                                pch_tmp.c_str(),
+                                O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) >= 0 &&
+               fchmod(pch_fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 &&
+               renameat(headers_fd_,
+                        pch_tmp.c_str(),
+                        headers_fd_,
+                        pch_name.c_str()) == 0 &&
+               renameat(headers_fd_,
+                        (deps_name + suffix).c_str(),
+                        headers_fd_,
+                        deps_name.c_str()) == 0;
+  if (pch_fd >= 0)
+    close(pch_fd);
+  if (!saved)
+  {
+    unlinkat(headers_fd_, pch_tmp.c_str(), 0);
+    unlinkat(headers_fd_, (deps_name + suffix).c_str(), 0);
+    return "";
+  }
+
+  return dir + pch_name;
+}
+
+ClangParser::~ClangParser()
+{
+  if (headers_fd_ >= 0)
+    close(headers_fd_);
+}
+
 bool ClangParser::parse(ast::Program *program, BPFtrace &bpftrace, std::vector<std::string> extra_flags)
 {
+  // Without C definitions every type comes from BTF, which doesn't need
+  // clang to be resolved
+  if (program->c_definitions.empty())
+  {
+    bpftrace.btf_.resolve_types(bpftrace.btf_set_,
+                                bpftrace.structs_,
+                                bpftrace.enums_);
+    return true;
+  }
+
   auto input = "#include <__btf_generated_header.h>\n" + program->c_definitions;
 
   auto input_files = getTranslationUnitFiles(CXUnsavedFile{
@@ -593,8 +851,7 @@ bool ClangParser::parse(ast::Program *program, BPFtrace &bpftrace, std::vector<s
     args.push_back(flag.c_str());
   }
 
-  bool process_btf = program->c_definitions.empty() ||
-                     (bpftrace.force_btf_ && bpftrace.btf_.has_data());
+  bool process_btf = bpftrace.force_btf_ && bpftrace.btf_.has_data();
 
   // We set these args early because some systems may not have <linux/types.h>
   // (containers) and fully rely on BTF.
@@ -639,14 +896,58 @@ bool ClangParser::parse(ast::Program *program, BPFtrace &bpftrace, std::vector<s
     check_additional_types = types_cnt != bpftrace.btf_set_.size();
   }
 
-  CXErrorCode error;
-  error = handler.parse_translation_unit(
-      "definitions.h",
-      args.data(),
-      args.size(),
-      input_files.data(),
-      input_files.size(),
-      CXTranslationUnit_DetailedPreprocessingRecord);
+  CXErrorCode error = CXError_Failure;
+  std::string pch = process_btf ? "" : get_pch(args);
+  if (!pch.empty())
+  {
+    // What's included from the command line is in the precompiled header
+    std::vector<const char *> pch_args;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+      if (std::string(args[i]) == "-include" && i + 1 < args.size())
+        i++;
+      else
+        pch_args.push_back(args[i]);
+    }
+    pch_args.push_back("-include-pch");
+    pch_args.push_back(pch.c_str());
+
+    {
+      StderrSilencer silencer;
+      silencer.silence();
+      error = handler.parse_translation_unit(
+          "definitions.h",
+          pch_args.data(),
+          pch_args.size(),
+          input_files.data(),
+          input_files.size(),
+          CXTranslationUnit_DetailedPreprocessingRecord);
+    }
+    // Errors, including those of a header built by a different version of
+    // libclang, are left to the parse without it to report
+    if (!error && has_errors(handler.get_translation_unit()))
+      error = CXError_Failure;
+    else if (!error)
+      print_diagnostics(handler.get_translation_unit());
+  }
+
+  if (pch.empty() || error)
+  {
+    error = handler.parse_translation_unit(
+        "definitions.h",
+        args.data(),
+        args.size(),
+        input_files.data(),
+        input_files.size(),
+        CXTranslationUnit_DetailedPreprocessingRecord);
+
+    // Only the precompiled header was at fault, so it's rebuilt next time
+    if (!pch.empty() && !error && !has_errors(handler.get_translation_unit()))
+    {
+      unlink(pch.c_str());
+      unlink((pch + ".deps").c_str());
+    }
+  }
 
   if (error)
   {
@@ -16,6 +16,8 @@ class Program;
 class ClangParser
 {
 public:
+  ~ClangParser();
+
   bool parse(ast::Program *program,
              BPFtrace &bpftrace,
              std::vector<std::string> extra_flags = {});
@@ -44,6 +46,24 @@ private:
   static std::optional<std::string> get_unknown_type(
       const std::string &diagnostic_msg);
 
+  /*
+   * Everything the C definitions are parsed with but don't include themselves
+   * (the clang workarounds, which pull in <linux/types.h>, and the files
+   * given with --include) is the same from one run to the next. This method
+   * parses it into a precompiled header in the cache directory and returns
+   * the header's path.
+   *
+   * The header is reused for as long as the arguments, the embedded headers
+   * and the files it was built from stay the same. An empty string is
+   * returned if caching is disabled, the cache directory can't be trusted or
+   * the header couldn't be built.
+   */
+  std::string get_pch(const std::vector<const char *> &args);
+
+  // Directory of the precompiled headers, which get_pch() returns paths into
+  // by way of /proc/self/fd
+  int headers_fd_ = -1;
+
   class ClangParserHandler
   {
   public:
@@ -73,7 +93,7 @@ private:
 
   private:
     CXIndex index;
-    CXTranslationUnit translation_unit;
+    CXTranslationUnit translation_unit = nullptr;
   };
 };
 
@@ -17,9 +17,22 @@ FakeMap::FakeMap(const std::string &name,
 }
 
 FakeMap::FakeMap(const std::string &name,
-                 const SizedType &type __attribute__((unused)),
+                 const SizedType &type,
                  const MapKey &key __attribute__((unused)),
                  int max_entries __attribute__((unused)))
+{
+  name_ = name;
+  mapfd_ = next_mapfd_++;
+  if (type.IsTopkTy())
+    sketch_fd_ = next_mapfd_++;
+}
+
+FakeMap::FakeMap(const std::string &name,
+                 enum bpf_map_type map_type __attribute__((unused)),
+                 int key_size __attribute__((unused)),
+                 int value_size __attribute__((unused)),
+                 int max_entries __attribute__((unused)),
+                 int flags __attribute__((unused)))
 {
   name_ = name;
   mapfd_ = next_mapfd_++;
@@ -11,6 +11,12 @@ public:
           const SizedType &type,
           const MapKey &key,
           int max_entries = 0);
+  FakeMap(const std::string &name,
+          enum bpf_map_type map_type,
+          int key_size,
+          int value_size,
+          int max_entries,
+          int flags);
   FakeMap(const SizedType &type);
   FakeMap(enum bpf_map_type map_type);
   FakeMap(const std::string &name,
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #include "mapkey.h"
 #include "types.h"
@@ -9,6 +11,10 @@
 
 namespace bpftrace {
 
+// Memory mapped maps keep one value per CPU, spaced this many array entries
+// apart so that no two CPUs write to the same cache line.
+const int MMAP_CPU_STRIDE = 8;
+
 class IMap
 {
 public:
@@ -25,7 +31,15 @@ public:
   bool is_per_cpu_type()
   {
     return map_type_ == BPF_MAP_TYPE_PERCPU_HASH ||
-           map_type_ == BPF_MAP_TYPE_PERCPU_ARRAY;
+           map_type_ == BPF_MAP_TYPE_PERCPU_ARRAY || is_mmapped();
+  }
+
+  // Userspace mapping of the map values, only set for BPF_F_MMAPABLE arrays
+  uint8_t *mmap_ = nullptr;
+  size_t mmap_size_ = 0;
+  bool is_mmapped() const
+  {
+    return mmap_ != nullptr;
   }
 
   // unique id of this map. Used by (bpf) runtime to reference
@@ -35,6 +49,14 @@ public:
   int lqmin;
   int lqmax;
   int lqstep;
+  // used by qhist(): sub-buckets per power of two, as a power of two
+  int qprecision = 0;
+  // used by bhist(): the lower boundaries of all but the first bucket
+  std::vector<int64_t> bhist_bounds;
+  // used by topk(): keys to print, and the count-min sketch holding the
+  // counts of the keys in this map
+  int topk_k = 0;
+  int sketch_fd_ = -1;
 };
 
 } // namespace bpftrace
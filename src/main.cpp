@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <csignal>
 #include <cstdio>
@@ -6,8 +7,10 @@
 #include <getopt.h>
 #include <iostream>
 #include <optional>
+#include <sstream>
 #include <sys/resource.h>
 #include <sys/utsname.h>
+#include <thread>
 #include <time.h>
 #include <unistd.h>
 
@@ -22,6 +25,7 @@
 #include "list.h"
 #include "lockdown.h"
 #include "log.h"
+#include "optimiser.h"
 #include "output.h"
 #include "printer.h"
 #include "procmon.h"
@@ -70,19 +74,29 @@ void usage()
   std::cerr << "    -kk            check all bpf helper functions" << std::endl;
   std::cerr << "    -V, --version  bpftrace version" << std::endl;
   std::cerr << "    --no-warnings  disable all warning messages" << std::endl;
+  std::cerr << "    --timings      print where start up time went once probes are attached" << std::endl;
+  std::cerr << "    --prog-stats   print the size and verifier statistics of each loaded program" << std::endl;
+  std::cerr << "    --run-stats[=SECS]" << std::endl;
+  std::cerr << "                   print the time spent running each probe at exit, and every SECS seconds" << std::endl;
+  std::cerr << "    --fast-compile only run the LLVM optimisations the verifier needs" << std::endl;
   std::cerr << std::endl;
   std::cerr << "ENVIRONMENT:" << std::endl;
-  std::cerr << "    BPFTRACE_STRLEN             [default: 64] bytes on BPF stack per str()" << std::endl;
+  std::cerr << "    BPFTRACE_STRLEN             [default: 64] bytes per str(), at most 512" << std::endl;
+  std::cerr << "    BPFTRACE_SCRATCH_SIZE       [default: 16384] per-CPU bytes for what doesn't fit on the BPF stack" << std::endl;
   std::cerr << "    BPFTRACE_NO_CPP_DEMANGLE    [default: 0] disable C++ symbol demangling" << std::endl;
   std::cerr << "    BPFTRACE_MAP_KEYS_MAX       [default: 4096] max keys in a map" << std::endl;
   std::cerr << "    BPFTRACE_CAT_BYTES_MAX      [default: 10k] maximum bytes read by cat builtin" << std::endl;
   std::cerr << "    BPFTRACE_MAX_PROBES         [default: 512] max number of probes" << std::endl;
   std::cerr << "    BPFTRACE_LOG_SIZE           [default: 1000000] log size in bytes" << std::endl;
   std::cerr << "    BPFTRACE_PERF_RB_PAGES      [default: 64] pages per CPU to allocate for ring buffer" << std::endl;
+  std::cerr << "    BPFTRACE_ADAPTIVE_SAMPLING  [default: 0] sample printf() and print() events instead of losing them" << std::endl;
+  std::cerr << "    BPFTRACE_SPLIT_INSNS        [default: kernel limit] split probes of more BPF instructions into tail called programs" << std::endl;
+  std::cerr << "    BPFTRACE_COMPILE_THREADS    [default: up to 8] threads to compile probes with" << std::endl;
   std::cerr << "    BPFTRACE_NO_USER_SYMBOLS    [default: 0] disable user symbol resolution" << std::endl;
   std::cerr << "    BPFTRACE_CACHE_USER_SYMBOLS [default: auto] enable user symbol cache" << std::endl;
   std::cerr << "    BPFTRACE_VMLINUX            [default: none] vmlinux path used for kernel symbol resolution" << std::endl;
   std::cerr << "    BPFTRACE_BTF                [default: none] BTF file" << std::endl;
+  std::cerr << "    BPFTRACE_CACHE_DIR          [default: ~/.cache/bpftrace] directory for cached feature checks and headers, empty to disable" << std::endl;
   std::cerr << std::endl;
   std::cerr << "EXAMPLES:" << std::endl;
   std::cerr << "bpftrace -l '*sleep*'" << std::endl;
@@ -261,6 +275,11 @@ int main(int argc, char *argv[])
   bool safe_mode = true;
   bool force_btf = false;
   bool usdt_file_activation = false;
+  bool print_timings = false;
+  bool print_prog_stats = false;
+  bool print_run_stats = false;
+  uint64_t run_stats_interval = 0;
+  bool fast_compile = false;
   int helper_check_level = 0;
   std::string script, search, file_name, output_file, output_format, output_elf;
   OutputBufferConfig obc = OutputBufferConfig::UNSET;
@@ -277,6 +296,10 @@ int main(int argc, char *argv[])
     option{ "info", no_argument, nullptr, 2000 },
     option{ "emit-elf", required_argument, nullptr, 2001 },
     option{ "no-warnings", no_argument, nullptr, 2002 },
+    option{ "timings", no_argument, nullptr, 2003 },
+    option{ "prog-stats", no_argument, nullptr, 2004 },
+    option{ "run-stats", optional_argument, nullptr, 2005 },
+    option{ "fast-compile", no_argument, nullptr, 2006 },
     option{ nullptr, 0, nullptr, 0 }, // Must be last
   };
   std::vector<std::string> include_dirs;
@@ -297,6 +320,30 @@ int main(int argc, char *argv[])
       case 2002: // --no-warnings
         DISABLE_LOG(WARNING);
         break;
+      case 2003: // --timings
+        print_timings = true;
+        break;
+      case 2004: // --prog-stats
+        print_prog_stats = true;
+        break;
+      case 2005: // --run-stats
+        print_run_stats = true;
+        if (optarg)
+        {
+          try
+          {
+            run_stats_interval = std::stoull(optarg);
+          }
+          catch (const std::exception &)
+          {
+            LOG(ERROR) << "--run-stats: invalid interval '" << optarg << "'";
+            return 1;
+          }
+        }
+        break;
+      case 2006: // --fast-compile
+        fast_compile = true;
+        break;
       case 'o':
         output_file = optarg;
         break;
@@ -433,6 +480,11 @@ int main(int argc, char *argv[])
   Driver driver(bpftrace);
 
   bpftrace.usdt_file_activation_ = usdt_file_activation;
+  bpftrace.print_timings_ = print_timings;
+  bpftrace.print_prog_stats_ = print_prog_stats;
+  bpftrace.print_run_stats_ = print_run_stats;
+  bpftrace.run_stats_interval_ = run_stats_interval;
+  bpftrace.fast_compile_ = fast_compile;
   bpftrace.safe_mode_ = safe_mode;
   bpftrace.force_btf_ = force_btf;
   bpftrace.helper_check_level_ = helper_check_level;
@@ -521,6 +573,7 @@ int main(int argc, char *argv[])
     optind++;
   }
 
+  bpftrace.timings_.start("parse");
   err = driver.parse();
   if (err)
     return err;
@@ -528,6 +581,11 @@ int main(int argc, char *argv[])
   if (!is_root())
     return 1;
 
+  bpftrace.timings_.start("features");
+  std::string cache_dir = get_cache_dir();
+  if (!cache_dir.empty())
+    bpftrace.feature_.use_cache(cache_dir + "/features");
+
   auto lockdown_state = lockdown::detect(bpftrace.feature_);
   if (lockdown_state == lockdown::LockdownState::Confidentiality)
   {
@@ -535,6 +593,7 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  bpftrace.timings_.start("fields");
   ast::FieldAnalyser fields(driver.root_.get(), bpftrace);
   err = fields.analyse();
   if (err)
@@ -548,22 +607,36 @@ int main(int argc, char *argv[])
   bpftrace.join_argnum_ = 16;
   bpftrace.join_argsize_ = 1024;
 
+  bpftrace.scratch_size_ = 16384;
+  if (!get_uint64_env_var("BPFTRACE_SCRATCH_SIZE", bpftrace.scratch_size_))
+    return 1;
+  if (bpftrace.scratch_size_ > MAX_SCRATCH_SIZE)
+  {
+    LOG(ERROR) << "'BPFTRACE_SCRATCH_SIZE' " << bpftrace.scratch_size_
+               << " exceeds the maximum of " << MAX_SCRATCH_SIZE << " bytes.";
+    return 1;
+  }
+
   if (!get_uint64_env_var("BPFTRACE_STRLEN", bpftrace.strlen_))
     return 1;
 
-  // in practice, the largest buffer I've seen fit into the BPF stack was 240 bytes.
-  // I've set the bar lower, in case your program has a deeper stack than the one from my tests,
-  // in the hope that you'll get this instructive error instead of getting the BPF verifier's error.
-  if (bpftrace.strlen_ > 200) {
+  // Without a scratch buffer strings live on the 512 byte BPF stack, and in
+  // practice the largest one that fits is about 240 bytes. With it they only
+  // need to stay small enough for LLVM to inline their memset()/memcpy(), as
+  // BPF can't call those.
+  uint64_t max_strlen = bpftrace.scratch_size_ > 0 ? 512 : 200;
+  if (bpftrace.strlen_ > max_strlen) {
     // the verifier errors you would encounter when attempting larger allocations would be:
     // >240=  <Looks like the BPF stack limit of 512 bytes is exceeded. Please move large on stack variables into BPF per-cpu array map.>
     // ~1024= <A call to built-in function 'memset' is not supported.>
     LOG(ERROR) << "'BPFTRACE_STRLEN' " << bpftrace.strlen_
-               << " exceeds the current maximum of 200 bytes.\n"
-               << "This limitation is because strings are currently stored on "
-                  "the 512 byte BPF stack.\n"
-               << "Long strings will be pursued in: "
-                  "https://github.com/iovisor/bpftrace/issues/305";
+               << " exceeds the current maximum of " << max_strlen
+               << " bytes.\n"
+               << (bpftrace.scratch_size_ > 0
+                       ? "Longer strings can't be copied without a loop."
+                       : "This limitation is because strings are stored on "
+                         "the 512 byte BPF stack when BPFTRACE_SCRATCH_SIZE "
+                         "is 0.");
     return 1;
   }
 
@@ -590,6 +663,23 @@ int main(int argc, char *argv[])
   if (!get_uint64_env_var("BPFTRACE_LOG_SIZE", bpftrace.log_size_))
     return 1;
 
+  // Kernels since 5.2 load programs of up to a million instructions, older
+  // ones stop at BPF_MAXINSNS
+  bpftrace.split_insns_ = bpftrace.feature_.instruction_limit() >= 1000000
+                              ? 1000000
+                              : 4096;
+  if (!get_uint64_env_var("BPFTRACE_SPLIT_INSNS", bpftrace.split_insns_))
+    return 1;
+
+  bpftrace.compile_threads_ = std::clamp(
+      std::thread::hardware_concurrency(), 1U, 8U);
+  if (!get_uint64_env_var("BPFTRACE_COMPILE_THREADS",
+                          bpftrace.compile_threads_))
+    return 1;
+  // Debug output and ELF files are made from the unsplit module
+  if (bt_debug != DebugLevel::kNone || !output_elf.empty())
+    bpftrace.compile_threads_ = 1;
+
   if (!get_uint64_env_var("BPFTRACE_PERF_RB_PAGES", bpftrace.perf_rb_pages_))
     return 1;
 
@@ -620,6 +710,21 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (const char* env_p = std::getenv("BPFTRACE_ADAPTIVE_SAMPLING"))
+  {
+    std::string s(env_p);
+    if (s == "1")
+      bpftrace.adaptive_sampling_ = true;
+    else if (s == "0")
+      bpftrace.adaptive_sampling_ = false;
+    else
+    {
+      LOG(ERROR) << "Env var 'BPFTRACE_ADAPTIVE_SAMPLING' did not contain a "
+                    "valid value (0 or 1).";
+      return 1;
+    }
+  }
+
   if (const char* env_p = std::getenv("BPFTRACE_CACHE_USER_SYMBOLS"))
   {
     std::string s(env_p);
@@ -645,6 +750,7 @@ int main(int argc, char *argv[])
   if (!cmd_str.empty())
     bpftrace.cmd_ = cmd_str;
 
+  bpftrace.timings_.start("tracepoints");
   if (TracepointFormatParser::parse(driver.root_.get(), bpftrace) == false)
     return 1;
 
@@ -657,6 +763,7 @@ int main(int argc, char *argv[])
     std::cout << std::endl;
   }
 
+  bpftrace.timings_.start("clang");
   ClangParser clang;
   std::vector<std::string> extra_flags;
   {
@@ -694,10 +801,41 @@ int main(int argc, char *argv[])
   if (!clang.parse(driver.root_.get(), bpftrace, extra_flags))
     return 1;
 
+  bpftrace.timings_.start("reparse");
+  err = driver.parse();
+  if (err)
+    return err;
+
+  // Check the program as written, so that errors in code the optimiser
+  // removes are still reported. Its warnings are left to the analysis of the
+  // optimised program.
+  bpftrace.timings_.start("checks");
+  {
+    std::stringstream checks_out;
+    ast::SemanticAnalyser checks(driver.root_.get(),
+                                 bpftrace,
+                                 bpftrace.feature_,
+                                 checks_out,
+                                 !cmd_str.empty());
+    err = checks.analyse();
+    if (err)
+    {
+      std::cerr << checks_out.str();
+      return err;
+    }
+  }
+  // Start over from an AST without the types the checks gave it, and
+  // without what they recorded in bpftrace
+  bpftrace.clear_analysis();
   err = driver.parse();
   if (err)
     return err;
 
+  bpftrace.timings_.start("optimise");
+  ast::Optimiser optimiser(driver.root_.get(), bpftrace);
+  optimiser.optimise();
+
+  bpftrace.timings_.start("semantics");
   ast::SemanticAnalyser semantics(
       driver.root_.get(), bpftrace, bpftrace.feature_, !cmd_str.empty());
   err = semantics.analyse();
@@ -713,6 +851,7 @@ int main(int argc, char *argv[])
     std::cout << std::endl;
   }
 
+  bpftrace.timings_.start("maps");
   err = semantics.create_maps(bt_debug != DebugLevel::kNone);
   if (err)
     return err;
@@ -730,19 +869,37 @@ int main(int argc, char *argv[])
     }
   }
 
-  ast::CodegenLLVM llvm(driver.root_.get(), bpftrace);
+  // Shared helpers are inlined into every probe when the kernel can't verify
+  // BPF-to-BPF calls
+  if (!bpftrace.feature_.has_bpf_call())
+    bpftrace.helper_subprograms_ = false;
+
+  auto llvm = std::make_unique<ast::CodegenLLVM>(driver.root_.get(), bpftrace);
   std::unique_ptr<BpfOrc> bpforc;
+  std::unique_ptr<BpfOrc> full_bpforc;
+  // The scratch buffer is only created once there are temporaries to move
+  // to it
+  auto create_scratch_map = [&]() {
+    if (bpftrace.maps.Has(MapManager::Type::Scratch) || !llvm->needs_scratch())
+      return 0;
+    return semantics.create_scratch_map(bt_debug != DebugLevel::kNone);
+  };
   try
   {
-    llvm.generate_ir();
+    bpftrace.timings_.start("codegen");
+    llvm->generate_ir();
+    err = create_scratch_map();
+    if (err)
+      return err;
     if (bt_debug == DebugLevel::kFullDebug)
     {
       std::cout << "Before optimization\n";
       std::cout << "-------------------\n\n";
-      llvm.DumpIR();
+      llvm->DumpIR();
     }
 
-    llvm.optimize();
+    bpftrace.timings_.start("llvm optimise");
+    llvm->optimize();
     if (bt_debug != DebugLevel::kNone)
     {
       if (bt_debug == DebugLevel::kFullDebug)
@@ -750,14 +907,35 @@ int main(int argc, char *argv[])
         std::cout << "\nAfter optimization\n";
         std::cout << "------------------\n\n";
       }
-      llvm.DumpIR();
+      llvm->DumpIR();
     }
     if (!output_elf.empty())
     {
-      llvm.emit_elf(output_elf);
+      llvm->emit_elf(output_elf);
       return 0;
     }
-    bpforc = llvm.emit();
+    bpftrace.timings_.start("llvm emit");
+    bpforc = llvm->emit();
+
+    // Probes too large for the kernel are generated again, split into parts
+    // chained with tail calls, until every part fits
+    while (bpftrace.split_large_probes(*bpforc, llvm->probe_insns()))
+    {
+      bpftrace.timings_.start("split");
+      if (!bpftrace.maps.Has(MapManager::Type::TailCalls))
+      {
+        err = semantics.create_tail_call_maps(bt_debug != DebugLevel::kNone);
+        if (err)
+          return err;
+      }
+      llvm = std::make_unique<ast::CodegenLLVM>(driver.root_.get(), bpftrace);
+      llvm->generate_ir();
+      err = create_scratch_map();
+      if (err)
+        return err;
+      llvm->optimize();
+      bpforc = llvm->emit();
+    }
   }
   catch (const std::system_error& ex)
   {
@@ -800,6 +978,13 @@ int main(int argc, char *argv[])
     bpftrace.out_->attached_probes(num_probes);
 
   bpftrace.bpforc_ = bpforc.get();
+  bpftrace.full_bpforc_ = [&]() {
+    if (!full_bpforc)
+      full_bpforc = llvm->emit_full();
+    return full_bpforc.get();
+  };
+  bpftrace.timings_.start("attach");
+  bpftrace.timings_.count("probes", num_probes);
   err = bpftrace.run();
   if (err)
     return err;
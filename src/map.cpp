@@ -1,5 +1,6 @@
 #include <cstring>
 #include <iostream>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <linux/version.h>
 
@@ -10,9 +11,16 @@
 
 #include "map.h"
 #include "mapmanager.h"
+#include "sketch.h"
 
 namespace bpftrace {
 
+namespace {
+// BPF_F_MMAPABLE, only available since Linux 5.5 and missing from older
+// uapi headers
+const int MAP_F_MMAPABLE = (1U << 10);
+} // namespace
+
 int Map::create_map(enum bpf_map_type map_type, const char *name, int key_size, int value_size, int max_entries, int flags) {
 #ifdef HAVE_BCC_CREATE_MAP
   return bcc_create_map(map_type, name, key_size, value_size, max_entries, flags);
@@ -32,24 +40,48 @@ Map::Map(const std::string &name, const SizedType &type, const MapKey &key, int
   lqstep = step;
 
   int key_size = key.size();
-  if (type.IsHistTy() || type.IsLhistTy() || type.IsAvgTy() || type.IsStatsTy())
+  if (type.IsHistTy() || type.IsLhistTy() || type.IsQhistTy() ||
+      type.IsAvgTy() || type.IsStatsTy())
     key_size += 8;
   if (key_size == 0)
     key_size = 8;
 
   if (type.IsCountTy() && !key.args_.size())
   {
+    // Prefer an array userspace can read through a memory mapping, so
+    // printing the counter doesn't cost a syscall.
+    if (create_mmapped_map(name, type.size))
+      return;
+
     map_type_ = BPF_MAP_TYPE_PERCPU_ARRAY;
     max_entries = 1;
     key_size = 4;
   }
-  else if ((type.IsHistTy() || type.IsLhistTy() || type.IsCountTy() ||
-            type.IsSumTy() || type.IsMinTy() || type.IsMaxTy() ||
-            type.IsAvgTy() || type.IsStatsTy()) &&
+  else if ((type.IsHistTy() || type.IsLhistTy() || type.IsQhistTy() ||
+            type.IsCountTy() || type.IsSumTy() || type.IsMinTy() ||
+            type.IsMaxTy() || type.IsAvgTy() || type.IsStatsTy() ||
+            type.IsDistinctTy() || type.IsBhistTy()) &&
            (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)))
   {
       map_type_ = BPF_MAP_TYPE_PERCPU_HASH;
   }
+  else if (type.IsTopkTy())
+  {
+    // The map itself only remembers recently seen keys, their counts live in
+    // the sketch
+    map_type_ = BPF_MAP_TYPE_LRU_HASH;
+    sketch_fd_ = create_map(BPF_MAP_TYPE_PERCPU_ARRAY,
+                            name.c_str(),
+                            4,
+                            TOPK_SKETCH_WIDTH * sizeof(uint64_t),
+                            TOPK_SKETCH_DEPTH,
+                            0);
+    if (sketch_fd_ < 0)
+    {
+      LOG(ERROR) << "failed to create sketch for map: '" << name_
+                 << "': " << strerror(errno);
+    }
+  }
   else if (type.IsJoinTy())
   {
     map_type_ = BPF_MAP_TYPE_PERCPU_ARRAY;
@@ -69,6 +101,59 @@ Map::Map(const std::string &name, const SizedType &type, const MapKey &key, int
   }
 }
 
+// Internal maps which don't hold a bpftrace type, with an explicit layout
+Map::Map(const std::string &name,
+         enum bpf_map_type map_type,
+         int key_size,
+         int value_size,
+         int max_entries,
+         int flags)
+{
+  name_ = name;
+  map_type_ = map_type;
+  mapfd_ = create_map(
+      map_type, name.c_str(), key_size, value_size, max_entries, flags);
+  if (mapfd_ < 0)
+  {
+    LOG(ERROR) << "failed to create " << name << " map: " << strerror(errno);
+  }
+}
+
+// Create an array with one slot per possible CPU and map it into our address
+// space. Returns false if the kernel doesn't support BPF_F_MMAPABLE, in which
+// case the caller should fall back to a regular map.
+bool Map::create_mmapped_map(const std::string &name, int value_size)
+{
+  int ncpus = get_possible_cpus().size();
+  int max_entries = ncpus * MMAP_CPU_STRIDE;
+  int fd = create_map(BPF_MAP_TYPE_ARRAY,
+                      name.c_str(),
+                      4,
+                      value_size,
+                      max_entries,
+                      MAP_F_MMAPABLE);
+  if (fd < 0)
+    return false;
+
+  // The kernel lays out array values 8-byte aligned and only allows mapping
+  // whole pages
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = max_entries * ((value_size + 7) & ~7);
+  size = (size + page_size - 1) & ~(page_size - 1);
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+  {
+    close(fd);
+    return false;
+  }
+
+  mapfd_ = fd;
+  map_type_ = BPF_MAP_TYPE_ARRAY;
+  mmap_ = static_cast<uint8_t *>(addr);
+  mmap_size_ = size;
+  return true;
+}
+
 Map::Map(const SizedType &type) {
 #ifdef DEBUG
   // TODO (mmarchini): replace with DCHECK
@@ -134,6 +219,10 @@ Map::Map(enum bpf_map_type map_type)
 
 Map::~Map()
 {
+  if (mmap_)
+    munmap(mmap_, mmap_size_);
+  if (sketch_fd_ >= 0)
+    close(sketch_fd_);
   if (mapfd_ >= 0)
     close(mapfd_);
 }
@@ -223,6 +312,20 @@ std::string to_string(MapManager::Type t)
       return "join";
     case MapManager::Type::Elapsed:
       return "elapsed";
+    case MapManager::Type::Ratelimit:
+      return "ratelimit";
+    case MapManager::Type::RatelimitKeys:
+      return "ratelimit_keys";
+    case MapManager::Type::SampleRate:
+      return "sample_rate";
+    case MapManager::Type::Zeroes:
+      return "zeroes";
+    case MapManager::Type::TailCalls:
+      return "tail_calls";
+    case MapManager::Type::TailCallScratch:
+      return "tail_call_scratch";
+    case MapManager::Type::Scratch:
+      return "scratch";
   }
   return {}; // unreached
 }
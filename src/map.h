@@ -19,6 +19,12 @@ public:
       int max,
       int step,
       int max_entries);
+  Map(const std::string &name,
+      enum bpf_map_type map_type,
+      int key_size,
+      int value_size,
+      int max_entries,
+      int flags);
   Map(const SizedType &type);
   Map(enum bpf_map_type map_type);
   virtual ~Map() override;
@@ -29,5 +35,8 @@ public:
                  int value_size,
                  int max_entries,
                  int flags);
+
+private:
+  bool create_mmapped_map(const std::string &name, int value_size);
 };
 } // namespace bpftrace
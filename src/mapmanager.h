@@ -59,6 +59,13 @@ public:
     PerfEvent,
     Join,
     Elapsed,
+    Ratelimit,
+    RatelimitKeys,
+    SampleRate,
+    Zeroes,
+    TailCalls,
+    TailCallScratch,
+    Scratch,
   };
 
   void Set(Type t, std::unique_ptr<IMap> map);
@@ -1,5 +1,6 @@
 #include "output.h"
 #include "bpftrace.h"
+#include "qhist.h"
 #include "utils.h"
 
 namespace bpftrace {
@@ -28,6 +29,11 @@ std::ostream& operator<<(std::ostream& out, MessageType type) {
     case MessageType::syscall: out << "syscall"; break;
     case MessageType::attached_probes: out << "attached_probes"; break;
     case MessageType::lost_events: out << "lost_events"; break;
+    case MessageType::map_delta: out << "map_delta"; break;
+    case MessageType::sample_rate: out << "sample_rate"; break;
+    case MessageType::timings: out << "timings"; break;
+    case MessageType::prog_stats: out << "prog_stats"; break;
+    case MessageType::run_stats: out << "run_stats"; break;
     default: out << "?";
   }
   return out;
@@ -64,7 +70,7 @@ std::string TextOutput::hist_index_label(int power)
   return label.str();
 }
 
-std::string TextOutput::lhist_index_label(int number)
+std::string TextOutput::lhist_index_label(int64_t number)
 {
   int kilo = 1024;
   int mega = 1048576;
@@ -91,6 +97,23 @@ std::string TextOutput::lhist_index_label(int number)
   return label.str();
 }
 
+std::string TextOutput::qhist_index_label(uint64_t number)
+{
+  const char *suffixes = "KMGTPE";
+
+  std::ostringstream label;
+  int i = -1;
+  while (number != 0 && number % 1024 == 0 && suffixes[i + 1])
+  {
+    number /= 1024;
+    i++;
+  }
+  label << number;
+  if (i >= 0)
+    label << suffixes[i];
+  return label.str();
+}
+
 void Output::hist_prepare(const std::vector<uint64_t> &values, int &min_index, int &max_index, int &max_value) const
 {
   min_index = -1;
@@ -248,6 +271,83 @@ void TextOutput::lhist(const std::vector<uint64_t> &values, int min, int max, in
   }
 }
 
+void TextOutput::qhist(const std::vector<uint64_t> &values,
+                       int precision,
+                       uint32_t div) const
+{
+  int min_index, max_index, max_value;
+  hist_prepare(values, min_index, max_index, max_value);
+  if (max_index == -1)
+    return;
+
+  // There can be many buckets between the lowest and highest value, only
+  // the ones holding values are shown
+  for (int i = min_index; i <= max_index; i++)
+  {
+    if (values.at(i) == 0)
+      continue;
+
+    uint64_t low, high;
+    qhist_bounds(i, precision, low, high);
+    std::ostringstream header;
+    if (low == high)
+      header << "[" << qhist_index_label(low) << "]";
+    else if (high == UINT64_MAX)
+      header << "[" << qhist_index_label(low) << ", ...)";
+    else
+      header << "[" << qhist_index_label(low) << ", "
+             << qhist_index_label(high + 1) << ")";
+
+    int max_width = 52;
+    int bar_width = values.at(i)/(float)max_value*max_width;
+    std::string bar(bar_width, '@');
+
+    out_ << std::setw(16) << std::left << header.str()
+         << std::setw(8) << std::right << (values.at(i) / div)
+         << " |" << std::setw(max_width) << std::left << bar << "|"
+         << std::endl;
+  }
+
+  for (auto &p : QHIST_PERCENTILES)
+  {
+    if (&p != QHIST_PERCENTILES)
+      out_ << ", ";
+    out_ << p.name << " " << qhist_percentile(values, precision, p.percentile);
+  }
+  out_ << std::endl;
+}
+
+void TextOutput::bhist(const std::vector<uint64_t> &values,
+                       const std::vector<int64_t> &bounds,
+                       uint32_t div) const
+{
+  int min_index, max_index, max_value;
+  hist_prepare(values, min_index, max_index, max_value);
+  if (max_index == -1)
+    return;
+
+  for (int i = min_index; i <= max_index; i++)
+  {
+    std::ostringstream header;
+    if (i == 0)
+      header << "(..., " << lhist_index_label(bounds.front()) << ")";
+    else if (i == static_cast<int>(bounds.size()))
+      header << "[" << lhist_index_label(bounds.back()) << ", ...)";
+    else
+      header << "[" << lhist_index_label(bounds.at(i - 1)) << ", "
+             << lhist_index_label(bounds.at(i)) << ")";
+
+    int max_width = 52;
+    int bar_width = values.at(i)/(float)max_value*max_width;
+    std::string bar(bar_width, '@');
+
+    out_ << std::setw(16) << std::left << header.str()
+         << std::setw(8) << std::right << (values.at(i) / div)
+         << " |" << std::setw(max_width) << std::left << bar << "|"
+         << std::endl;
+  }
+}
+
 void TextOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                           const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                           const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
@@ -265,6 +365,10 @@ void TextOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
 
     if (map.type_.IsHistTy())
       hist(value, div);
+    else if (map.type_.IsQhistTy())
+      qhist(value, map.qprecision, div);
+    else if (map.type_.IsBhistTy())
+      bhist(value, map.bhist_bounds, div);
     else
       lhist(value, map.lqmin, map.lqmax, map.lqstep);
 
@@ -309,6 +413,26 @@ void TextOutput::map_stats(
   out_ << std::endl;
 }
 
+void TextOutput::map_delta(BPFtrace &bpftrace,
+                           IMap &map,
+                           const std::vector<MapDelta> &deltas) const
+{
+  for (auto &delta : deltas)
+  {
+    out_ << map.name_ << map.key_.argument_value_list_str(bpftrace, delta.key)
+         << ": ";
+    if (delta.removed)
+      out_ << "removed";
+    else
+      out_ << delta.value;
+    out_ << " (" << (delta.delta >= 0 ? "+" : "") << delta.delta << ")"
+         << std::endl;
+  }
+
+  if (!deltas.empty())
+    out_ << std::endl;
+}
+
 void TextOutput::value(BPFtrace &bpftrace,
                        const SizedType &ty,
                        const std::vector<uint8_t> &value) const
@@ -333,6 +457,14 @@ void TextOutput::lost_events(uint64_t lost) const
   out_ << "Lost " << lost << " events" << std::endl;
 }
 
+void TextOutput::sample_rate(uint64_t rate) const
+{
+  if (rate == 1)
+    out_ << "Printing all printf() and print() events" << std::endl;
+  else
+    out_ << "Printing 1 in " << rate << " printf() and print() events" << std::endl;
+}
+
 void TextOutput::attached_probes(uint64_t num_probes) const
 {
   if (num_probes == 1)
@@ -341,6 +473,64 @@ void TextOutput::attached_probes(uint64_t num_probes) const
     out_ << "Attaching " << num_probes << " probes..." << std::endl;
 }
 
+void TextOutput::timings(const Timings &timings) const
+{
+  auto flags = out_.flags();
+  auto precision = out_.precision();
+  auto row = [this](const Timings::Phase &phase) {
+    out_ << std::left << std::setw(16) << phase.name << std::right << std::fixed
+         << std::setprecision(1) << std::setw(12) << phase.wall_ms
+         << std::setw(12) << phase.cpu_ms << std::setw(14) << phase.max_rss_kb;
+    for (auto &[counter, n] : phase.counts)
+      out_ << "  " << counter << "=" << n;
+    out_ << std::endl;
+  };
+
+  out_ << std::left << std::setw(16) << "phase" << std::right << std::setw(12)
+       << "wall (ms)" << std::setw(12) << "cpu (ms)" << std::setw(14)
+       << "max rss (kB)" << std::endl;
+  for (auto &phase : timings.phases())
+    row(phase);
+  row(timings.total());
+  out_.flags(flags);
+  out_.precision(precision);
+}
+
+void TextOutput::prog_stats(const std::vector<ProgStats> &stats) const
+{
+  out_ << std::right << std::setw(10) << "xlated" << std::setw(12)
+       << "jited (B)" << std::setw(10) << "verified" << std::setw(8)
+       << "stack"
+       << "  program" << std::endl;
+  for (auto &prog : stats)
+    out_ << std::setw(10) << prog.xlated_insns << std::setw(12)
+         << prog.jited_bytes << std::setw(10) << prog.verified_insns
+         << std::setw(8) << prog.stack_depth << "  " << prog.name << std::endl;
+}
+
+void TextOutput::run_stats(const std::vector<RunStats> &stats,
+                           uint64_t elapsed_ns) const
+{
+  auto flags = out_.flags();
+  auto precision = out_.precision();
+  // cpu % is the share of a single CPU's time spent in the probe
+  out_ << std::right << std::setw(12) << "runs" << std::setw(12) << "avg (ns)"
+       << std::setw(14) << "total (ms)" << std::setw(8) << "cpu %"
+       << "  probe" << std::endl;
+  for (auto &probe : stats)
+  {
+    out_ << std::setw(12) << probe.run_cnt << std::setw(12)
+         << (probe.run_cnt ? probe.run_time_ns / probe.run_cnt : 0)
+         << std::fixed << std::setprecision(1) << std::setw(14)
+         << probe.run_time_ns / 1e6 << std::setprecision(2) << std::setw(8)
+         << (elapsed_ns ? 100.0 * probe.run_time_ns / elapsed_ns : 0) << "  "
+         << probe.name << std::endl;
+  }
+  out_ << std::endl;
+  out_.flags(flags);
+  out_.precision(precision);
+}
+
 std::string TextOutput::tuple_to_str(BPFtrace &bpftrace,
                                      const SizedType &ty,
                                      const std::vector<uint8_t> &value) const
@@ -536,6 +726,68 @@ void JsonOutput::lhist(const std::vector<uint64_t> &values, int min, int max, in
   out_ << "]";
 }
 
+void JsonOutput::qhist(const std::vector<uint64_t> &values,
+                       int precision,
+                       uint32_t div) const
+{
+  int min_index, max_index, max_value;
+  hist_prepare(values, min_index, max_index, max_value);
+  if (max_index == -1)
+    return;
+
+  out_ << "{\"buckets\": [";
+  bool first = true;
+  for (int i = min_index; i <= max_index; i++)
+  {
+    if (values.at(i) == 0)
+      continue;
+    if (!first)
+      out_ << ", ";
+    first = false;
+
+    uint64_t low, high;
+    qhist_bounds(i, precision, low, high);
+    out_ << "{\"min\": " << low << ", \"max\": " << high << ", ";
+    out_ << "\"count\": " << values.at(i) / div;
+    out_ << "}";
+  }
+  out_ << "], \"percentiles\": {";
+  for (auto &p : QHIST_PERCENTILES)
+  {
+    if (&p != QHIST_PERCENTILES)
+      out_ << ", ";
+    out_ << "\"" << p.name
+         << "\": " << qhist_percentile(values, precision, p.percentile);
+  }
+  out_ << "}}";
+}
+
+void JsonOutput::bhist(const std::vector<uint64_t> &values,
+                       const std::vector<int64_t> &bounds,
+                       uint32_t div) const
+{
+  int min_index, max_index, max_value;
+  hist_prepare(values, min_index, max_index, max_value);
+  if (max_index == -1)
+    return;
+
+  out_ << "[";
+  for (int i = min_index; i <= max_index; i++)
+  {
+    if (i > min_index)
+      out_ << ", ";
+
+    out_ << "{";
+    if (i > 0)
+      out_ << "\"min\": " << bounds.at(i - 1) << ", ";
+    if (i < static_cast<int>(bounds.size()))
+      out_ << "\"max\": " << bounds.at(i) - 1 << ", ";
+    out_ << "\"count\": " << values.at(i) / div;
+    out_ << "}";
+  }
+  out_ << "]";
+}
+
 void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t div,
                           const std::map<std::vector<uint8_t>, std::vector<uint64_t>> &values_by_key,
                           const std::vector<std::pair<std::vector<uint8_t>, uint64_t>> &total_counts_by_key) const
@@ -567,6 +819,10 @@ void JsonOutput::map_hist(BPFtrace &bpftrace, IMap &map, uint32_t top, uint32_t
 
     if (map.type_.IsHistTy())
       hist(value, div);
+    else if (map.type_.IsQhistTy())
+      qhist(value, map.qprecision, div);
+    else if (map.type_.IsBhistTy())
+      bhist(value, map.bhist_bounds, div);
     else
       lhist(value, map.lqmin, map.lqmax, map.lqstep);
 
@@ -633,6 +889,44 @@ void JsonOutput::map_stats(
   out_ << "}}" << std::endl;
 }
 
+void JsonOutput::map_delta(BPFtrace &bpftrace,
+                           IMap &map,
+                           const std::vector<MapDelta> &deltas) const
+{
+  if (deltas.empty())
+    return;
+
+  out_ << "{\"type\": \"" << MessageType::map_delta << "\", \"data\": {";
+  out_ << "\"" << json_escape(map.name_) << "\": ";
+  if (map.key_.size() > 0) // check if this map has keys
+    out_ << "{";
+
+  uint32_t i = 0;
+  for (auto &delta : deltas)
+  {
+    std::vector<std::string> args = map.key_.argument_value_list(bpftrace,
+                                                                 delta.key);
+    if (i > 0)
+      out_ << ", ";
+    if (args.size() > 0) {
+      out_ << "\"" << json_escape(str_join(args, ",")) << "\": ";
+    }
+
+    out_ << "{\"value\": ";
+    if (delta.removed)
+      out_ << "null";
+    else
+      out_ << delta.value;
+    out_ << ", \"delta\": " << delta.delta << "}";
+
+    i++;
+  }
+
+  if (map.key_.size() > 0)
+    out_ << "}";
+  out_ << "}}" << std::endl;
+}
+
 void JsonOutput::value(BPFtrace &bpftrace,
                        const SizedType &ty,
                        const std::vector<uint8_t> &value) const
@@ -672,11 +966,73 @@ void JsonOutput::lost_events(uint64_t lost) const
   message(MessageType::lost_events, "events", lost);
 }
 
+void JsonOutput::sample_rate(uint64_t rate) const
+{
+  message(MessageType::sample_rate, "rate", rate);
+}
+
 void JsonOutput::attached_probes(uint64_t num_probes) const
 {
   message(MessageType::attached_probes, "probes", num_probes);
 }
 
+void JsonOutput::timings(const Timings &timings) const
+{
+  auto phase_to_str = [this](const Timings::Phase &phase) {
+    std::ostringstream phase_str;
+    phase_str << "{\"name\": \"" << json_escape(phase.name)
+              << "\", \"wall_ms\": " << phase.wall_ms
+              << ", \"cpu_ms\": " << phase.cpu_ms
+              << ", \"max_rss_kb\": " << phase.max_rss_kb;
+    for (auto &[counter, n] : phase.counts)
+      phase_str << ", \"" << json_escape(counter) << "\": " << n;
+    phase_str << "}";
+    return phase_str.str();
+  };
+
+  std::vector<std::string> phases;
+  for (auto &phase : timings.phases())
+    phases.push_back(phase_to_str(phase));
+
+  out_ << "{\"type\": \"" << MessageType::timings << "\", \"data\": {";
+  out_ << "\"phases\": [" << str_join(phases, ", ") << "], ";
+  out_ << "\"total\": " << phase_to_str(timings.total()) << "}}" << std::endl;
+}
+
+void JsonOutput::prog_stats(const std::vector<ProgStats> &stats) const
+{
+  out_ << "{\"type\": \"" << MessageType::prog_stats << "\", \"data\": [";
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    auto &prog = stats[i];
+    if (i > 0)
+      out_ << ", ";
+    out_ << "{\"name\": \"" << json_escape(prog.name)
+         << "\", \"xlated_insns\": " << prog.xlated_insns
+         << ", \"jited_bytes\": " << prog.jited_bytes
+         << ", \"verified_insns\": " << prog.verified_insns
+         << ", \"stack_depth\": " << prog.stack_depth << "}";
+  }
+  out_ << "]}" << std::endl;
+}
+
+void JsonOutput::run_stats(const std::vector<RunStats> &stats,
+                           uint64_t elapsed_ns) const
+{
+  out_ << "{\"type\": \"" << MessageType::run_stats << "\", \"data\": {";
+  out_ << "\"elapsed_ns\": " << elapsed_ns << ", \"probes\": [";
+  for (size_t i = 0; i < stats.size(); i++)
+  {
+    auto &probe = stats[i];
+    if (i > 0)
+      out_ << ", ";
+    out_ << "{\"name\": \"" << json_escape(probe.name)
+         << "\", \"run_cnt\": " << probe.run_cnt
+         << ", \"run_time_ns\": " << probe.run_time_ns << "}";
+  }
+  out_ << "]}}" << std::endl;
+}
+
 std::string JsonOutput::tuple_to_str(BPFtrace &bpftrace,
                                      const SizedType &ty,
                                      const std::vector<uint8_t> &value) const
@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "imap.h"
+#include "timings.h"
 
 namespace bpftrace {
 
@@ -23,11 +24,26 @@ enum class MessageType
   join,
   syscall,
   attached_probes,
-  lost_events
+  lost_events,
+  map_delta,
+  sample_rate,
+  timings,
+  prog_stats,
+  run_stats
 };
 
 std::ostream& operator<<(std::ostream& out, MessageType type);
 
+// A single entry of print(@map, delta). Removed keys carry a value of 0 and
+// a delta of minus their last seen value.
+struct MapDelta
+{
+  std::vector<uint8_t> key;
+  int64_t value;
+  int64_t delta;
+  bool removed;
+};
+
 class Output
 {
 public:
@@ -51,13 +67,21 @@ public:
       const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
       const std::vector<std::pair<std::vector<uint8_t>, int64_t>>
           &total_counts_by_key) const = 0;
+  virtual void map_delta(BPFtrace &bpftrace,
+                         IMap &map,
+                         const std::vector<MapDelta> &deltas) const = 0;
   virtual void value(BPFtrace &bpftrace,
                      const SizedType &ty,
                      const std::vector<uint8_t> &value) const = 0;
 
   virtual void message(MessageType type, const std::string& msg, bool nl = true) const = 0;
   virtual void lost_events(uint64_t lost) const = 0;
+  virtual void sample_rate(uint64_t rate) const = 0;
   virtual void attached_probes(uint64_t num_probes) const = 0;
+  virtual void timings(const Timings &timings) const = 0;
+  virtual void prog_stats(const std::vector<ProgStats> &stats) const = 0;
+  virtual void run_stats(const std::vector<RunStats> &stats,
+                         uint64_t elapsed_ns) const = 0;
 
 protected:
   std::ostream &out_;
@@ -83,19 +107,34 @@ public:
       const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
       const std::vector<std::pair<std::vector<uint8_t>, int64_t>>
           &total_counts_by_key) const override;
+  void map_delta(BPFtrace &bpftrace,
+                 IMap &map,
+                 const std::vector<MapDelta> &deltas) const override;
   virtual void value(BPFtrace &bpftrace,
                      const SizedType &ty,
                      const std::vector<uint8_t> &value) const override;
 
   void message(MessageType type, const std::string& msg, bool nl = true) const override;
   void lost_events(uint64_t lost) const override;
+  void sample_rate(uint64_t rate) const override;
   void attached_probes(uint64_t num_probes) const override;
+  void timings(const Timings &timings) const override;
+  void prog_stats(const std::vector<ProgStats> &stats) const override;
+  void run_stats(const std::vector<RunStats> &stats,
+                 uint64_t elapsed_ns) const override;
 
 private:
   static std::string hist_index_label(int power);
-  static std::string lhist_index_label(int number);
+  static std::string lhist_index_label(int64_t number);
+  static std::string qhist_index_label(uint64_t number);
   void hist(const std::vector<uint64_t> &values, uint32_t div) const;
   void lhist(const std::vector<uint64_t> &values, int min, int max, int step) const;
+  void qhist(const std::vector<uint64_t> &values,
+             int precision,
+             uint32_t div) const;
+  void bhist(const std::vector<uint64_t> &values,
+             const std::vector<int64_t> &bounds,
+             uint32_t div) const;
   std::string tuple_to_str(BPFtrace &bpftrace,
                            const SizedType &ty,
                            const std::vector<uint8_t> &value) const;
@@ -118,6 +157,9 @@ public:
       const std::map<std::vector<uint8_t>, std::vector<int64_t>> &values_by_key,
       const std::vector<std::pair<std::vector<uint8_t>, int64_t>>
           &total_counts_by_key) const override;
+  void map_delta(BPFtrace &bpftrace,
+                 IMap &map,
+                 const std::vector<MapDelta> &deltas) const override;
   virtual void value(BPFtrace &bpftrace,
                      const SizedType &ty,
                      const std::vector<uint8_t> &value) const override;
@@ -125,7 +167,12 @@ public:
   void message(MessageType type, const std::string& msg, bool nl = true) const override;
   void message(MessageType type, const std::string& field, uint64_t value) const;
   void lost_events(uint64_t lost) const override;
+  void sample_rate(uint64_t rate) const override;
   void attached_probes(uint64_t num_probes) const override;
+  void timings(const Timings &timings) const override;
+  void prog_stats(const std::vector<ProgStats> &stats) const override;
+  void run_stats(const std::vector<RunStats> &stats,
+                 uint64_t elapsed_ns) const override;
 
 private:
   std::string json_escape(const std::string &str) const;
@@ -135,6 +182,12 @@ private:
              int min,
              int max,
              int step) const;
+  void qhist(const std::vector<uint64_t> &values,
+             int precision,
+             uint32_t div) const;
+  void bhist(const std::vector<uint64_t> &values,
+             const std::vector<int64_t> &bounds,
+             uint32_t div) const;
   std::string tuple_to_str(BPFtrace &bpftrace,
                            const SizedType &ty,
                            const std::vector<uint8_t> &value) const;
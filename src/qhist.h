@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace bpftrace {
+
+// qhist() splits every power of two into 2^precision linear sub-buckets, so
+// a bucket is never wider than 2^-precision of the values it holds. Values
+// below 2^precision get a bucket of their own.
+//
+// The bucket index is computed by CodegenLLVM::createQhistFunction() and
+// must stay in sync with the functions below.
+const int QHIST_MAX_PRECISION = 5;
+const int QHIST_DEFAULT_PRECISION = 3;
+
+struct QhistPercentile
+{
+  const char *name;
+  double percentile;
+};
+
+const QhistPercentile QHIST_PERCENTILES[] = {
+  { "p50", 50 },
+  { "p90", 90 },
+  { "p99", 99 },
+  { "p999", 99.9 },
+};
+
+// Number of buckets covering all 64-bit values
+inline size_t qhist_buckets(int precision)
+{
+  return static_cast<size_t>(65 - precision) << precision;
+}
+
+// Lowest and highest value counted in a bucket
+inline void qhist_bounds(size_t index,
+                         int precision,
+                         uint64_t &low,
+                         uint64_t &high)
+{
+  if (index < (1ULL << precision))
+  {
+    low = high = index;
+    return;
+  }
+
+  uint64_t shift = (index >> precision) - 1;
+  uint64_t sub = index & ((1ULL << precision) - 1);
+  low = ((1ULL << precision) + sub) << shift;
+  high = low + (1ULL << shift) - 1;
+}
+
+// Highest value of the bucket the given percentile falls into
+inline uint64_t qhist_percentile(const std::vector<uint64_t> &counts,
+                                 int precision,
+                                 double percentile)
+{
+  uint64_t total = 0;
+  for (uint64_t count : counts)
+    total += count;
+  if (total == 0)
+    return 0;
+
+  uint64_t rank = std::ceil(total * percentile / 100);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); i++)
+  {
+    seen += counts[i];
+    if (seen >= rank && counts[i] > 0)
+    {
+      uint64_t low, high;
+      qhist_bounds(i, precision, low, high);
+      return high;
+    }
+  }
+  return 0; // unreached
+}
+
+} // namespace bpftrace
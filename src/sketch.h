@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace bpftrace {
+
+// topk() counts keys in a count-min sketch of TOPK_SKETCH_DEPTH rows, each
+// row being a single per-CPU array entry of TOPK_SKETCH_WIDTH counters.
+//
+// The BPF side of the hashing is generated in CodegenLLVM::visit(Call &) and
+// must stay in sync with the functions below.
+const int TOPK_SKETCH_DEPTH = 4;
+const int TOPK_SKETCH_WIDTH_BITS = 11;
+const int TOPK_SKETCH_WIDTH = 1 << TOPK_SKETCH_WIDTH_BITS;
+// Candidate keys remembered for each key topk() is asked to print
+const int TOPK_CANDIDATES = 8;
+
+const uint64_t SKETCH_HASH_MULT = 0x9e3779b97f4a7c15ULL;
+const uint64_t SKETCH_ROW_SEEDS[TOPK_SKETCH_DEPTH] = {
+  0x2545f4914f6cdd1dULL,
+  0x9fb21c651e98df25ULL,
+  0xc2b2ae3d27d4eb4fULL,
+  0x165667b19e3779f9ULL,
+};
+
+// Multiplicative hash over 8-byte words, the last word zero padded
+inline uint64_t sketch_hash(const uint8_t *key, size_t size)
+{
+  uint64_t hash = 0;
+  for (size_t off = 0; off < size; off += 8)
+  {
+    uint64_t word = 0;
+    memcpy(&word, key + off, std::min<size_t>(8, size - off));
+    hash = (hash ^ word) * SKETCH_HASH_MULT;
+  }
+  return hash;
+}
+
+// Column of `hash` in the given sketch row
+inline uint32_t sketch_column(uint64_t hash, int row)
+{
+  return ((hash ^ SKETCH_ROW_SEEDS[row]) * SKETCH_HASH_MULT) >>
+         (64 - TOPK_SKETCH_WIDTH_BITS);
+}
+
+// distinct() keeps a HyperLogLog sketch of 2^precision one-byte registers
+// per map key and CPU. A value's register is picked by the top `precision`
+// bits of its hash, and holds the highest count of leading zero bits (plus
+// one) seen in the remaining bits.
+//
+// The hashing is generated in CodegenLLVM::visit(Call &): sketch_hash() of
+// the value, followed by an xorshift-multiply round so that both ends of the
+// hash are well distributed.
+const int DISTINCT_MIN_PRECISION = 4;
+const int DISTINCT_MAX_PRECISION = 12;
+const int DISTINCT_DEFAULT_PRECISION = 10;
+
+// Cardinality estimate from merged registers, with the small range
+// correction of the original HyperLogLog paper
+inline uint64_t distinct_estimate(const std::vector<uint8_t> &registers)
+{
+  double m = registers.size();
+  double alpha;
+  if (registers.size() == 16)
+    alpha = 0.673;
+  else if (registers.size() == 32)
+    alpha = 0.697;
+  else if (registers.size() == 64)
+    alpha = 0.709;
+  else
+    alpha = 0.7213 / (1 + 1.079 / m);
+
+  double sum = 0;
+  size_t zeros = 0;
+  for (uint8_t reg : registers)
+  {
+    sum += std::ldexp(1.0, -reg);
+    if (reg == 0)
+      zeros++;
+  }
+
+  double estimate = alpha * m * m / sum;
+  if (estimate <= 2.5 * m && zeros)
+    estimate = m * std::log(m / zeros);
+  return std::llround(estimate);
+}
+
+} // namespace bpftrace
@@ -0,0 +1,90 @@
+#include <sys/resource.h>
+
+#include "timings.h"
+
+namespace bpftrace {
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - since)
+      .count();
+}
+
+long max_rss_kb()
+{
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+} // namespace
+
+Timings::Timings()
+    : start_wall_(std::chrono::steady_clock::now()), start_cpu_(cpu_ms())
+{
+}
+
+double Timings::cpu_ms()
+{
+  // User and system time of all threads
+  struct rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+void Timings::start(const std::string &name)
+{
+  stop();
+  Phase phase;
+  phase.name = name;
+  phases_.push_back(phase);
+  phase_wall_ = std::chrono::steady_clock::now();
+  phase_cpu_ = cpu_ms();
+  running_ = true;
+}
+
+void Timings::stop()
+{
+  if (!running_)
+    return;
+
+  auto &phase = phases_.back();
+  phase.wall_ms = elapsed_ms(phase_wall_);
+  phase.cpu_ms = cpu_ms() - phase_cpu_;
+  phase.max_rss_kb = max_rss_kb();
+  running_ = false;
+}
+
+void Timings::count(const std::string &counter, uint64_t n)
+{
+  if (running_)
+    phases_.back().counts[counter] += n;
+}
+
+Timings::Phase Timings::total() const
+{
+  Phase total;
+  total.name = "total";
+  if (phases_.empty())
+    return total;
+
+  // Phases only cover what's instrumented, the total everything up to the
+  // end of the last one
+  auto &last = phases_.back();
+  total.wall_ms = std::chrono::duration<double, std::milli>(
+                      phase_wall_ - start_wall_)
+                      .count() +
+                  last.wall_ms;
+  total.cpu_ms = phase_cpu_ - start_cpu_ + last.cpu_ms;
+  total.max_rss_kb = last.max_rss_kb;
+  for (auto &phase : phases_)
+    for (auto &[counter, n] : phase.counts)
+      total.counts[counter] += n;
+  return total;
+}
+
+} // namespace bpftrace
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bpftrace {
+
+// Where bpftrace's start up time goes, as printed with --timings
+class Timings
+{
+public:
+  struct Phase
+  {
+    std::string name;
+    double wall_ms = 0;
+    double cpu_ms = 0;
+    // Peak resident set size of the process by the end of the phase
+    long max_rss_kb = 0;
+    std::map<std::string, uint64_t> counts;
+  };
+
+  Timings();
+
+  // Ends the current phase, if any, and starts the next one
+  void start(const std::string &name);
+  void stop();
+  // Adds to one of the counts of the current phase
+  void count(const std::string &counter, uint64_t n);
+
+  const std::vector<Phase> &phases() const
+  {
+    return phases_;
+  }
+  // Totals from the start of the process until the last phase ended
+  Phase total() const;
+
+private:
+  static double cpu_ms();
+
+  std::chrono::steady_clock::time_point start_wall_;
+  double start_cpu_;
+  std::chrono::steady_clock::time_point phase_wall_;
+  double phase_cpu_ = 0;
+  bool running_ = false;
+  std::vector<Phase> phases_;
+};
+
+} // namespace bpftrace
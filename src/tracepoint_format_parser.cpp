@@ -1,7 +1,14 @@
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <fstream>
 #include <glob.h>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <thread>
 
 #include "ast.h"
 #include "bpftrace.h"
@@ -10,6 +17,181 @@
 #include "tracepoint_format_parser.h"
 
 namespace bpftrace {
+namespace {
+
+struct FormatField
+{
+  std::string type;
+  std::string name;
+  int offset;
+  int size;
+  std::optional<bool> is_signed;
+};
+
+// Splits a line like
+//   field:unsigned int fd;	offset:16;	size:8;	signed:0;
+// into its parts
+bool parse_format_field(const std::string &line, FormatField &field)
+{
+  auto field_pos = line.find("field:");
+  if (field_pos == std::string::npos)
+    return false;
+
+  auto field_semi_pos = line.find(';', field_pos);
+  if (field_semi_pos == std::string::npos)
+    return false;
+
+  auto offset_pos = line.find("offset:", field_semi_pos);
+  if (offset_pos == std::string::npos)
+    return false;
+
+  auto offset_semi_pos = line.find(';', offset_pos);
+  if (offset_semi_pos == std::string::npos)
+    return false;
+
+  auto size_pos = line.find("size:", offset_semi_pos);
+  if (size_pos == std::string::npos)
+    return false;
+
+  auto size_semi_pos = line.find(';', size_pos);
+  if (size_semi_pos == std::string::npos)
+    return false;
+
+  field.size = std::stoi(
+      line.substr(size_pos + 5, size_semi_pos - size_pos - 5));
+  field.offset = std::stoi(
+      line.substr(offset_pos + 7, offset_semi_pos - offset_pos - 7));
+
+  // Kernels older than 2.6.32 don't report signedness
+  field.is_signed.reset();
+  auto signed_pos = line.find("signed:", size_semi_pos);
+  if (signed_pos != std::string::npos)
+    field.is_signed = line.compare(signed_pos + 7, 1, "1") == 0;
+
+  std::string decl = line.substr(field_pos + 6,
+                                 field_semi_pos - field_pos - 6);
+  auto type_end_pos = decl.find_last_of("\t ");
+  if (type_end_pos == std::string::npos)
+    return false;
+  field.type = decl.substr(0, type_end_pos);
+  field.name = decl.substr(type_end_pos + 1);
+  return true;
+}
+
+// Size in bits and signedness of the integer type spelled `type`, for the
+// types which tracepoints commonly use and whose definition doesn't depend on
+// the kernel's configuration
+bool get_integer_type(const std::string &type, size_t &bits, bool &is_signed)
+{
+  static const std::map<std::string, std::pair<size_t, bool>> typedefs = {
+    { "bool", { 8, false } },         { "_Bool", { 8, false } },
+    { "u8", { 8, false } },           { "u16", { 16, false } },
+    { "u32", { 32, false } },         { "u64", { 64, false } },
+    { "s8", { 8, true } },            { "s16", { 16, true } },
+    { "s32", { 32, true } },          { "s64", { 64, true } },
+    { "__u8", { 8, false } },         { "__u16", { 16, false } },
+    { "__u32", { 32, false } },       { "__u64", { 64, false } },
+    { "__s8", { 8, true } },          { "__s16", { 16, true } },
+    { "__s32", { 32, true } },        { "__s64", { 64, true } },
+    { "__be16", { 16, false } },      { "__be32", { 32, false } },
+    { "__be64", { 64, false } },      { "__le16", { 16, false } },
+    { "__le32", { 32, false } },      { "__le64", { 64, false } },
+    { "pid_t", { 32, true } },        { "uid_t", { 32, false } },
+    { "gid_t", { 32, false } },       { "dev_t", { 32, false } },
+    { "umode_t", { 16, false } },     { "gfp_t", { 32, false } },
+    { "clockid_t", { 32, true } },    { "loff_t", { 64, true } },
+    { "sector_t", { 64, false } },    { "time64_t", { 64, true } },
+    { "size_t", { 8 * sizeof(size_t), false } },
+    { "ssize_t", { 8 * sizeof(size_t), true } },
+  };
+
+  std::vector<std::string> words;
+  std::istringstream in(type);
+  for (std::string word; in >> word;)
+    if (word != "const" && word != "volatile" && word != "__user")
+      words.push_back(word);
+
+  if (words.size() == 1 && typedefs.count(words[0]))
+  {
+    std::tie(bits, is_signed) = typedefs.at(words[0]);
+    return true;
+  }
+  if (words.size() == 2 && words[0] == "enum")
+  {
+    bits = 32;
+    is_signed = false;
+    return true;
+  }
+
+  // Combinations of the C keywords
+  int longs = 0;
+  bool is_char = false, is_short = false, has_signed = false,
+       has_unsigned = false;
+  for (auto &word : words)
+  {
+    if (word == "long")
+      longs++;
+    else if (word == "char")
+      is_char = true;
+    else if (word == "short")
+      is_short = true;
+    else if (word == "signed")
+      has_signed = true;
+    else if (word == "unsigned")
+      has_unsigned = true;
+    else if (word != "int")
+      return false;
+  }
+  if (words.empty())
+    return false;
+
+  if (is_char)
+    bits = 8;
+  else if (is_short)
+    bits = 16;
+  else if (longs == 1)
+    bits = 8 * sizeof(long);
+  else if (longs == 2)
+    bits = 64;
+  else
+    bits = 32;
+  is_signed = !has_unsigned &&
+              (has_signed || !is_char ||
+               std::numeric_limits<char>::is_signed);
+  return true;
+}
+
+// Reads the files concurrently, as tracefs generates their contents on every
+// read and wildcards may match hundreds of them
+std::vector<std::string> read_files(const std::vector<std::string> &paths)
+{
+  std::vector<std::string> contents(paths.size());
+  std::atomic<size_t> next(0);
+  auto read = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++)
+    {
+      std::ifstream file(paths[i]);
+      std::ostringstream buf;
+      buf << file.rdbuf();
+      contents[i] = buf.str();
+    }
+  };
+
+  size_t nthreads = std::min<size_t>(
+      { std::max(std::thread::hardware_concurrency(), 1U),
+        8,
+        paths.size() / 32 + 1 });
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nthreads; i++)
+    threads.emplace_back(read);
+  read();
+  for (auto &thread : threads)
+    thread.join();
+
+  return contents;
+}
+
+} // namespace
 
 std::set<std::string> TracepointFormatParser::struct_list;
 
@@ -26,9 +208,20 @@ bool TracepointFormatParser::parse(ast::Program *program, BPFtrace &bpftrace)
   if (probes_with_tracepoint.empty())
     return true;
 
+  // Tracepoints whose args are used, and whose struct hasn't been generated
+  // before
+  struct Format
+  {
+    std::string path;
+    std::string category;
+    std::string event_name;
+  };
+  std::vector<Format> formats;
+  // Format files matched by each wildcard, as several probes may use the
+  // same one
+  std::map<std::string, std::vector<std::string>> matches;
+
   ast::TracepointArgsVisitor n{};
-  if (!bpftrace.btf_.has_data())
-    program->c_definitions += "#include <linux/types.h>\n";
   for (ast::Probe *probe : probes_with_tracepoint)
   {
     n.analyse(probe);
@@ -45,37 +238,50 @@ bool TracepointFormatParser::parse(ast::Program *program, BPFtrace &bpftrace)
         if (has_wildcard(category) || has_wildcard(event_name))
         {
           // tracepoint wildcard expansion, part 1 of 3. struct definitions.
-          memset(&glob_result, 0, sizeof(glob_result));
-          int ret = glob(format_file_path.c_str(), 0, NULL, &glob_result);
-          if (ret != 0)
+          auto match = matches.find(format_file_path);
+          if (match == matches.end())
           {
-            if (ret == GLOB_NOMATCH)
+            memset(&glob_result, 0, sizeof(glob_result));
+            int ret = glob(format_file_path.c_str(), 0, NULL, &glob_result);
+            if (ret != 0)
             {
-              LOG(ERROR, ap->loc, std::cerr)
-                  << "tracepoints not found: " << category << ":" << event_name;
-              // helper message:
-              if (category == "syscall")
+              if (ret == GLOB_NOMATCH)
+              {
                 LOG(ERROR, ap->loc, std::cerr)
-                    << "Did you mean syscalls:" << event_name << "?";
-              if (bt_verbose) {
-                LOG(ERROR) << strerror(errno) << ": " << format_file_path;
+                    << "tracepoints not found: " << category << ":"
+                    << event_name;
+                // helper message:
+                if (category == "syscall")
+                  LOG(ERROR, ap->loc, std::cerr)
+                      << "Did you mean syscalls:" << event_name << "?";
+                if (bt_verbose) {
+                  LOG(ERROR) << strerror(errno) << ": " << format_file_path;
+                }
+                return false;
+              }
+              else
+              {
+                // unexpected error
+                LOG(ERROR, ap->loc, std::cerr) << std::string(strerror(errno));
+                return false;
               }
-              return false;
-            }
-            else
-            {
-              // unexpected error
-              LOG(ERROR, ap->loc, std::cerr) << std::string(strerror(errno));
-              return false;
             }
+
+            match = matches
+                        .emplace(format_file_path,
+                                 std::vector<std::string>(
+                                     glob_result.gl_pathv,
+                                     glob_result.gl_pathv +
+                                         glob_result.gl_pathc))
+                        .first;
+            globfree(&glob_result);
           }
 
           if (!probe->need_tp_args_structs)
             continue;
 
-          for (size_t i = 0; i < glob_result.gl_pathc; ++i) {
-            std::string filename(glob_result.gl_pathv[i]);
-            std::ifstream format_file(filename);
+          for (auto &filename : match->second)
+          {
             std::string prefix("/sys/kernel/debug/tracing/events/");
             size_t pos = prefix.length();
             std::string real_category = filename.substr(
@@ -87,14 +293,9 @@ bool TracepointFormatParser::parse(ast::Program *program, BPFtrace &bpftrace)
             // Check to avoid adding the same struct more than once to definitions
             std::string struct_name = get_struct_name(real_category,
                                                       real_event);
-            if (!TracepointFormatParser::struct_list.count(struct_name))
-            {
-              program->c_definitions += get_tracepoint_struct(
-                  format_file, real_category, real_event, bpftrace);
-              TracepointFormatParser::struct_list.insert(struct_name);
-            }
+            if (TracepointFormatParser::struct_list.insert(struct_name).second)
+              formats.push_back({ filename, real_category, real_event });
           }
-          globfree(&glob_result);
         }
         else
         {
@@ -125,12 +326,44 @@ bool TracepointFormatParser::parse(ast::Program *program, BPFtrace &bpftrace)
           // Check to avoid adding the same struct more than once to definitions
           std::string struct_name = get_struct_name(category, event_name);
           if (TracepointFormatParser::struct_list.insert(struct_name).second)
-            program->c_definitions += get_tracepoint_struct(
-                format_file, category, event_name, bpftrace);
+            formats.push_back({ format_file_path, category, event_name });
         }
       }
     }
   }
+
+  std::vector<std::string> paths;
+  for (auto &format : formats)
+    paths.push_back(format.path);
+  auto contents = read_files(paths);
+
+  // Structs are only left to clang when they use types which can't be
+  // resolved without the kernel's headers
+  std::string definitions;
+  for (size_t i = 0; i < formats.size(); i++)
+  {
+    auto &format = formats[i];
+    std::istringstream format_file(contents[i]);
+    Struct record;
+    if (get_tracepoint_record(format_file, record))
+    {
+      bpftrace.structs_[get_struct_name(format.category, format.event_name)] =
+          std::move(record);
+      continue;
+    }
+
+    format_file.clear();
+    format_file.seekg(0);
+    definitions += get_tracepoint_struct(
+        format_file, format.category, format.event_name, bpftrace);
+  }
+
+  if (!definitions.empty())
+  {
+    if (!bpftrace.btf_.has_data())
+      program->c_definitions += "#include <linux/types.h>\n";
+    program->c_definitions += definitions;
+  }
   return true;
 }
 
@@ -153,33 +386,12 @@ std::string TracepointFormatParser::parse_field(const std::string &line,
 {
   std::string extra = "";
 
-  auto field_pos = line.find("field:");
-  if (field_pos == std::string::npos)
+  FormatField format_field;
+  if (!parse_format_field(line, format_field))
     return "";
 
-  auto field_semi_pos = line.find(';', field_pos);
-  if (field_semi_pos == std::string::npos)
-    return "";
-
-  auto offset_pos = line.find("offset:", field_semi_pos);
-  if (offset_pos == std::string::npos)
-    return "";
-
-  auto offset_semi_pos = line.find(';', offset_pos);
-  if (offset_semi_pos == std::string::npos)
-    return "";
-
-  auto size_pos = line.find("size:", offset_semi_pos);
-  if (size_pos == std::string::npos)
-    return "";
-
-  auto size_semi_pos = line.find(';', size_pos);
-  if (size_semi_pos == std::string::npos)
-    return "";
-
-  int size = std::stoi(line.substr(size_pos + 5, size_semi_pos - size_pos - 5));
-  int offset = std::stoi(
-      line.substr(offset_pos + 7, offset_semi_pos - offset_pos - 7));
+  int size = format_field.size;
+  int offset = format_field.offset;
 
   // If there'a gap between last field and this one,
   // generate padding fields
@@ -195,12 +407,8 @@ std::string TracepointFormatParser::parse_field(const std::string &line,
 
   *last_offset = offset + size;
 
-  std::string field = line.substr(field_pos + 6, field_semi_pos - field_pos - 6);
-  auto field_type_end_pos = field.find_last_of("\t ");
-  if (field_type_end_pos == std::string::npos)
-    return "";
-  std::string field_type = field.substr(0, field_type_end_pos);
-  std::string field_name = field.substr(field_type_end_pos+1);
+  std::string field_type = format_field.type;
+  std::string field_name = format_field.name;
 
   if (field_type.find("__data_loc") != std::string::npos)
   {
@@ -257,4 +465,126 @@ std::string TracepointFormatParser::get_tracepoint_struct(
   return format_struct;
 }
 
+bool TracepointFormatParser::get_tracepoint_record(std::istream &format_file,
+                                                   Struct &record)
+{
+  // Laid out the same as the struct get_tracepoint_struct() generates,
+  // including its padding fields
+  record = Struct{};
+  int last_offset = 0;
+  int end = 0;
+  int align = 1;
+
+  for (std::string line; getline(format_file, line);)
+  {
+    FormatField field;
+    if (line.find("field:") == std::string::npos)
+      continue;
+    if (!parse_format_field(line, field))
+      return false;
+
+    if (field.offset && last_offset)
+    {
+      for (int pad = last_offset; pad < field.offset; pad++)
+        record.fields["__pad_" + std::to_string(pad)] = Field{
+          CreateInt8(), pad, false, {}
+        };
+    }
+    last_offset = field.offset + field.size;
+    end = std::max(end, last_offset);
+
+    SizedType type;
+    std::string name = field.name;
+    size_t bits;
+    bool is_signed;
+    int field_align;
+
+    if (field.type.find("__data_loc") != std::string::npos)
+    {
+      type = CreateInt32();
+      name = "data_loc_" + name;
+      field_align = 4;
+    }
+    else if (name.find('[') != std::string::npos)
+    {
+      auto open = name.find('[');
+      auto close = name.find(']', open);
+      if (close != name.size() - 1)
+        return false;
+      std::string count = name.substr(open + 1, close - open - 1);
+      if (count.empty() ||
+          count.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+      size_t num_elements = std::stoul(count);
+      name = name.substr(0, open);
+
+      std::string elem_type = field.type;
+      trim(elem_type);
+      if (elem_type == "char" || elem_type == "const char")
+      {
+        type = CreateString(num_elements);
+        field_align = 1;
+      }
+      else if (get_integer_type(elem_type, bits, is_signed) &&
+               bits / 8 * num_elements == static_cast<size_t>(field.size))
+      {
+        type = CreateArray(num_elements, CreateInteger(bits, is_signed));
+        field_align = bits / 8;
+      }
+      else
+        return false;
+    }
+    else if (field.type.find('*') != std::string::npos)
+    {
+      // Only pointers to integers, whose type is known without headers
+      auto stars = std::count(field.type.begin(), field.type.end(), '*');
+      std::string pointee = field.type.substr(0, field.type.find('*'));
+      std::string rest = field.type.substr(field.type.find('*'));
+      rest.erase(std::remove(rest.begin(), rest.end(), '*'), rest.end());
+      std::istringstream qualifiers(rest);
+      for (std::string word; qualifiers >> word;)
+        if (word != "const" && word != "volatile")
+          return false;
+
+      trim(pointee);
+      if (pointee == "void" || pointee == "const void")
+        type = CreateNone();
+      else if (get_integer_type(pointee, bits, is_signed))
+        type = CreateInteger(bits, is_signed);
+      else
+        return false;
+      for (; stars > 0; stars--)
+        type = CreatePointer(type);
+      if (field.size != sizeof(void *))
+        return false;
+      field_align = field.size;
+    }
+    else
+    {
+      // Typedefs of structs look like integers in the format, so only types
+      // known to be integers are taken
+      if (!get_integer_type(field.type, bits, is_signed) ||
+          (field.size != 1 && field.size != 2 && field.size != 4 &&
+           field.size != 8))
+        return false;
+      // Enums and bools are unsigned to clang, whatever the kernel reports
+      if (field.is_signed.has_value() &&
+          field.type.rfind("enum ", 0) != 0 && field.type != "bool" &&
+          field.type != "_Bool")
+        is_signed = *field.is_signed;
+      type = CreateInteger(8 * field.size, is_signed);
+      field_align = field.size;
+    }
+
+    align = std::max(align, field_align);
+    record.fields[name] = Field{ type, field.offset, false, {} };
+  }
+
+  if (record.fields.empty())
+    return false;
+
+  record.size = (end + align - 1) / align * align;
+  return true;
+}
+
 } // namespace bpftrace
@@ -164,6 +164,11 @@ protected:
                                            const std::string &category,
                                            const std::string &event_name,
                                            BPFtrace &bpftrace);
+  // Builds the struct for the tracepoint directly, without clang. Returns
+  // false if a field has a type which can't be resolved without the kernel's
+  // headers.
+  static bool get_tracepoint_record(std::istream &format_file,
+                                    Struct &record);
 };
 
 } // namespace bpftrace
@@ -172,6 +172,10 @@ std::string typestr(Type t)
     case Type::buffer:   return "buffer";   break;
     case Type::tuple:    return "tuple";    break;
     case Type::timestamp:return "timestamp";break;
+    case Type::topk:     return "topk";     break;
+    case Type::distinct: return "distinct"; break;
+    case Type::qhist:    return "qhist";    break;
+    case Type::bhist:    return "bhist";    break;
     // clang-format on
   }
 
@@ -422,7 +426,7 @@ SizedType CreateKSym()
 
 SizedType CreateJoin(size_t argnum, size_t argsize)
 {
-  return SizedType(Type::join, 8 + 8 + argnum * argsize);
+  return SizedType(Type::join, 8 + 8 + 8 + argnum * argsize);
 }
 
 SizedType CreateBuffer(size_t size)
@@ -435,6 +439,28 @@ SizedType CreateTimestamp()
   return SizedType(Type::timestamp, 16);
 }
 
+SizedType CreateTopk()
+{
+  return SizedType(Type::topk, 8);
+}
+
+SizedType CreateDistinct(int precision)
+{
+  // One byte register per bucket
+  return SizedType(Type::distinct, 1ULL << precision);
+}
+
+SizedType CreateQhist()
+{
+  return SizedType(Type::qhist, 8);
+}
+
+SizedType CreateBhist(size_t buckets)
+{
+  // One u64 counter per bucket
+  return SizedType(Type::bhist, buckets * 8);
+}
+
 bool SizedType::IsSigned(void) const
 {
   return is_signed_;
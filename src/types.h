@@ -44,7 +44,11 @@ enum class Type
   array,
   buffer,
   tuple,
-  timestamp
+  timestamp,
+  topk,
+  distinct,
+  qhist,
+  bhist
   // clang-format on
 };
 
@@ -288,6 +292,22 @@ public:
   {
     return type == Type::timestamp;
   };
+  bool IsTopkTy(void) const
+  {
+    return type == Type::topk;
+  };
+  bool IsDistinctTy(void) const
+  {
+    return type == Type::distinct;
+  };
+  bool IsQhistTy(void) const
+  {
+    return type == Type::qhist;
+  };
+  bool IsBhistTy(void) const
+  {
+    return type == Type::bhist;
+  };
 
   friend std::ostream &operator<<(std::ostream &, const SizedType &);
   friend std::ostream &operator<<(std::ostream &, Type);
@@ -345,6 +365,10 @@ SizedType CreateKSym();
 SizedType CreateJoin(size_t argnum, size_t argsize);
 SizedType CreateBuffer(size_t size);
 SizedType CreateTimestamp();
+SizedType CreateTopk();
+SizedType CreateDistinct(int precision);
+SizedType CreateQhist();
+SizedType CreateBhist(size_t buckets);
 
 std::ostream &operator<<(std::ostream &os, const SizedType &type);
 
@@ -412,6 +436,7 @@ struct Probe
   uint64_t loc;                 // for USDT probes
   int usdt_location_idx = 0;    // to disambiguate duplicate USDT markers
   uint64_t log_size;
+  bool prog_stats = false;      // collect ProgStats when loading
   int index = 0;
   int freq;
   pid_t pid = -1;
@@ -421,7 +446,30 @@ struct Probe
   uint64_t func_offset = 0;
 };
 
+// What the kernel made of a loaded program, collected with --prog-stats
+struct ProgStats
+{
+  std::string name;
+  uint64_t xlated_insns = 0;
+  uint64_t jited_bytes = 0;
+  // Instructions the verifier went through and the stack it found in use,
+  // summed over BPF-to-BPF subprograms. 0 if the kernel doesn't report them.
+  uint64_t verified_insns = 0;
+  uint64_t stack_depth = 0;
+};
+
+// Time spent running the programs of a probe, collected with --run-stats
+struct RunStats
+{
+  std::string name;
+  uint64_t run_cnt = 0;
+  uint64_t run_time_ns = 0;
+};
+
 const int RESERVED_IDS_PER_ASYNCACTION = 10000;
+// Set in the id of printf(), system() and cat() records whose strings are
+// packed behind the fixed part of the record, see BPFtrace::get_arg_values()
+const uint64_t ASYNC_PACKED_STRINGS = 1ULL << 31;
 
 enum class AsyncAction
 {
@@ -437,7 +485,8 @@ enum class AsyncAction
   join,
   helper_error,
   print_non_map,
-  strftime
+  strftime,
+  print_delta
   // clang-format on
 };
 
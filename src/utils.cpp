@@ -139,6 +139,49 @@ bool get_uint64_env_var(const std::string &str, uint64_t &dest)
   return true;
 }
 
+/**
+ * Directory for files which are expensive to recreate, but can be recreated
+ * at any time. Empty if caching is disabled.
+ */
+std::string get_cache_dir()
+{
+  if (const char *env_p = std::getenv("BPFTRACE_CACHE_DIR"))
+    return env_p;
+  if (const char *env_p = std::getenv("XDG_CACHE_HOME"))
+    return std::string(env_p) + "/bpftrace";
+  if (const char *env_p = std::getenv("HOME"))
+    return std::string(env_p) + "/.cache/bpftrace";
+  return "";
+}
+
+/**
+ * Whether a file read from the cache directory can be trusted: only if it
+ * belongs to the current user and nobody else can write to it. Otherwise
+ * another user could feed their own files to bpftrace running as root, e.g.
+ * under sudo with the cache directory in their home.
+ */
+bool is_trusted_file(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  return S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+         (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/**
+ * Whether a cache directory can be trusted: nobody but the current user may
+ * add, replace or rename the files in it.
+ */
+bool is_trusted_dir(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return false;
+  return S_ISDIR(st.st_mode) && st.st_uid == geteuid() &&
+         (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
 std::string get_pid_exe(pid_t pid)
 {
   char proc_path[512];
@@ -117,6 +117,9 @@ static std::vector<std::string> UNSAFE_BUILTIN_FUNCS = {
 static std::vector<std::string> COMPILE_TIME_FUNCS = { "cgroupid" };
 
 bool get_uint64_env_var(const ::std::string &str, uint64_t &dest);
+std::string get_cache_dir();
+bool is_trusted_file(int fd);
+bool is_trusted_dir(int fd);
 std::string get_pid_exe(pid_t pid);
 bool has_wildcard(const std::string &str);
 std::vector<std::string> split_string(const std::string &str,
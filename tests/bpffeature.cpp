@@ -0,0 +1,98 @@
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bpffeature.h"
+#include "gtest/gtest.h"
+
+namespace bpftrace {
+namespace test {
+namespace bpffeature {
+
+const std::string report = "Kernel helpers\n"
+                           "  probe_read: yes\n"
+                           "  probe_read_str: yes\n"
+                           "  probe_read_user: no\n"
+                           "  probe_read_user_str: no\n"
+                           "  probe_read_kernel: no\n"
+                           "  probe_read_kernel_str: no\n"
+                           "  get_current_cgroup_id: yes\n"
+                           "  send_signal: yes\n"
+                           "  override_return: no\n"
+                           "  get_boot_ns: no\n"
+                           "\n"
+                           "Kernel features\n"
+                           "  Instruction limit: 1000000\n"
+                           "  Loop support: yes\n"
+                           "  BPF-to-BPF calls: yes\n"
+                           "  btf (depends on Build:libbpf): no\n"
+                           "  map batch (depends on Build:libbpf): no\n"
+                           "\n"
+                           "Map types\n"
+                           "  hash: yes\n"
+                           "  percpu hash: yes\n"
+                           "  array: yes\n"
+                           "  percpu array: yes\n"
+                           "  stack_trace: yes\n"
+                           "  perf_event_array: yes\n"
+                           "\n"
+                           "Probe types\n"
+                           "  kprobe: yes\n"
+                           "  tracepoint: yes\n"
+                           "  perf_event: yes\n"
+                           "  kfunc: no\n"
+                           "\n";
+
+TEST(bpffeature, parse_report)
+{
+  BPFfeature feature;
+  std::istringstream in(report);
+  ASSERT_TRUE(feature.parse_report(in));
+
+  // All checks are served from the report, none probe the kernel
+  EXPECT_EQ(feature.report(), report);
+  EXPECT_EQ(feature.instruction_limit(), 1000000);
+  EXPECT_TRUE(feature.has_helper_send_signal());
+  EXPECT_FALSE(feature.has_prog_kfunc());
+}
+
+TEST(bpffeature, parse_report_invalid)
+{
+  BPFfeature feature;
+  std::istringstream in("Kernel helpers\n  probe_read: maybe\n"
+                        "  Instruction limit: none\n  unknown: yes\n");
+  EXPECT_FALSE(feature.parse_report(in));
+}
+
+TEST(bpffeature, read_cache)
+{
+  std::string path = "/tmp/bpftrace-test-features-XXXXXX";
+  int fd = mkstemp(&path[0]);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  std::ofstream(path) << "key: " << BPFfeature::cache_key() << std::endl
+                      << report;
+
+  ASSERT_EQ(chmod(path.c_str(), 0644), 0);
+  BPFfeature feature;
+  EXPECT_TRUE(feature.read_cache(path));
+  EXPECT_EQ(feature.report(), report);
+
+  // Files others can write to are ignored
+  ASSERT_EQ(chmod(path.c_str(), 0664), 0);
+  EXPECT_FALSE(BPFfeature().read_cache(path));
+  ASSERT_EQ(chmod(path.c_str(), 0646), 0);
+  EXPECT_FALSE(BPFfeature().read_cache(path));
+
+  // As are those written for another kernel
+  ASSERT_EQ(chmod(path.c_str(), 0644), 0);
+  std::ofstream(path) << "key: other" << std::endl << report;
+  EXPECT_FALSE(BPFfeature().read_cache(path));
+
+  unlink(path.c_str());
+}
+
+} // namespace bpffeature
+} // namespace test
+} // namespace bpftrace
@@ -1075,6 +1075,39 @@ TEST(bpftrace, sort_by_key_int_str)
   EXPECT_THAT(values_by_key, ContainerEq(expected_values));
 }
 
+TEST(bpftrace, next_sample_rate)
+{
+  using namespace std::chrono_literals;
+
+  // Losses double the rate, up to 1 in 65536
+  EXPECT_EQ(BPFtrace::next_sample_rate(1, 1, 0s), 2U);
+  EXPECT_EQ(BPFtrace::next_sample_rate(2, 100, 5s), 4U);
+  EXPECT_EQ(BPFtrace::next_sample_rate(1 << 16, 1, 0s), 1U << 16);
+
+  // A second without losses halves it, down to printing everything
+  EXPECT_EQ(BPFtrace::next_sample_rate(8, 0, 999ms), 8U);
+  EXPECT_EQ(BPFtrace::next_sample_rate(8, 0, 1s), 4U);
+  EXPECT_EQ(BPFtrace::next_sample_rate(1, 0, 10s), 1U);
+}
+
+TEST(bpftrace, clear_analysis)
+{
+  BPFtrace bpftrace;
+  bpftrace.printf_args_.emplace_back("%d", std::vector<Field>{});
+  bpftrace.join_args_.emplace_back(",");
+  bpftrace.ratelimit_sites_ = 2;
+  bpftrace.has_usdt_ = true;
+  bpftrace.strlen_ = 128;
+
+  // What the analysis recorded goes, the settings stay
+  bpftrace.clear_analysis();
+  EXPECT_TRUE(bpftrace.printf_args_.empty());
+  EXPECT_TRUE(bpftrace.join_args_.empty());
+  EXPECT_EQ(bpftrace.ratelimit_sites_, 0U);
+  EXPECT_FALSE(bpftrace.has_usdt_);
+  EXPECT_EQ(bpftrace.strlen_, 128U);
+}
+
 #ifdef HAVE_LIBBPF_BTF_DUMP
 
 #include "btf_common.h"
@@ -4,7 +4,10 @@
 #include "bpftrace.h"
 #include "struct.h"
 #include "field_analyser.h"
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <sys/stat.h>
 
 namespace bpftrace {
 namespace test {
@@ -617,6 +620,42 @@ TEST_F(clang_parser_btf, btf)
   EXPECT_EQ(foo2.offset, 8);
 }
 
+TEST_F(clang_parser_btf, btf_pointee_structs)
+{
+  // Records only reached through pointers are left until they're
+  // dereferenced
+  BPFtrace bpftrace;
+  parse("",
+        bpftrace,
+        true,
+        "kprobe:sys_read { @x3 = (struct Foo3 *) curtask; }");
+
+  StructMap &structs = bpftrace.structs_;
+
+  ASSERT_EQ(structs.size(), 1U);
+  ASSERT_EQ(structs.count("struct Foo3"), 1U);
+  auto foo2 = structs["struct Foo3"].fields["foo2"];
+  EXPECT_EQ(foo2.type.GetPointeeTy()->GetName(), "struct Foo2");
+
+  // Dereferencing one resolves it, along with the records it embeds
+  BPFtrace bpftrace2;
+  parse("",
+        bpftrace2,
+        true,
+        "kprobe:sys_read { @x3 = ((struct Foo3 *) curtask)->foo2->g; }");
+
+  StructMap &structs2 = bpftrace2.structs_;
+
+  ASSERT_EQ(structs2.size(), 3U);
+  ASSERT_EQ(structs2.count("struct Foo1"), 1U);
+  ASSERT_EQ(structs2.count("struct Foo2"), 1U);
+  ASSERT_EQ(structs2.count("struct Foo3"), 1U);
+
+  EXPECT_EQ(structs2["struct Foo2"].size, 24);
+  EXPECT_EQ(structs2["struct Foo2"].fields["g"].offset, 8);
+  EXPECT_EQ(structs2["struct Foo2"].fields["f"].type.GetName(), "struct Foo1");
+}
+
 TEST_F(clang_parser_btf, btf_field_struct)
 {
   BPFtrace bpftrace;
@@ -737,6 +776,69 @@ TEST(clang_parser, struct_qualifiers)
   EXPECT_EQ(SB.fields["a2"].type.GetName(), "struct a");
 }
 
+TEST(clang_parser, precompiled_header)
+{
+  std::string cache_dir = "/tmp/bpftrace-test-cache-XXXXXX";
+  ASSERT_NE(mkdtemp(&cache_dir[0]), nullptr);
+  setenv("BPFTRACE_CACHE_DIR", cache_dir.c_str(), 1);
+
+  auto parse_foo = [] {
+    BPFtrace bpftrace;
+    parse("struct Foo { int x; long y; }", bpftrace);
+    ASSERT_EQ(bpftrace.structs_.count("struct Foo"), 1U);
+    EXPECT_EQ(bpftrace.structs_["struct Foo"].size, 16);
+  };
+  auto pch_stat = [&](struct stat &st) {
+    for (auto &entry :
+         std::filesystem::directory_iterator(cache_dir + "/headers"))
+      if (entry.path().extension() == ".pch")
+        return stat(entry.path().c_str(), &st) == 0;
+    return false;
+  };
+
+  // The first parse builds the header
+  parse_foo();
+  struct stat built;
+  ASSERT_TRUE(pch_stat(built));
+
+  // The second one uses it, and would have removed it if that had failed
+  parse_foo();
+  struct stat used;
+  ASSERT_TRUE(pch_stat(used));
+  EXPECT_EQ(used.st_ino, built.st_ino);
+
+  // Headers others can write to are rebuilt
+  for (auto &entry :
+       std::filesystem::directory_iterator(cache_dir + "/headers"))
+    if (entry.path().extension() == ".pch")
+      ASSERT_EQ(chmod(entry.path().c_str(), 0666), 0);
+  parse_foo();
+  struct stat rebuilt;
+  ASSERT_TRUE(pch_stat(rebuilt));
+  EXPECT_NE(rebuilt.st_ino, built.st_ino);
+  EXPECT_EQ(rebuilt.st_mode & (S_IWGRP | S_IWOTH), 0U);
+
+  // A missing header is rebuilt, even though its dependencies are unchanged
+  auto remove_pch = [&] {
+    for (auto &entry :
+         std::filesystem::directory_iterator(cache_dir + "/headers"))
+      if (entry.path().extension() == ".pch")
+        std::filesystem::remove(entry.path());
+  };
+  remove_pch();
+  parse_foo();
+  ASSERT_TRUE(pch_stat(rebuilt));
+
+  // Nothing is cached in a directory others can write to
+  remove_pch();
+  ASSERT_EQ(chmod((cache_dir + "/headers").c_str(), 0777), 0);
+  parse_foo();
+  EXPECT_FALSE(pch_stat(rebuilt));
+
+  setenv("BPFTRACE_CACHE_DIR", "", 1);
+  std::filesystem::remove_all(cache_dir);
+}
+
 } // namespace clang_parser
 } // namespace test
 } // namespace bpftrace
@@ -0,0 +1,23 @@
+#include "common.h"
+
+namespace bpftrace {
+namespace test {
+namespace codegen {
+
+TEST(codegen, call_ratelimit)
+{
+  test("kprobe:f /ratelimit(10)/ { @x = 1 }",
+
+       NAME);
+}
+
+TEST(codegen, call_ratelimit_key)
+{
+  test("kprobe:f /ratelimit(10, pid)/ { @x = 1 }",
+
+       NAME);
+}
+
+} // namespace codegen
+} // namespace test
+} // namespace bpftrace
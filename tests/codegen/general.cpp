@@ -57,6 +57,66 @@ TEST(codegen, populate_sections)
   EXPECT_EQ(bpforc->sections_.count("s_kprobe:bar_1"), 1U);
 }
 
+TEST(codegen, fast_compile)
+{
+  BPFtrace bpftrace;
+  bpftrace.fast_compile_ = true;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { @[pid] = hist(tid) }"), 0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  auto bpforc = codegen.compile();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+
+  // The same programs, fully optimised
+  auto full_bpforc = codegen.emit_full();
+  ASSERT_NE(full_bpforc, nullptr);
+  EXPECT_EQ(full_bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+}
+
+TEST(codegen, compile_threads)
+{
+  auto compile = [](uint64_t threads) {
+    BPFtrace bpftrace;
+    bpftrace.compile_threads_ = threads;
+    Driver driver(bpftrace);
+
+    EXPECT_EQ(driver.parse_str("kprobe:foo { @a[pid] = hist(tid) }"
+                               "kprobe:bar { @b = lhist(tid, 0, 100, 10) }"
+                               "kprobe:baz { printf(\"%d\\n\", pid) }"),
+              0);
+    MockBPFfeature feature;
+    ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+    EXPECT_EQ(semantics.analyse(), 0);
+    // Both compiles refer to maps by the same fds
+    FakeMap::next_mapfd_ = 1;
+    EXPECT_EQ(semantics.create_maps(true), 0);
+    ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+    auto bpforc = codegen.compile();
+
+    std::map<std::string, std::vector<uint8_t>> sections;
+    for (auto &[name, section] : bpforc->sections_)
+    {
+      // Only probe sections, others such as .eh_frame may be laid out
+      // differently
+      if (name.rfind("s_", 0) != 0)
+        continue;
+      auto *data = std::get<0>(section);
+      sections[name].assign(data, data + std::get<1>(section));
+    }
+    return sections;
+  };
+
+  // Each probe compiled on its own comes out the same
+  auto serial = compile(1);
+  EXPECT_EQ(serial.size(), 3U);
+  EXPECT_EQ(compile(4), serial);
+}
+
 TEST(codegen, printf_offsets)
 {
   BPFtrace bpftrace;
@@ -107,6 +167,331 @@ TEST(codegen, printf_offsets)
   EXPECT_EQ(args[3].offset, 40);
 }
 
+TEST(codegen, helper_subprograms)
+{
+  BPFtrace bpftrace;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { @a = hist(pid); @b = hist(tid) }"
+                             "kprobe:bar { @c = lhist(pid, 0, 10, 1) }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+
+  // Helpers are emitted once per probe, into the probe's own section
+  std::stringstream ir;
+  codegen.DumpIR(ir);
+  EXPECT_TRUE(std::regex_search(
+      ir.str(),
+      std::regex("define internal i64 @log2\\(.*section \"s_kprobe:foo_1\"")));
+  EXPECT_TRUE(std::regex_search(
+      ir.str(),
+      std::regex(
+          "define internal i64 @linear\\(.*section \"s_kprobe:bar_1\"")));
+  EXPECT_FALSE(std::regex_search(ir.str(), std::regex("@log2\\.")));
+
+  // and are still called after optimisation
+  codegen.optimize();
+  std::stringstream opt_ir;
+  codegen.DumpIR(opt_ir);
+  EXPECT_TRUE(std::regex_search(opt_ir.str(), std::regex("call .*@log2\\(")));
+
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:bar_1"), 1U);
+}
+
+TEST(codegen, helper_inlined)
+{
+  BPFtrace bpftrace;
+  bpftrace.helper_subprograms_ = false;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { @a = hist(pid) }"), 0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+  codegen.optimize();
+
+  // Kernels without BPF-to-BPF calls get the helpers inlined
+  std::stringstream ir;
+  codegen.DumpIR(ir);
+  EXPECT_FALSE(std::regex_search(ir.str(), std::regex("call .*@log2\\(")));
+
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+}
+
+TEST(codegen, split_probe)
+{
+  auto bpftrace_ptr = get_mock_bpftrace();
+  auto &bpftrace = *bpftrace_ptr;
+  bpftrace.split_insns_ = 1;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { $a = 1; @x = $a; @y[probe] = $a }"
+                             "tracepoint:sched:sched_switch { @z = 1; @w = 2 }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  EXPECT_FALSE(bpftrace.maps.Has(MapManager::Type::TailCalls));
+  auto codegen = std::make_unique<ast::CodegenLLVM>(driver.root_.get(),
+                                                    bpftrace);
+  auto bpforc = codegen->compile();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+  EXPECT_EQ(bpftrace.num_probes(), 2);
+  EXPECT_EQ(bpftrace.probe_ids_.size(), 1U);
+
+  // Only the kprobe is compiled again, split after every statement but the
+  // last. Tracepoints are never split.
+  ASSERT_TRUE(bpftrace.split_large_probes(*bpforc, codegen->probe_insns()));
+  EXPECT_EQ(bpftrace.split_sections_.size(), 1U);
+  EXPECT_EQ(bpftrace.split_sections_.count("s_kprobe:foo_1"), 1U);
+  EXPECT_EQ(bpftrace.num_probes(), 0);
+  EXPECT_EQ(bpftrace.probe_ids_.size(), 0U);
+  ASSERT_EQ(semantics.create_tail_call_maps(true), 0);
+  codegen = std::make_unique<ast::CodegenLLVM>(driver.root_.get(), bpftrace);
+  bpforc = codegen->compile();
+
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1_tail1"), 1U);
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1_tail2"), 1U);
+  EXPECT_EQ(bpforc->sections_.count("s_tracepoint:sched:sched_switch_1"), 1U);
+  EXPECT_EQ(bpftrace.num_probes(), 2);
+  EXPECT_EQ(bpftrace.probe_ids_.size(), 1U);
+
+  std::vector<std::pair<int, std::string>> parts = {
+    { 0, "s_kprobe:foo_1_tail1" },
+    { 1, "s_kprobe:foo_1_tail2" },
+  };
+  EXPECT_EQ(bpftrace.tail_call_sections_.size(), 1U);
+  EXPECT_EQ(bpftrace.tail_call_sections_["s_kprobe:foo_1"], parts);
+  EXPECT_EQ(bpftrace.tail_call_scratch_size_, 8U);
+
+  // The parts can't get any smaller
+  EXPECT_FALSE(bpftrace.split_large_probes(*bpforc, codegen->probe_insns()));
+}
+
+TEST(codegen, split_probe_small)
+{
+  BPFtrace bpftrace;
+  bpftrace.split_insns_ = 4096;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { $a = 1; @x = $a; @y = $a + 1 }"), 0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  auto bpforc = codegen.compile();
+
+  EXPECT_FALSE(bpftrace.split_large_probes(*bpforc, codegen.probe_insns()));
+  EXPECT_FALSE(bpftrace.maps.Has(MapManager::Type::TailCalls));
+  EXPECT_TRUE(bpftrace.tail_call_sections_.empty());
+  EXPECT_EQ(bpftrace.num_probes(), 1);
+}
+
+TEST(codegen, scratch_buffer)
+{
+  BPFtrace bpftrace;
+  bpftrace.scratch_size_ = 4096;
+  bpftrace.strlen_ = 400;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str(
+                "kprobe:foo { printf(\"%s %s\\n\", str(arg0), str(arg1)) }"
+                "kprobe:bar { @x = 1 }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  EXPECT_FALSE(bpftrace.maps.Has(MapManager::Type::Scratch));
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+  ASSERT_TRUE(codegen.needs_scratch());
+  ASSERT_EQ(semantics.create_scratch_map(true), 0);
+  codegen.optimize();
+
+  // Only the probe outgrowing the stack looks the buffer up
+  std::stringstream out;
+  codegen.DumpIR(out);
+  std::string ir = out.str();
+  size_t pos = ir.find("scratch_cond");
+  ASSERT_NE(pos, std::string::npos);
+  EXPECT_EQ(ir.find("scratch_cond", ir.find("define", pos)),
+            std::string::npos);
+
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+}
+
+TEST(codegen, scratch_buffer_unused)
+{
+  BPFtrace bpftrace;
+  bpftrace.scratch_size_ = 4096;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { @x = str(arg0) }"), 0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+
+  // Everything fits on the stack, so the buffer isn't created at all
+  EXPECT_FALSE(codegen.needs_scratch());
+  EXPECT_FALSE(bpftrace.maps.Has(MapManager::Type::Scratch));
+}
+
+TEST(codegen, packed_printf_strings)
+{
+  BPFtrace bpftrace;
+  bpftrace.scratch_size_ = 4096;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { printf(\"%s %d\\n\", comm, 1) }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+
+  // The record is built in the scratch buffer, and flagged as packed
+  ASSERT_TRUE(codegen.needs_scratch());
+  ASSERT_EQ(semantics.create_scratch_map(true), 0);
+  codegen.optimize();
+  std::stringstream out;
+  codegen.DumpIR(out);
+  std::string ir = out.str();
+  EXPECT_NE(ir.find("scratch_cond"), std::string::npos);
+  EXPECT_NE(ir.find("store i64 " + std::to_string(ASYNC_PACKED_STRINGS)),
+            std::string::npos);
+
+  // The string field holds its offset and length
+  auto &args = std::get<1>(bpftrace.printf_args_.at(0));
+  EXPECT_EQ(args.at(0).offset, 8);
+  EXPECT_EQ(args.at(1).offset, 16);
+
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+}
+
+TEST(codegen, word_strcmp)
+{
+  BPFtrace bpftrace;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo /comm == \"nginx\"/ { @a = 1 }"
+                             "kprobe:bar /str(arg0) == str(arg1)/ { @b = 1 }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+
+  // Stack strings are compared in place, without a byte by byte loop
+  std::stringstream out;
+  codegen.DumpIR(out);
+  std::string ir = out.str();
+  EXPECT_EQ(ir.find("strcmp.loop_null_cmp"), std::string::npos);
+  EXPECT_EQ(ir.find("strcmp.buf"), std::string::npos);
+  EXPECT_NE(ir.find("strcmp.decided"), std::string::npos);
+
+  codegen.optimize();
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:bar_1"), 1U);
+}
+
+TEST(codegen, adaptive_sampling)
+{
+  BPFtrace bpftrace;
+  bpftrace.adaptive_sampling_ = true;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { printf(\"%d\\n\", pid); print(comm); "
+                             "print(@x); @x = 1 }"),
+            0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+  ASSERT_TRUE(bpftrace.maps.Has(MapManager::Type::SampleRate));
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+
+  // printf() and print() of a value each pick one in `rate` records and store
+  // the rate in the upper half of the id. Printing the map isn't sampled.
+  std::stringstream out;
+  codegen.DumpIR(out);
+  std::string ir = out.str();
+  size_t pos = 0;
+  int sampled = 0;
+  while ((pos = ir.find("\nsample_emit", pos)) != std::string::npos)
+  {
+    sampled++;
+    pos++;
+  }
+  EXPECT_EQ(sampled, 2);
+  EXPECT_NE(ir.find("call i64 inttoptr (i64 7 to i64 ()*)()"),
+            std::string::npos);
+  pos = ir.find("shl i64");
+  ASSERT_NE(pos, std::string::npos);
+  EXPECT_NE(ir.find("shl i64", pos + 1), std::string::npos);
+
+  codegen.optimize();
+  auto bpforc = codegen.emit();
+  EXPECT_EQ(bpforc->sections_.count("s_kprobe:foo_1"), 1U);
+}
+
+TEST(codegen, mmapped_count)
+{
+  BPFtrace bpftrace;
+  Driver driver(bpftrace);
+
+  ASSERT_EQ(driver.parse_str("kprobe:foo { @x = count() }"), 0);
+  MockBPFfeature feature;
+  ast::SemanticAnalyser semantics(driver.root_.get(), bpftrace, feature);
+  ASSERT_EQ(semantics.analyse(), 0);
+  ASSERT_EQ(semantics.create_maps(true), 0);
+
+  // Pretend the kernel let us map the counter's array
+  uint8_t buf[8];
+  auto map = bpftrace.maps["@x"];
+  ASSERT_TRUE(map.has_value());
+  map.value()->mmap_ = buf;
+
+  ast::CodegenLLVM codegen(driver.root_.get(), bpftrace);
+  codegen.generate_ir();
+  map.value()->mmap_ = nullptr;
+
+  // Each CPU updates its own slot, MMAP_CPU_STRIDE entries apart
+  std::stringstream out;
+  codegen.DumpIR(out);
+  std::string ir = out.str();
+  EXPECT_NE(ir.find("%get_cpu_id = call i64 inttoptr (i64 8 to i64 ()*)()"),
+            std::string::npos);
+  EXPECT_NE(ir.find("mul i64 %get_cpu_id, " + std::to_string(MMAP_CPU_STRIDE)),
+            std::string::npos);
+  EXPECT_EQ(ir.find("store i64 0, i64* %\"@x_key\""), std::string::npos);
+}
+
 TEST(codegen, probe_count)
 {
   MockBPFtrace bpftrace;
@@ -0,0 +1,92 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %zeroes_key = alloca i32
+  %"@x_key" = alloca i64
+  %get_pid_tgid = call i64 inttoptr (i64 14 to i64 ()*)()
+  %1 = lshr i64 %get_pid_tgid, 32
+  %2 = icmp sge i64 %1, 5
+  br i1 %2, label %bucket_above, label %bucket_below
+
+bucket_found:                                     ; preds = %bucket_above4, %bucket_below3, %bucket_above2, %bucket_below1
+  %bucket = phi i64 [ 0, %bucket_below1 ], [ 1, %bucket_above2 ], [ 2, %bucket_below3 ], [ 3, %bucket_above4 ]
+  %3 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %3)
+  store i64 0, i64* %"@x_key"
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, i64*)*)(i64 %pseudo, i64* %"@x_key")
+  %lookup_or_init_found = icmp ne i8* %lookup_elem, null
+  br i1 %lookup_or_init_found, label %lookup_or_init_done, label %lookup_or_init_insert
+
+bucket_below:                                     ; preds = %entry
+  %4 = icmp sge i64 %1, 1
+  br i1 %4, label %bucket_above2, label %bucket_below1
+
+bucket_above:                                     ; preds = %entry
+  %5 = icmp sge i64 %1, 10
+  br i1 %5, label %bucket_above4, label %bucket_below3
+
+bucket_below1:                                    ; preds = %bucket_below
+  br label %bucket_found
+
+bucket_above2:                                    ; preds = %bucket_below
+  br label %bucket_found
+
+bucket_below3:                                    ; preds = %bucket_above
+  br label %bucket_found
+
+bucket_above4:                                    ; preds = %bucket_above
+  br label %bucket_found
+
+lookup_or_init_insert:                            ; preds = %bucket_found
+  %6 = bitcast i32* %zeroes_key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %6)
+  store i32 0, i32* %zeroes_key
+  %pseudo5 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem6 = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo5, i32* %zeroes_key)
+  %7 = bitcast i32* %zeroes_key to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %7)
+  %zeroes_found = icmp ne i8* %lookup_elem6, null
+  br i1 %zeroes_found, label %lookup_or_init_update, label %lookup_or_init_done
+
+lookup_or_init_update:                            ; preds = %lookup_or_init_insert
+  %pseudo7 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, i64*, i8*, i64)*)(i64 %pseudo7, i64* %"@x_key", i8* %lookup_elem6, i64 0)
+  %pseudo8 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem9 = call i8* inttoptr (i64 1 to i8* (i64, i64*)*)(i64 %pseudo8, i64* %"@x_key")
+  br label %lookup_or_init_done
+
+lookup_or_init_done:                              ; preds = %lookup_or_init_update, %lookup_or_init_insert, %bucket_found
+  %lookup_or_init_elem = phi i8* [ %lookup_elem, %bucket_found ], [ null, %lookup_or_init_insert ], [ %lookup_elem9, %lookup_or_init_update ]
+  %bhist_cond = icmp ne i8* %lookup_or_init_elem, null
+  br i1 %bhist_cond, label %bhist_notzero, label %bhist_done
+
+bhist_notzero:                                    ; preds = %lookup_or_init_done
+  %8 = bitcast i8* %lookup_or_init_elem to i64*
+  %9 = getelementptr i64, i64* %8, i64 %bucket
+  %10 = load i64, i64* %9
+  %11 = add i64 %10, 1
+  store i64 %11, i64* %9
+  br label %bhist_done
+
+bhist_done:                                       ; preds = %bhist_notzero, %lookup_or_init_done
+  %12 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %12)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
@@ -0,0 +1,129 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %zeroes_key = alloca i32
+  %"@x_key" = alloca i64
+  %"@x_distinct" = alloca [8 x i8]
+  %get_pid_tgid = call i64 inttoptr (i64 14 to i64 ()*)()
+  %1 = lshr i64 %get_pid_tgid, 32
+  %2 = bitcast [8 x i8]* %"@x_distinct" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %2)
+  %3 = bitcast [8 x i8]* %"@x_distinct" to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 1 %3, i8 0, i64 8, i1 false)
+  %4 = bitcast [8 x i8]* %"@x_distinct" to i64*
+  store i64 %1, i64* %4
+  %5 = bitcast [8 x i8]* %"@x_distinct" to i64*
+  %6 = getelementptr i64, i64* %5, i64 0
+  %7 = load i64, i64* %6
+  %8 = xor i64 0, %7
+  %9 = mul i64 %8, -7046029254386353131
+  %10 = bitcast [8 x i8]* %"@x_distinct" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %10)
+  %11 = lshr i64 %9, 32
+  %12 = xor i64 %9, %11
+  %13 = mul i64 %12, -7046029254386353131
+  %14 = lshr i64 %13, 29
+  %15 = xor i64 %13, %14
+  %16 = lshr i64 %15, 60
+  %17 = shl i64 %15, 4
+  %18 = or i64 %17, 8
+  %19 = lshr i64 %18, 32
+  %20 = icmp eq i64 %19, 0
+  %21 = shl i64 %18, 32
+  %22 = select i1 %20, i64 %21, i64 %18
+  %23 = select i1 %20, i64 32, i64 0
+  %24 = lshr i64 %22, 48
+  %25 = icmp eq i64 %24, 0
+  %26 = shl i64 %22, 16
+  %27 = select i1 %25, i64 %26, i64 %22
+  %28 = add i64 %23, 16
+  %29 = select i1 %25, i64 %28, i64 %23
+  %30 = lshr i64 %27, 56
+  %31 = icmp eq i64 %30, 0
+  %32 = shl i64 %27, 8
+  %33 = select i1 %31, i64 %32, i64 %27
+  %34 = add i64 %29, 8
+  %35 = select i1 %31, i64 %34, i64 %29
+  %36 = lshr i64 %33, 60
+  %37 = icmp eq i64 %36, 0
+  %38 = shl i64 %33, 4
+  %39 = select i1 %37, i64 %38, i64 %33
+  %40 = add i64 %35, 4
+  %41 = select i1 %37, i64 %40, i64 %35
+  %42 = lshr i64 %39, 62
+  %43 = icmp eq i64 %42, 0
+  %44 = shl i64 %39, 2
+  %45 = select i1 %43, i64 %44, i64 %39
+  %46 = add i64 %41, 2
+  %47 = select i1 %43, i64 %46, i64 %41
+  %48 = lshr i64 %45, 63
+  %49 = icmp eq i64 %48, 0
+  %50 = shl i64 %45, 1
+  %51 = select i1 %49, i64 %50, i64 %45
+  %52 = add i64 %47, 1
+  %53 = select i1 %49, i64 %52, i64 %47
+  %54 = add i64 %53, 1
+  %55 = trunc i64 %54 to i8
+  %56 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %56)
+  store i64 0, i64* %"@x_key"
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, i64*)*)(i64 %pseudo, i64* %"@x_key")
+  %lookup_or_init_found = icmp ne i8* %lookup_elem, null
+  br i1 %lookup_or_init_found, label %lookup_or_init_done, label %lookup_or_init_insert
+
+lookup_or_init_insert:                            ; preds = %entry
+  %57 = bitcast i32* %zeroes_key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %57)
+  store i32 0, i32* %zeroes_key
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem2 = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo1, i32* %zeroes_key)
+  %58 = bitcast i32* %zeroes_key to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %58)
+  %zeroes_found = icmp ne i8* %lookup_elem2, null
+  br i1 %zeroes_found, label %lookup_or_init_update, label %lookup_or_init_done
+
+lookup_or_init_update:                            ; preds = %lookup_or_init_insert
+  %pseudo3 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, i64*, i8*, i64)*)(i64 %pseudo3, i64* %"@x_key", i8* %lookup_elem2, i64 0)
+  %pseudo4 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem5 = call i8* inttoptr (i64 1 to i8* (i64, i64*)*)(i64 %pseudo4, i64* %"@x_key")
+  br label %lookup_or_init_done
+
+lookup_or_init_done:                              ; preds = %lookup_or_init_update, %lookup_or_init_insert, %entry
+  %lookup_or_init_elem = phi i8* [ %lookup_elem, %entry ], [ null, %lookup_or_init_insert ], [ %lookup_elem5, %lookup_or_init_update ]
+  %distinct_cond = icmp ne i8* %lookup_or_init_elem, null
+  br i1 %distinct_cond, label %distinct_notzero, label %distinct_done
+
+distinct_notzero:                                 ; preds = %lookup_or_init_done
+  %59 = getelementptr i8, i8* %lookup_or_init_elem, i64 %16
+  %60 = load i8, i8* %59
+  %61 = icmp ugt i8 %55, %60
+  %62 = select i1 %61, i8 %55, i8 %60
+  store i8 %62, i8* %59
+  br label %distinct_done
+
+distinct_done:                                    ; preds = %distinct_notzero, %lookup_or_init_done
+  %63 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %63)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
@@ -51,8 +51,8 @@ lookup_merge:                                     ; preds = %lookup_failure, %lo
   ret i64 0
 }
 
-; Function Attrs: alwaysinline
-define internal i64 @log2(i64) #1 section "helpers" {
+; Function Attrs: noinline
+define internal i64 @log2(i64) #1 section "s_kprobe:f_1" {
 entry:
   %1 = alloca i64
   %2 = alloca i64
@@ -138,5 +138,5 @@ declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #2
 declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #2
 
 attributes #0 = { nounwind }
-attributes #1 = { alwaysinline }
+attributes #1 = { noinline }
 attributes #2 = { argmemonly nounwind }
@@ -53,8 +53,8 @@ lookup_merge:                                     ; preds = %lookup_failure, %lo
   ret i64 0
 }
 
-; Function Attrs: alwaysinline
-define internal i64 @linear(i64, i64, i64, i64) #1 section "helpers" {
+; Function Attrs: noinline
+define internal i64 @linear(i64, i64, i64, i64) #1 section "s_kprobe:f_1" {
 entry:
   %4 = alloca i64
   %5 = alloca i64
@@ -119,5 +119,5 @@ declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #2
 declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #2
 
 attributes #0 = { nounwind }
-attributes #1 = { alwaysinline }
+attributes #1 = { noinline }
 attributes #2 = { argmemonly nounwind }
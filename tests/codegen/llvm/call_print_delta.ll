@@ -0,0 +1,58 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+%print_t = type <{ i64, i32, i32, i32 }>
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @BEGIN(i8*) section "s_BEGIN_1" {
+entry:
+  %"@x_val" = alloca i64
+  %"@x_key" = alloca i64
+  %1 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %1)
+  store i64 0, i64* %"@x_key"
+  %2 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %2)
+  store i64 1, i64* %"@x_val"
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, i64*, i64*, i64)*)(i64 %pseudo, i64* %"@x_key", i64* %"@x_val", i64 0)
+  %3 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %3)
+  %4 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %4)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %"print_@x" = alloca %print_t
+  %1 = bitcast %print_t* %"print_@x" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %1)
+  %2 = getelementptr %print_t, %print_t* %"print_@x", i64 0, i32 0
+  store i64 30009, i64* %2
+  %3 = getelementptr %print_t, %print_t* %"print_@x", i64 0, i32 1
+  store i32 0, i32* %3
+  %4 = getelementptr %print_t, %print_t* %"print_@x", i64 0, i32 2
+  store i32 0, i32* %4
+  %5 = getelementptr %print_t, %print_t* %"print_@x", i64 0, i32 3
+  store i32 0, i32* %5
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %get_cpu_id = call i64 inttoptr (i64 8 to i64 ()*)()
+  %perf_event_output = call i64 inttoptr (i64 25 to i64 (i8*, i64, i64, %print_t*, i64)*)(i8* %0, i64 %pseudo, i64 %get_cpu_id, %print_t* %"print_@x", i64 20)
+  %6 = bitcast %print_t* %"print_@x" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %6)
+  ret i64 0
+}
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
@@ -0,0 +1,112 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64
+  %lookup_elem_val = alloca i64
+  %"@x_key" = alloca i64
+  %get_pid_tgid = call i64 inttoptr (i64 14 to i64 ()*)()
+  %1 = lshr i64 %get_pid_tgid, 32
+  %qhist = call i64 @qhist(i64 %1, i64 2)
+  %2 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %2)
+  store i64 %qhist, i64* %"@x_key"
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, i64*)*)(i64 %pseudo, i64* %"@x_key")
+  %3 = bitcast i64* %lookup_elem_val to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %3)
+  %map_lookup_cond = icmp ne i8* %lookup_elem, null
+  br i1 %map_lookup_cond, label %lookup_success, label %lookup_failure
+
+lookup_success:                                   ; preds = %entry
+  %cast = bitcast i8* %lookup_elem to i64*
+  %4 = load i64, i64* %cast
+  store i64 %4, i64* %lookup_elem_val
+  br label %lookup_merge
+
+lookup_failure:                                   ; preds = %entry
+  store i64 0, i64* %lookup_elem_val
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %lookup_failure, %lookup_success
+  %5 = load i64, i64* %lookup_elem_val
+  %6 = bitcast i64* %lookup_elem_val to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %6)
+  %7 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %7)
+  %8 = add i64 %5, 1
+  store i64 %8, i64* %"@x_val"
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, i64*, i64*, i64)*)(i64 %pseudo1, i64* %"@x_key", i64* %"@x_val", i64 0)
+  %9 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %9)
+  %10 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %10)
+  ret i64 0
+}
+
+; Function Attrs: noinline
+define internal i64 @qhist(i64 %0, i64 %1) #1 section "s_kprobe:f_1" {
+entry:
+  %2 = icmp slt i64 %0, 0
+  %3 = select i1 %2, i64 0, i64 %0
+  %4 = icmp uge i64 %3, 4294967296
+  %5 = zext i1 %4 to i64
+  %6 = shl i64 %5, 5
+  %7 = lshr i64 %3, %6
+  %8 = add i64 0, %6
+  %9 = icmp uge i64 %7, 65536
+  %10 = zext i1 %9 to i64
+  %11 = shl i64 %10, 4
+  %12 = lshr i64 %7, %11
+  %13 = add i64 %8, %11
+  %14 = icmp uge i64 %12, 256
+  %15 = zext i1 %14 to i64
+  %16 = shl i64 %15, 3
+  %17 = lshr i64 %12, %16
+  %18 = add i64 %13, %16
+  %19 = icmp uge i64 %17, 16
+  %20 = zext i1 %19 to i64
+  %21 = shl i64 %20, 2
+  %22 = lshr i64 %17, %21
+  %23 = add i64 %18, %21
+  %24 = icmp uge i64 %22, 4
+  %25 = zext i1 %24 to i64
+  %26 = shl i64 %25, 1
+  %27 = lshr i64 %22, %26
+  %28 = add i64 %23, %26
+  %29 = icmp uge i64 %27, 2
+  %30 = zext i1 %29 to i64
+  %31 = shl i64 %30, 0
+  %32 = lshr i64 %27, %31
+  %33 = add i64 %28, %31
+  %34 = shl i64 1, %1
+  %35 = icmp ult i64 %3, %34
+  %36 = sub i64 %33, %1
+  %37 = select i1 %35, i64 0, i64 %36
+  %38 = shl i64 1, %1
+  %39 = sub i64 %38, 1
+  %40 = lshr i64 %3, %37
+  %41 = and i64 %40, %39
+  %42 = add i64 %37, 1
+  %43 = shl i64 %42, %1
+  %44 = add i64 %43, %41
+  %45 = select i1 %35, i64 %3, i64 %44
+  ret i64 %45
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #2
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #2
+
+attributes #0 = { nounwind }
+attributes #1 = { noinline }
+attributes #2 = { argmemonly nounwind }
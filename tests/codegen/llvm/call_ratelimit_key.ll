@@ -0,0 +1,105 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64
+  %"@x_key" = alloca i64
+  %ratelimit_init = alloca i64
+  %ratelimit_key = alloca [16 x i8]
+  %ratelimit_result = alloca i64
+  %1 = bitcast i64* %ratelimit_result to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %1)
+  store i64 0, i64* %ratelimit_result
+  %get_pid_tgid = call i64 inttoptr (i64 14 to i64 ()*)()
+  %2 = lshr i64 %get_pid_tgid, 32
+  %3 = bitcast [16 x i8]* %ratelimit_key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %3)
+  %4 = bitcast [16 x i8]* %ratelimit_key to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 1 %4, i8 0, i64 16, i1 false)
+  %5 = bitcast [16 x i8]* %ratelimit_key to i64*
+  store i64 0, i64* %5
+  %6 = getelementptr [16 x i8], [16 x i8]* %ratelimit_key, i64 0, i64 8
+  %7 = bitcast i8* %6 to i64*
+  store i64 %2, i64* %7
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, [16 x i8]*)*)(i64 %pseudo, [16 x i8]* %ratelimit_key)
+  %ratelimit_key_found = icmp ne i8* %lookup_elem, null
+  br i1 %ratelimit_key_found, label %ratelimit_found, label %ratelimit_insert
+
+pred_false:                                       ; preds = %ratelimit_done
+  ret i64 0
+
+pred_true:                                        ; preds = %ratelimit_done
+  %8 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %8)
+  store i64 0, i64* %"@x_key"
+  %9 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %9)
+  store i64 1, i64* %"@x_val"
+  %pseudo4 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem5 = call i64 inttoptr (i64 2 to i64 (i64, i64*, i64*, i64)*)(i64 %pseudo4, i64* %"@x_key", i64* %"@x_val", i64 0)
+  %10 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %10)
+  %11 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %11)
+  ret i64 0
+
+ratelimit_insert:                                 ; preds = %entry
+  %12 = bitcast i64* %ratelimit_init to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %12)
+  store i64 0, i64* %ratelimit_init
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, [16 x i8]*, i64*, i64)*)(i64 %pseudo1, [16 x i8]* %ratelimit_key, i64* %ratelimit_init, i64 0)
+  %13 = bitcast i64* %ratelimit_init to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %13)
+  %pseudo2 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem3 = call i8* inttoptr (i64 1 to i8* (i64, [16 x i8]*)*)(i64 %pseudo2, [16 x i8]* %ratelimit_key)
+  br label %ratelimit_found
+
+ratelimit_found:                                  ; preds = %ratelimit_insert, %entry
+  %ratelimit_state = phi i8* [ %lookup_elem, %entry ], [ %lookup_elem3, %ratelimit_insert ]
+  %14 = bitcast [16 x i8]* %ratelimit_key to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %14)
+  %ratelimit_cond = icmp ne i8* %ratelimit_state, null
+  br i1 %ratelimit_cond, label %ratelimit_notzero, label %ratelimit_done
+
+ratelimit_notzero:                                ; preds = %ratelimit_found
+  %15 = bitcast i8* %ratelimit_state to i64*
+  %16 = load i64, i64* %15
+  %get_ns = call i64 inttoptr (i64 5 to i64 ()*)()
+  %17 = add i64 %get_ns, 900000000
+  %18 = icmp ule i64 %16, %17
+  %19 = icmp ugt i64 %16, %get_ns
+  %20 = select i1 %19, i64 %16, i64 %get_ns
+  %21 = add i64 %20, 100000000
+  %22 = select i1 %18, i64 %21, i64 %16
+  store i64 %22, i64* %15
+  %23 = zext i1 %18 to i64
+  store i64 %23, i64* %ratelimit_result
+  br label %ratelimit_done
+
+ratelimit_done:                                   ; preds = %ratelimit_notzero, %ratelimit_found
+  %24 = load i64, i64* %ratelimit_result
+  %25 = bitcast i64* %ratelimit_result to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %25)
+  %predcond = icmp eq i64 %24, 0
+  br i1 %predcond, label %pred_false, label %pred_true
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
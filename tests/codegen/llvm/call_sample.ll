@@ -0,0 +1,70 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %"@x_val" = alloca i64
+  %"@x_key" = alloca i64
+  %key = alloca i32
+  %sample_result = alloca i64
+  %1 = bitcast i64* %sample_result to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %1)
+  store i64 0, i64* %sample_result
+  %2 = bitcast i32* %key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %2)
+  store i32 0, i32* %key
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo, i32* %key)
+  %sample_cond = icmp ne i8* %lookup_elem, null
+  br i1 %sample_cond, label %sample_notzero, label %sample_done
+
+pred_false:                                       ; preds = %sample_done
+  ret i64 0
+
+pred_true:                                        ; preds = %sample_done
+  %3 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %3)
+  store i64 0, i64* %"@x_key"
+  %4 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %4)
+  store i64 1, i64* %"@x_val"
+  %pseudo1 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, i64*, i64*, i64)*)(i64 %pseudo1, i64* %"@x_key", i64* %"@x_val", i64 0)
+  %5 = bitcast i64* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %5)
+  %6 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %6)
+  ret i64 0
+
+sample_notzero:                                   ; preds = %entry
+  %7 = bitcast i8* %lookup_elem to i64*
+  %8 = load i64, i64* %7
+  %9 = add i64 %8, 1
+  %10 = icmp uge i64 %9, 10
+  %11 = select i1 %10, i64 0, i64 %9
+  store i64 %11, i64* %7
+  %12 = zext i1 %10 to i64
+  store i64 %12, i64* %sample_result
+  br label %sample_done
+
+sample_done:                                      ; preds = %sample_notzero, %entry
+  %13 = load i64, i64* %sample_result
+  %14 = bitcast i64* %sample_result to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %14)
+  %predcond = icmp eq i64 %13, 0
+  br i1 %predcond, label %pred_false, label %pred_true
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
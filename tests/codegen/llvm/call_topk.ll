@@ -0,0 +1,170 @@
+; ModuleID = 'bpftrace'
+source_filename = "bpftrace"
+target datalayout = "e-m:e-p:64:64-i64:64-n32:64-S128"
+target triple = "bpf-pc-linux"
+
+; Function Attrs: nounwind
+declare i64 @llvm.bpf.pseudo(i64, i64) #0
+
+define i64 @"kprobe:f"(i8*) section "s_kprobe:f_1" {
+entry:
+  %lookup_elem_val = alloca i64
+  %"@x_val" = alloca i64
+  %sketch_key13 = alloca i32
+  %sketch_key7 = alloca i32
+  %sketch_key1 = alloca i32
+  %sketch_key = alloca i32
+  %"@x_key" = alloca [8 x i8]
+  %get_pid_tgid = call i64 inttoptr (i64 14 to i64 ()*)()
+  %1 = lshr i64 %get_pid_tgid, 32
+  %2 = bitcast [8 x i8]* %"@x_key" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %2)
+  %3 = bitcast [8 x i8]* %"@x_key" to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 1 %3, i8 0, i64 8, i1 false)
+  %4 = bitcast [8 x i8]* %"@x_key" to i64*
+  store i64 %1, i64* %4
+  %5 = bitcast [8 x i8]* %"@x_key" to i64*
+  %6 = getelementptr i64, i64* %5, i64 0
+  %7 = load i64, i64* %6
+  %8 = xor i64 0, %7
+  %9 = mul i64 %8, -7046029254386353131
+  %10 = xor i64 %9, 2685821657736338717
+  %11 = mul i64 %10, -7046029254386353131
+  %12 = lshr i64 %11, 53
+  %13 = bitcast i32* %sketch_key to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %13)
+  store i32 0, i32* %sketch_key
+  %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo, i32* %sketch_key)
+  %14 = bitcast i32* %sketch_key to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %14)
+  %sketch_cond = icmp ne i8* %lookup_elem, null
+  br i1 %sketch_cond, label %sketch_notzero, label %sketch_done
+
+sketch_notzero:                                   ; preds = %entry
+  %15 = bitcast i8* %lookup_elem to i64*
+  %16 = getelementptr i64, i64* %15, i64 %12
+  %17 = load i64, i64* %16
+  %18 = add i64 %17, 1
+  store i64 %18, i64* %16
+  br label %sketch_done
+
+sketch_done:                                      ; preds = %sketch_notzero, %entry
+  %19 = xor i64 %9, -6939452855193903323
+  %20 = mul i64 %19, -7046029254386353131
+  %21 = lshr i64 %20, 53
+  %22 = bitcast i32* %sketch_key1 to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %22)
+  store i32 1, i32* %sketch_key1
+  %pseudo2 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem3 = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo2, i32* %sketch_key1)
+  %23 = bitcast i32* %sketch_key1 to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %23)
+  %sketch_cond6 = icmp ne i8* %lookup_elem3, null
+  br i1 %sketch_cond6, label %sketch_notzero4, label %sketch_done5
+
+sketch_notzero4:                                  ; preds = %sketch_done
+  %24 = bitcast i8* %lookup_elem3 to i64*
+  %25 = getelementptr i64, i64* %24, i64 %21
+  %26 = load i64, i64* %25
+  %27 = add i64 %26, 1
+  store i64 %27, i64* %25
+  br label %sketch_done5
+
+sketch_done5:                                     ; preds = %sketch_notzero4, %sketch_done
+  %28 = xor i64 %9, -4417276706812531889
+  %29 = mul i64 %28, -7046029254386353131
+  %30 = lshr i64 %29, 53
+  %31 = bitcast i32* %sketch_key7 to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %31)
+  store i32 2, i32* %sketch_key7
+  %pseudo8 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem9 = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo8, i32* %sketch_key7)
+  %32 = bitcast i32* %sketch_key7 to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %32)
+  %sketch_cond12 = icmp ne i8* %lookup_elem9, null
+  br i1 %sketch_cond12, label %sketch_notzero10, label %sketch_done11
+
+sketch_notzero10:                                 ; preds = %sketch_done5
+  %33 = bitcast i8* %lookup_elem9 to i64*
+  %34 = getelementptr i64, i64* %33, i64 %30
+  %35 = load i64, i64* %34
+  %36 = add i64 %35, 1
+  store i64 %36, i64* %34
+  br label %sketch_done11
+
+sketch_done11:                                    ; preds = %sketch_notzero10, %sketch_done5
+  %37 = xor i64 %9, 1609587929392839161
+  %38 = mul i64 %37, -7046029254386353131
+  %39 = lshr i64 %38, 53
+  %40 = bitcast i32* %sketch_key13 to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %40)
+  store i32 3, i32* %sketch_key13
+  %pseudo14 = call i64 @llvm.bpf.pseudo(i64 1, i64 2)
+  %lookup_elem15 = call i8* inttoptr (i64 1 to i8* (i64, i32*)*)(i64 %pseudo14, i32* %sketch_key13)
+  %41 = bitcast i32* %sketch_key13 to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %41)
+  %sketch_cond18 = icmp ne i8* %lookup_elem15, null
+  br i1 %sketch_cond18, label %sketch_notzero16, label %sketch_done17
+
+sketch_notzero16:                                 ; preds = %sketch_done11
+  %42 = bitcast i8* %lookup_elem15 to i64*
+  %43 = getelementptr i64, i64* %42, i64 %39
+  %44 = load i64, i64* %43
+  %45 = add i64 %44, 1
+  store i64 %45, i64* %43
+  br label %sketch_done17
+
+sketch_done17:                                    ; preds = %sketch_notzero16, %sketch_done11
+  %46 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %46)
+  store i64 0, i64* %"@x_val"
+  %pseudo19 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %lookup_elem20 = call i8* inttoptr (i64 1 to i8* (i64, [8 x i8]*)*)(i64 %pseudo19, [8 x i8]* %"@x_key")
+  %47 = bitcast i64* %lookup_elem_val to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %47)
+  %map_lookup_cond = icmp ne i8* %lookup_elem20, null
+  br i1 %map_lookup_cond, label %lookup_success, label %lookup_failure
+
+lookup_success:                                   ; preds = %sketch_done17
+  %cast = bitcast i8* %lookup_elem20 to i64*
+  %48 = load i64, i64* %cast
+  store i64 %48, i64* %lookup_elem_val
+  br label %lookup_merge
+
+lookup_failure:                                   ; preds = %sketch_done17
+  store i64 0, i64* %lookup_elem_val
+  br label %lookup_merge
+
+lookup_merge:                                     ; preds = %lookup_failure, %lookup_success
+  %49 = load i64, i64* %lookup_elem_val
+  %50 = bitcast i64* %lookup_elem_val to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %50)
+  %51 = icmp eq i64 %49, 0
+  br i1 %51, label %topk_insert, label %topk_done
+
+topk_insert:                                      ; preds = %lookup_merge
+  store i64 1, i64* %"@x_val"
+  %pseudo21 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, [8 x i8]*, i64*, i64)*)(i64 %pseudo21, [8 x i8]* %"@x_key", i64* %"@x_val", i64 0)
+  br label %topk_done
+
+topk_done:                                        ; preds = %topk_insert, %lookup_merge
+  %52 = bitcast [8 x i8]* %"@x_key" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %52)
+  %53 = bitcast i64* %"@x_val" to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %53)
+  ret i64 0
+}
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.start.p0i8(i64, i8* nocapture) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1) #1
+
+; Function Attrs: argmemonly nounwind
+declare void @llvm.lifetime.end.p0i8(i64, i8* nocapture) #1
+
+attributes #0 = { nounwind }
+attributes #1 = { argmemonly nounwind }
@@ -10,58 +10,43 @@ define i64 @"kretprobe:vfs_read"(i8*) section "s_kretprobe:vfs_read_1" {
 entry:
   %"@_val" = alloca i64
   %lookup_elem_val = alloca i64
-  %comm3 = alloca [16 x i8]
-  %strcmp.result = alloca i1
+  %comm1 = alloca [16 x i8]
   %comm = alloca [16 x i8]
   %1 = bitcast [16 x i8]* %comm to i8*
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* %1)
   %2 = bitcast [16 x i8]* %comm to i8*
   call void @llvm.memset.p0i8.i64(i8* align 1 %2, i8 0, i64 16, i1 false)
   %get_comm = call i64 inttoptr (i64 16 to i64 ([16 x i8]*, i64)*)([16 x i8]* %comm, i64 16)
-  %3 = bitcast i1* %strcmp.result to i8*
-  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %3)
-  store i1 true, i1* %strcmp.result
-  %4 = getelementptr [16 x i8], [16 x i8]* %comm, i32 0, i32 0
-  %5 = load i8, i8* %4
-  %strcmp.cmp = icmp ne i8 %5, 115
-  br i1 %strcmp.cmp, label %strcmp.false, label %strcmp.loop
+  %3 = bitcast [16 x i8]* %comm to i8*
+  %4 = getelementptr i8, i8* %3, i64 0
+  %5 = bitcast i8* %4 to i16*
+  %6 = load i16, i16* %5
+  %7 = xor i16 %6, 29555
+  %8 = zext i16 %7 to i64
+  %strcmp.cmp = icmp ne i64 %8, 0
+  %9 = xor i1 %strcmp.cmp, false
+  %10 = zext i1 %9 to i64
+  %11 = bitcast [16 x i8]* %comm to i8*
+  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %11)
+  %predcond = icmp eq i64 %10, 0
+  br i1 %predcond, label %pred_false, label %pred_true
 
-pred_false:                                       ; preds = %strcmp.false
+pred_false:                                       ; preds = %entry
   ret i64 0
 
-pred_true:                                        ; preds = %strcmp.false
-  %6 = bitcast [16 x i8]* %comm3 to i8*
-  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %6)
-  %7 = bitcast [16 x i8]* %comm3 to i8*
-  call void @llvm.memset.p0i8.i64(i8* align 1 %7, i8 0, i64 16, i1 false)
-  %get_comm4 = call i64 inttoptr (i64 16 to i64 ([16 x i8]*, i64)*)([16 x i8]* %comm3, i64 16)
+pred_true:                                        ; preds = %entry
+  %12 = bitcast [16 x i8]* %comm1 to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %12)
+  %13 = bitcast [16 x i8]* %comm1 to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 1 %13, i8 0, i64 16, i1 false)
+  %get_comm2 = call i64 inttoptr (i64 16 to i64 ([16 x i8]*, i64)*)([16 x i8]* %comm1, i64 16)
   %pseudo = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, [16 x i8]*)*)(i64 %pseudo, [16 x i8]* %comm3)
-  %8 = bitcast i64* %lookup_elem_val to i8*
-  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %8)
+  %lookup_elem = call i8* inttoptr (i64 1 to i8* (i64, [16 x i8]*)*)(i64 %pseudo, [16 x i8]* %comm1)
+  %14 = bitcast i64* %lookup_elem_val to i8*
+  call void @llvm.lifetime.start.p0i8(i64 -1, i8* %14)
   %map_lookup_cond = icmp ne i8* %lookup_elem, null
   br i1 %map_lookup_cond, label %lookup_success, label %lookup_failure
 
-strcmp.false:                                     ; preds = %strcmp.loop1, %strcmp.loop, %entry
-  %9 = load i1, i1* %strcmp.result
-  %10 = bitcast i1* %strcmp.result to i8*
-  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %10)
-  %11 = zext i1 %9 to i64
-  %12 = bitcast [16 x i8]* %comm to i8*
-  call void @llvm.lifetime.end.p0i8(i64 -1, i8* %12)
-  %predcond = icmp eq i64 %11, 0
-  br i1 %predcond, label %pred_false, label %pred_true
-
-strcmp.loop:                                      ; preds = %entry
-  %13 = getelementptr [16 x i8], [16 x i8]* %comm, i32 0, i32 1
-  %14 = load i8, i8* %13
-  %strcmp.cmp2 = icmp ne i8 %14, 115
-  br i1 %strcmp.cmp2, label %strcmp.false, label %strcmp.loop1
-
-strcmp.loop1:                                     ; preds = %strcmp.loop
-  store i1 false, i1* %strcmp.result
-  br label %strcmp.false
-
 lookup_success:                                   ; preds = %pred_true
   %cast = bitcast i8* %lookup_elem to i64*
   %15 = load i64, i64* %cast
@@ -80,9 +65,9 @@ lookup_merge:                                     ; preds = %lookup_failure, %lo
   call void @llvm.lifetime.start.p0i8(i64 -1, i8* %18)
   %19 = add i64 %16, 1
   store i64 %19, i64* %"@_val"
-  %pseudo5 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
-  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, [16 x i8]*, i64*, i64)*)(i64 %pseudo5, [16 x i8]* %comm3, i64* %"@_val", i64 0)
-  %20 = bitcast [16 x i8]* %comm3 to i8*
+  %pseudo3 = call i64 @llvm.bpf.pseudo(i64 1, i64 1)
+  %update_elem = call i64 inttoptr (i64 2 to i64 (i64, [16 x i8]*, i64*, i64)*)(i64 %pseudo3, [16 x i8]* %comm1, i64* %"@_val", i64 0)
+  %20 = bitcast [16 x i8]* %comm1 to i8*
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* %20)
   %21 = bitcast i64* %"@_val" to i8*
   call void @llvm.lifetime.end.p0i8(i64 -1, i8* %21)
@@ -1,3 +1,5 @@
+#include <cstdlib>
+
 #include "gtest/gtest.h"
 
 class ThrowListener : public testing::EmptyTestEventListener
@@ -15,5 +17,7 @@ int main(int argc, char *argv[])
 {
   ::testing::InitGoogleTest(&argc, argv);
   ::testing::UnitTest::GetInstance()->listeners().Append(new ThrowListener);
+  // Tests shouldn't depend on, or leave behind, what's cached by other runs
+  setenv("BPFTRACE_CACHE_DIR", "", 1);
   return RUN_ALL_TESTS();
 }
@@ -0,0 +1,175 @@
+#include <sstream>
+
+#include "gtest/gtest.h"
+#include "driver.h"
+#include "optimiser.h"
+#include "printer.h"
+
+namespace bpftrace {
+namespace test {
+namespace optimiser {
+
+using Printer = ast::Printer;
+
+void test(BPFtrace &bpftrace,
+          const std::string &input,
+          const std::string &output)
+{
+  Driver driver(bpftrace);
+  ASSERT_EQ(driver.parse_str(input), 0);
+
+  ast::Optimiser optimiser(driver.root_.get(), bpftrace);
+  optimiser.optimise();
+
+  std::ostringstream out;
+  Printer printer(out);
+  driver.root_->accept(printer);
+  EXPECT_EQ(output, out.str());
+}
+
+void test(const std::string &input, const std::string &output)
+{
+  BPFtrace bpftrace;
+  test(bpftrace, input, output);
+}
+
+TEST(optimiser, fold_binop)
+{
+  test("kprobe:f { @x = 1 + 2 * 3 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 7\n");
+  test("kprobe:f { @x = (1 << 4) | 3 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 19\n");
+  test("kprobe:f { @x = 3 > 2 && 0 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 0\n");
+  test("kprobe:f { @x = pid + 1 * 2 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   +\n    builtin: pid\n    int: "
+       "2\n");
+}
+
+TEST(optimiser, no_fold_unsafe)
+{
+  // Division by zero is left for the semantic analyser to report
+  test("kprobe:f { @x = 1 / 0 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   /\n    int: 1\n    int: 0\n");
+  test("kprobe:f { @x = 1 << 64 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   <<\n    int: 1\n    int: "
+       "64\n");
+}
+
+TEST(optimiser, fold_unop_ternary)
+{
+  test("kprobe:f { @x = !0 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 1\n");
+  test("kprobe:f { @x = 1 ? pid : tid }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   builtin: pid\n");
+}
+
+TEST(optimiser, positional_parameters)
+{
+  BPFtrace bpftrace;
+  bpftrace.add_param("10");
+  bpftrace.add_param("foo");
+  test(bpftrace,
+       "kprobe:f { @x = $1 * 2; @y = $# }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 20\n  =\n   map: @y\n"
+       "   int: 2\n");
+  test(bpftrace,
+       "kprobe:f { if (str($2) == \"foo\") { @x = 1 } }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 1\n");
+}
+
+TEST(optimiser, invalid_positional_parameters)
+{
+  // Left for the semantic analyser to report
+  BPFtrace bpftrace;
+  bpftrace.add_param("foo");
+  test(bpftrace,
+       "kprobe:f { @x = $0 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   param: $0\n");
+  test(bpftrace,
+       "kprobe:f { if (str($0) == \"foo\") { @x = 1 } }",
+       "Program\n kprobe:f\n  pred\n   ==\n    call: str\n     param: $0\n "
+       "   string: foo\n  =\n   map: @x\n   int: 1\n");
+}
+
+TEST(optimiser, missing_positional_parameters)
+{
+  // Parameters which weren't given are 0 or an empty string
+  BPFtrace bpftrace;
+  bpftrace.add_param("foo");
+  test(bpftrace,
+       "kprobe:f { @y = $2 + 1 }",
+       "Program\n kprobe:f\n  =\n   map: @y\n   int: 1\n");
+  test(bpftrace,
+       "kprobe:f { if (str($2) == \"\") { @x = 1 } }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 1\n");
+}
+
+TEST(optimiser, dead_branches)
+{
+  test("kprobe:f { if (0) { @x = 1 } else { @y = 2 } }",
+       "Program\n kprobe:f\n  =\n   map: @y\n   int: 2\n");
+  test("kprobe:f { if (1 == 2) { @x = 1 } }", "Program\n kprobe:f\n");
+  test("kprobe:f { while (0) { @x = 1 } }", "Program\n kprobe:f\n");
+  test("kprobe:f { @x = 1; return; @y = 2 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 1\n  return\n");
+}
+
+TEST(optimiser, unused_variables)
+{
+  test("kprobe:f { $x = 1; $y = $x; @z = 2 }",
+       "Program\n kprobe:f\n  =\n   map: @z\n   int: 2\n");
+  // The call could have side effects
+  test("kprobe:f { $x = printf(\"hi\") }",
+       "Program\n kprobe:f\n  =\n   variable: $x\n   call: printf\n    "
+       "string: hi\n");
+  test("kprobe:f { $x = 1; @y = $x }",
+       "Program\n kprobe:f\n  =\n   variable: $x\n   int: 1\n  =\n   map: "
+       "@y\n   variable: $x\n");
+}
+
+TEST(optimiser, predicates)
+{
+  test("kprobe:f /1 + 1/ { @x = 1 }",
+       "Program\n kprobe:f\n  =\n   map: @x\n   int: 1\n");
+  test("kprobe:f /0/ { @x = 1 } kprobe:g { @y = 1 }",
+       "Program\n kprobe:g\n  =\n   map: @y\n   int: 1\n");
+  // The only probe is kept
+  test("kprobe:f /0/ { @x = 1 }",
+       "Program\n kprobe:f\n  pred\n   int: 0\n  =\n   map: @x\n   int: 1\n");
+}
+
+TEST(optimiser, reorder_conditions)
+{
+  test("kprobe:f /str(arg0) == \"x\" && pid == 123/ { @x = 1 }",
+       "Program\n kprobe:f\n  pred\n   &&\n    ==\n     builtin: pid\n     "
+       "int: 123\n    ==\n     call: str\n      builtin: arg0\n     string: "
+       "x\n  =\n   map: @x\n   int: 1\n");
+  // Side effects keep their order
+  test("kprobe:f /@x++ && pid/ { @y = 1 }",
+       "Program\n kprobe:f\n  pred\n   &&\n    map: @x\n     ++\n    "
+       "builtin: pid\n  =\n   map: @y\n   int: 1\n");
+}
+
+TEST(optimiser, hoist_conditions)
+{
+  test("kprobe:f /str(arg0) == \"x\"/ { if (pid == 1) { @x = 1 } }",
+       "Program\n kprobe:f\n  pred\n   &&\n    ==\n     builtin: pid\n     "
+       "int: 1\n    ==\n     call: str\n      builtin: arg0\n     string: "
+       "x\n  =\n   map: @x\n   int: 1\n");
+  test("kprobe:f { $s = kstack; if (pid == 1) { @[$s] = count() } }",
+       "Program\n kprobe:f\n  pred\n   ==\n    builtin: pid\n    int: 1\n  "
+       "=\n   variable: $s\n   builtin: kstack\n  =\n   map: @\n    "
+       "variable: $s\n   call: count\n");
+  // $s is needed outside of the if
+  test("kprobe:f { $s = kstack; if (pid == 1) { @a[$s] = count() } @b[$s] = "
+       "count() }",
+       "Program\n kprobe:f\n  =\n   variable: $s\n   builtin: kstack\n  "
+       "if\n   ==\n    builtin: pid\n    int: 1\n   then\n    =\n     map: "
+       "@a\n      variable: $s\n     call: count\n  =\n   map: @b\n    "
+       "variable: $s\n   call: count\n");
+}
+
+} // namespace optimiser
+} // namespace test
+} // namespace bpftrace
@@ -65,6 +65,26 @@ TEST(probe, short_name)
   compare_bytecode("interval:s:1 { 1 }", "i:s:1 { 1 }");
 }
 
+TEST(probe, verifier_stats)
+{
+  ProgStats stats;
+  AttachedProbe::parse_verifier_stats(
+      "func#0 @0\n"
+      "0: (bf) r6 = r1\n"
+      "verification time 28 usec\n"
+      "stack depth 24+8\n"
+      "processed 17 insns (limit 1000000) max_states_per_insn 0 "
+      "total_states 1 peak_states 1 mark_read 1\n",
+      stats);
+  EXPECT_EQ(stats.verified_insns, 17UL);
+  EXPECT_EQ(stats.stack_depth, 32UL);
+
+  ProgStats none;
+  AttachedProbe::parse_verifier_stats("", none);
+  EXPECT_EQ(none.verified_insns, 0UL);
+  EXPECT_EQ(none.stack_depth, 0UL);
+}
+
 #ifdef HAVE_LIBBPF_BTF_DUMP
 
 #include "btf_common.h"
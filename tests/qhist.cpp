@@ -0,0 +1,91 @@
+#include <limits>
+
+#include "gtest/gtest.h"
+#include "qhist.h"
+
+namespace bpftrace {
+namespace test {
+namespace qhist {
+
+// Bucket index of a value as computed by the generated BPF code, see
+// CodegenLLVM::createQhistFunction()
+static size_t qhist_index(uint64_t n, int precision)
+{
+  if (n < (1ULL << precision))
+    return n;
+  int log2 = 63 - __builtin_clzll(n);
+  int shift = log2 - precision;
+  return ((shift + 1) << precision) + ((n >> shift) & ((1 << precision) - 1));
+}
+
+TEST(qhist, buckets)
+{
+  EXPECT_EQ(qhist_buckets(0), 65U);
+  EXPECT_EQ(qhist_buckets(3), 62U * 8);
+  EXPECT_EQ(qhist_buckets(QHIST_MAX_PRECISION), 60U * 32);
+
+  // The largest value falls into the last bucket
+  for (int precision = 0; precision <= QHIST_MAX_PRECISION; precision++)
+    EXPECT_EQ(qhist_index(std::numeric_limits<uint64_t>::max(), precision),
+              qhist_buckets(precision) - 1);
+}
+
+TEST(qhist, bounds_small_values)
+{
+  // Values below 2^precision have a bucket of their own
+  uint64_t low, high;
+  for (size_t i = 0; i < 8; i++)
+  {
+    qhist_bounds(i, 3, low, high);
+    EXPECT_EQ(low, i);
+    EXPECT_EQ(high, i);
+  }
+
+  qhist_bounds(8, 3, low, high);
+  EXPECT_EQ(low, 8U);
+  EXPECT_EQ(high, 8U);
+  qhist_bounds(16, 3, low, high);
+  EXPECT_EQ(low, 16U);
+  EXPECT_EQ(high, 17U);
+  qhist_bounds(23, 3, low, high);
+  EXPECT_EQ(low, 30U);
+  EXPECT_EQ(high, 31U);
+}
+
+TEST(qhist, bounds_contiguous)
+{
+  for (int precision = 0; precision <= QHIST_MAX_PRECISION; precision++)
+  {
+    uint64_t prev_high = 0;
+    for (size_t i = 0; i < qhist_buckets(precision); i++)
+    {
+      uint64_t low, high;
+      qhist_bounds(i, precision, low, high);
+      if (i > 0)
+        EXPECT_EQ(low, prev_high + 1) << "precision " << precision;
+      // No bucket is wider than 2^-precision of its values
+      EXPECT_LE((high - low) << precision, low) << "precision " << precision;
+      EXPECT_EQ(qhist_index(low, precision), i);
+      EXPECT_EQ(qhist_index(high, precision), i);
+      prev_high = high;
+    }
+    EXPECT_EQ(prev_high, std::numeric_limits<uint64_t>::max());
+  }
+}
+
+TEST(qhist, percentile)
+{
+  std::vector<uint64_t> counts(qhist_buckets(2));
+  EXPECT_EQ(qhist_percentile(counts, 2, 50), 0U);
+
+  // 10 values of 1, 10 values in the bucket of 100 (96-111)
+  counts[qhist_index(1, 2)] = 10;
+  counts[qhist_index(100, 2)] = 10;
+  EXPECT_EQ(qhist_percentile(counts, 2, 50), 1U);
+  EXPECT_EQ(qhist_percentile(counts, 2, 51), 111U);
+  EXPECT_EQ(qhist_percentile(counts, 2, 99.9), 111U);
+}
+
+} // namespace qhist
+} // namespace test
+} // namespace bpftrace
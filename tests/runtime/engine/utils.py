@@ -96,6 +96,7 @@ class Utils(object):
         output = p.communicate()[0]
         bpffeature = {}
         bpffeature["loop"] = output.find("Loop support: yes") != -1
+        bpffeature["bpf_call"] = output.find("BPF-to-BPF calls: yes") != -1
         bpffeature["probe_read_kernel"] = output.find("probe_read_kernel: yes") != -1
         bpffeature["btf"] = output.find("btf (depends on Build:libbpf): yes") != -1
         return bpffeature
@@ -351,6 +351,41 @@ TEST(semantic_analyser, call_hist)
   test("kprobe:f { hist() ? 0 : 1; }", 1);
 }
 
+TEST(semantic_analyser, call_qhist)
+{
+  test("kprobe:f { @ = qhist(5); }", 0);
+  test("kprobe:f { @[comm] = qhist(arg0, 0); }", 0);
+  test("kprobe:f { @ = qhist(nsecs, 5); print(@); clear(@); }", 0);
+  test("kprobe:f { qhist(5); }", 1);
+  test("kprobe:f { $x = qhist(5); }", 1);
+  test("kprobe:f { @ = qhist(); }", 1);
+  test("kprobe:f { @ = qhist(5, 3, 1); }", 1);
+  test("kprobe:f { @ = qhist(5, pid); }", 1);
+  test("kprobe:f { @ = qhist(\"str\"); }", 10);
+  test("kprobe:f { @ = qhist(5, 6); }", 10);
+  test("kprobe:f { @ = qhist(arg0, 2); @ = qhist(arg1, 2); }", 0);
+  test("kprobe:f { @ = qhist(arg0); @ = qhist(arg1, 3); }", 0);
+  test("kprobe:f { @ = qhist(arg0, 2); @ = qhist(arg1, 4); }", 10);
+  test("kprobe:f { @ = qhist(arg0); } kprobe:g { @ = qhist(arg1, 0); }", 10);
+}
+
+TEST(semantic_analyser, call_bhist)
+{
+  test("kprobe:f { @ = bhist(arg0, 1, 5, 10, 50, 100, 250); }", 0);
+  test("kprobe:f { @[comm] = bhist(arg0, 10); print(@); clear(@); }", 0);
+  test("kprobe:f { @ = bhist(arg0, 1, 2); @ = bhist(arg1, 1, 2); }", 0);
+  test("kprobe:f { bhist(arg0, 1); }", 1);
+  test("kprobe:f { $x = bhist(arg0, 1); }", 1);
+  test("kprobe:f { @ = bhist(arg0); }", 1);
+  test("kprobe:f { @ = bhist(arg0, pid); }", 1);
+  test("kprobe:f { @ = bhist(arg0, 1, pid); }", 1);
+  test("kprobe:f { @ = bhist(\"str\", 1); }", 10);
+  test("kprobe:f { @ = bhist(arg0, 5, 1); }", 10);
+  test("kprobe:f { @ = bhist(arg0, 1, 1); }", 10);
+  test("kprobe:f { @ = bhist(arg0, 1, 2); @ = bhist(arg1, 1, 3); }", 10);
+  test("kprobe:f { @ = bhist(arg0, 1, 2); $x = @; }", 1);
+}
+
 TEST(semantic_analyser, call_lhist)
 {
   test("kprobe:f { @ = lhist(5, 0, 10, 1); }", 0);
@@ -476,6 +511,14 @@ TEST(semantic_analyser, call_print)
   test("kprobe:f { @x = count(); if(print(@x)) { 123 } }", 10);
   test("kprobe:f { @x = count(); print(@x) ? 0 : 1; }", 10);
 
+  test("kprobe:f { @x = count(); print(@x, delta); }", 0);
+  test("kretprobe:f { @x[pid] = sum(retval); print(@x, delta); }", 0);
+  test("kprobe:f { @x = 1; print(@x, delta); }", 0);
+  test("kprobe:f { @x = count(); print(@x, delta, 10); }", 10);
+  test("kprobe:f { @x = hist(5); print(@x, delta); }", 10);
+  test("kprobe:f { @x = \"str\"; print(@x, delta); }", 10);
+  test("kprobe:f { @x = count(); print(@x, other); }", 1);
+
   test_for_warning("kprobe:f { @x = stats(10); print(@x, 2); }",
                    "top and div arguments are ignored");
   test_for_warning("kprobe:f { @x = stats(10); print(@x, 2, 3); }",
@@ -549,6 +592,78 @@ TEST(semantic_analyser, call_time)
   test("kprobe:f { time() ? 0 : 1; }", 10);
 }
 
+TEST(semantic_analyser, call_topk)
+{
+  test("kprobe:f { @x = topk(pid, 10); }", 0);
+  test("kprobe:f { @x = topk(comm, 10); }", 0);
+  test("kprobe:f { @x = topk(kstack, 1); }", 0);
+  test("kprobe:f { @x = topk(comm, 10); print(@x, 5); clear(@x); }", 0);
+  test("kprobe:f { topk(pid, 10); }", 1);
+  test("kprobe:f { $x = topk(pid, 10); }", 1);
+  test("kprobe:f { @x = topk(pid); }", 1);
+  test("kprobe:f { @x = topk(pid, pid); }", 1);
+  test("kprobe:f { @x = topk(pid, 0); }", 10);
+  test("kprobe:f { @x = topk(pid, 1001); }", 10);
+  test("kprobe:f { @x[tid] = topk(pid, 10); }", 10);
+  test("kprobe:f { @x = topk(curtask, 10); }", 10);
+  test("kprobe:f { @x = topk(pid, 10); @y = @x; }", 10);
+  test("kprobe:f { @x = topk(comm, 10); $y = @x; }", 1);
+}
+
+TEST(semantic_analyser, call_distinct)
+{
+  test("kprobe:f { @x = distinct(pid); }", 0);
+  test("kprobe:f { @x[comm] = distinct(tid, 12); }", 0);
+  test("kprobe:f { @x = distinct(comm, 4); print(@x); clear(@x); }", 0);
+  test("kprobe:f { @x = distinct(kstack); }", 0);
+  test("kprobe:f { distinct(pid); }", 1);
+  test("kprobe:f { $x = distinct(pid); }", 1);
+  test("kprobe:f { @x = distinct(); }", 1);
+  test("kprobe:f { @x = distinct(pid, 10, 1); }", 1);
+  test("kprobe:f { @x = distinct(pid, pid); }", 1);
+  test("kprobe:f { @x = distinct(pid, 3); }", 10);
+  test("kprobe:f { @x = distinct(pid, 13); }", 10);
+  test("kprobe:f { @x = distinct(curtask); }", 10);
+  test("kprobe:f { @x = distinct(pid); @y = distinct(pid, 8); @x = distinct(tid, 8); }",
+       1);
+  test("kprobe:f { @x = distinct(pid); $y = @x; }", 1);
+  test("kprobe:f { @x = distinct(pid); @y = @x; }", 10);
+}
+
+TEST(semantic_analyser, call_ratelimit)
+{
+  test("kprobe:f { if (ratelimit(10)) { printf(\"hi\"); } }", 0);
+  test("kprobe:f /ratelimit(1000000000)/ { @x = count(); }", 0);
+  test("kprobe:f { $x = ratelimit(1); }", 0);
+  test("kprobe:f { ratelimit(); }", 1);
+  test("kprobe:f { ratelimit(1, 2, 3); }", 1);
+  test("kprobe:f { ratelimit(pid); }", 1);
+  test("kprobe:f { ratelimit(\"str\"); }", 1);
+  test("kprobe:f { ratelimit(0); }", 10);
+  test("kprobe:f { ratelimit(1000000001); }", 10);
+
+  test("kprobe:f { if (ratelimit(10, pid)) { printf(\"hi\"); } }", 0);
+  test("kprobe:f /ratelimit(10, comm)/ { @x = count(); }", 0);
+  test("kprobe:f { ratelimit(10, str(arg0)); ratelimit(10, tid); }", 0);
+  test("kprobe:f { ratelimit(pid, pid); }", 1);
+  test("kprobe:f { ratelimit(10, kstack); }", 10);
+  test("kprobe:f { ratelimit(10, (1, 2)); }", 10);
+}
+
+TEST(semantic_analyser, call_sample)
+{
+  test("kprobe:f { if (sample(100)) { printf(\"hi\"); } }", 0);
+  test("kprobe:f /sample(1)/ { @x = count(); }", 0);
+  test("kprobe:f { sample(); }", 1);
+  test("kprobe:f { sample(pid); }", 1);
+  test("kprobe:f { if (sample(10, cpu)) { printf(\"hi\"); } }", 0);
+  test("kprobe:f { sample(10, comm); }", 0);
+  test("kprobe:f { sample(10, 1, 2); }", 1);
+  test("kprobe:f { sample(10, ustack); }", 10);
+  test("kprobe:f { sample(0); }", 10);
+  test("kprobe:f { sample(-1); }", 10);
+}
+
 TEST(semantic_analyser, call_strftime)
 {
   test("kprobe:f { strftime(\"%M:%S\", 1); }", 0);
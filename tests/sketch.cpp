@@ -0,0 +1,73 @@
+#include <cmath>
+
+#include "gtest/gtest.h"
+#include "sketch.h"
+
+namespace bpftrace {
+namespace test {
+namespace sketch {
+
+// Adds an integer to distinct() registers the way the generated BPF code
+// does, see CodegenLLVM::visit(Call &)
+static void distinct_add(std::vector<uint8_t> &registers, uint64_t value)
+{
+  int precision = std::log2(registers.size());
+  uint64_t hash = sketch_hash(reinterpret_cast<uint8_t *>(&value),
+                              sizeof(value));
+  hash ^= hash >> 32;
+  hash *= SKETCH_HASH_MULT;
+  hash ^= hash >> 29;
+
+  uint64_t index = hash >> (64 - precision);
+  uint64_t rest = (hash << precision) | (1ULL << (precision - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  registers[index] = std::max(registers[index], rank);
+}
+
+static uint64_t distinct_count(int precision, uint64_t n)
+{
+  std::vector<uint8_t> registers(1 << precision);
+  for (uint64_t i = 0; i < n; i++)
+    distinct_add(registers, i * 7919);
+  return distinct_estimate(registers);
+}
+
+TEST(sketch, distinct_estimate_empty)
+{
+  EXPECT_EQ(distinct_count(DISTINCT_DEFAULT_PRECISION, 0), 0U);
+}
+
+TEST(sketch, distinct_estimate_small)
+{
+  // Small counts are exact in practice
+  for (uint64_t n : { 1, 2, 5, 10, 20 })
+    EXPECT_EQ(distinct_count(DISTINCT_DEFAULT_PRECISION, n), n);
+}
+
+TEST(sketch, distinct_estimate_duplicates)
+{
+  std::vector<uint8_t> registers(1 << DISTINCT_DEFAULT_PRECISION);
+  for (int i = 0; i < 1000; i++)
+    distinct_add(registers, i % 10);
+  EXPECT_EQ(distinct_estimate(registers), 10U);
+}
+
+TEST(sketch, distinct_estimate_error)
+{
+  // Within three times the typical error of 1.04 / sqrt(2^precision)
+  for (int precision :
+       { DISTINCT_MIN_PRECISION, DISTINCT_DEFAULT_PRECISION, DISTINCT_MAX_PRECISION })
+  {
+    double max_error = 3 * 1.04 / std::sqrt(1 << precision);
+    for (uint64_t n : { 1000, 10000, 100000 })
+    {
+      double estimate = distinct_count(precision, n);
+      EXPECT_LE(std::abs(estimate - n) / n, max_error)
+          << "precision " << precision << ", " << n << " values";
+    }
+  }
+}
+
+} // namespace sketch
+} // namespace test
+} // namespace bpftrace
@@ -18,6 +18,12 @@ public:
   {
     return get_tracepoint_struct(format_file, category, event_name, bpftrace);
   }
+
+  static bool get_tracepoint_record_public(std::istream &format_file,
+                                           Struct &record)
+  {
+    return get_tracepoint_record(format_file, record);
+  }
 };
 
 TEST(tracepoint_format_parser, tracepoint_struct)
@@ -251,6 +257,70 @@ TEST(tracepoint_format_parser, tracepoint_struct_btf)
   EXPECT_THAT(bpftrace.btf_set_, Contains("size_t"));
 }
 
+TEST(tracepoint_format_parser, tracepoint_record)
+{
+  std::string input =
+      "name: sys_enter_read\n"
+      "ID: 650\n"
+      "format:\n"
+      "	field:unsigned short common_type;	offset:0;	size:2;	"
+      "signed:0;\n"
+      "	field:unsigned char common_flags;	offset:2;	size:1;	"
+      "signed:0;\n"
+      "	field:int common_pid;	offset:4;	size:4;	signed:1;\n"
+      "\n"
+      "	field:int __syscall_nr;	offset:8;	size:4;	signed:1;\n"
+      "	field:unsigned int fd;	offset:16;	size:8;	signed:0;\n"
+      "	field:const char *const * argv;	offset:24;	size:8;	signed:0;\n"
+      "	field:char comm[16];	offset:32;	size:16;	signed:1;\n"
+      "	field:u16 ports[2];	offset:48;	size:4;	signed:0;\n"
+      "	field:__data_loc char[] msg;	offset:52;	size:4;	signed:1;\n"
+      "	field:size_t count;	offset:56;	size:8;	signed:0;\n"
+      "\n"
+      "print fmt: \"fd: 0x%08lx\", ((unsigned long)(REC->fd))\n";
+
+  std::istringstream format_file(input);
+  Struct record;
+  ASSERT_TRUE(MockTracepointFormatParser::get_tracepoint_record_public(
+      format_file, record));
+
+  EXPECT_EQ(record.size, 64);
+  EXPECT_EQ(record.fields.size(), 15U);
+  EXPECT_EQ(record.fields["common_type"].type, CreateUInt16());
+  EXPECT_EQ(record.fields["common_flags"].offset, 2);
+  EXPECT_EQ(record.fields["__pad_3"].type, CreateInt8());
+  EXPECT_EQ(record.fields["common_pid"].type, CreateInt32());
+  EXPECT_EQ(record.fields["__pad_12"].offset, 12);
+  EXPECT_EQ(record.fields["fd"].type, CreateUInt64());
+  EXPECT_EQ(record.fields["fd"].offset, 16);
+  EXPECT_EQ(record.fields["argv"].type,
+            CreatePointer(CreatePointer(CreateInt8())));
+  EXPECT_EQ(record.fields["comm"].type, CreateString(16));
+  EXPECT_EQ(record.fields["ports"].type, CreateArray(2, CreateUInt16()));
+  EXPECT_EQ(record.fields["data_loc_msg"].type, CreateInt32());
+  EXPECT_EQ(record.fields["count"].type, CreateUInt64());
+  EXPECT_EQ(record.fields["count"].offset, 56);
+}
+
+TEST(tracepoint_format_parser, tracepoint_record_needs_headers)
+{
+  // These are left to clang
+  for (auto field : { "struct sock * sk;	offset:8;	size:8;",
+                      "kuid_t uid;	offset:8;	size:4;	signed:0;",
+                      "struct in6_addr addr;	offset:8;	size:16;",
+                      "char name[TASK_COMM_LEN];	offset:8;	size:16;" })
+  {
+    std::istringstream format_file(
+        "	field:unsigned short common_type;	offset:0;	size:2;	"
+        "signed:0;\n	field:" +
+        std::string(field) + "\n");
+    Struct record;
+    EXPECT_FALSE(MockTracepointFormatParser::get_tracepoint_record_public(
+        format_file, record))
+        << field;
+  }
+}
+
 } // namespace tracepoint_format_parser
 } // namespace test
 } // namespace bpftrace